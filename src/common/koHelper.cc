@@ -12,6 +12,7 @@
 //             
 // ******************************************************
 #include "koHelper.hh"
+#include "koScanner.hh"
 #include <iostream>
 koHelper::koHelper()
 {}
@@ -145,13 +146,12 @@ int koHelper::UpdateRunInfo(koRunInfo_t &fRunInfo, string startedby,
    return 0;
 }
 
-u_int32_t koHelper::GetTimeStamp(u_int32_t *buffer)
+u_int32_t koHelper::GetTimeStamp(u_int32_t *buffer, u_int32_t nWords)
 //Pull a time stamp out of a CAEN header
 {
-  int pnt = 0;
-  while((buffer[pnt])==0xFFFFFFFF) //filler between events                          
-    pnt++;
-  if((buffer[pnt]>>20)==0xA00)   { //look for a header                              
+  //filler between events
+  u_int32_t pnt = koScanner::SkipFiller(buffer, 0, nWords);
+  if(pnt+3<nWords && (buffer[pnt]>>20)==0xA00)   { //look for a header
     pnt+=3;
     return (buffer[pnt] & 0x7FFFFFFF);
   }
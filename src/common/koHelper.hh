@@ -191,8 +191,9 @@ class koHelper
   
    // Function    : GetTimeStamp
    // Purpose     : Returns the time stamp out the the header of a CAEN block
+   //               of nWords words. 0xFFFFFFFF if there is no header.
    //
-   static u_int32_t GetTimeStamp(u_int32_t *buffer);
+   static u_int32_t GetTimeStamp(u_int32_t *buffer, u_int32_t nWords);
   
   // Function      : ProcessLineHex
   // Purpose       : Parse a line containing hex integers
@@ -4,7 +4,49 @@
 #include <fstream>
 #include <iostream>
 
-koOptions::koOptions(){ fLoaded=false; }
+// Schema for run_config_t. Options not marked as required fall back to
+// the default given here if they are missing from the file. None are
+// required for now, run mode files written for older versions leave
+// some of these out.
+struct run_config_field_t{
+  const char         *name;
+  int run_config_t::*field;
+  int                 default_value;
+  bool                required;
+};
+
+static const run_config_field_t g_RunConfigSchema[] = {
+  { "processing_mode",              &run_config_t::processing_mode,              0,     false },
+  { "processing_num_threads",       &run_config_t::processing_num_threads,       1,     false },
+  { "processing_readout_threshold", &run_config_t::processing_readout_threshold, 0,     false },
+  { "write_mode",                   &run_config_t::write_mode,                   0,     false },
+  { "compression",                  &run_config_t::compression,                  0,     false },
+  { "adaptive_compression",         &run_config_t::adaptive_compression,         0,     false },
+  { "block_compression",            &run_config_t::block_compression,            0,     false },
+  { "bundle_documents",             &run_config_t::bundle_documents,             0,     false },
+  { "codec_level",                  &run_config_t::codec_level,                  0,     false },
+  { "occurrence_integral",          &run_config_t::occurrence_integral,          0,     false },
+  { "occurrence_features",          &run_config_t::occurrence_features,          0,     false },
+  { "occurrence_width_threshold",   &run_config_t::occurrence_width_threshold,   10,    false },
+  { "debug_output",                 &run_config_t::debug_output,                 0,     false },
+  { "lite_mode",                    &run_config_t::lite_mode,                    0,     false },
+  { "rotating_collections",         &run_config_t::rotating_collections,         0,     false },
+  { "run_start",                    &run_config_t::run_start,                    0,     false },
+  { "blt_size",                     &run_config_t::blt_size,                     524288, false },
+  { "blt_pool_size",                &run_config_t::blt_pool_size,                100,   false },
+  { "parallel_readout",             &run_config_t::parallel_readout,             0,     false },
+  { "ordered_processing",           &run_config_t::ordered_processing,           0,     false },
+  { "read_busy_last",               &run_config_t::read_busy_last,               0,     false },
+  { "baseline_mode",                &run_config_t::baseline_mode,                0,     false },
+  { "baseline_level",               &run_config_t::baseline_level,               16000, false },
+  { "file_size_mb",                 &run_config_t::file_size_mb,                 1024,  false },
+  { "time_chunk_ms",                &run_config_t::time_chunk_ms,                0,     false },
+};
+
+koOptions::koOptions(){ 
+  fLoaded=false; 
+  BuildRunConfig();
+}
 
 koOptions::~koOptions(){}
 
@@ -31,11 +73,92 @@ int koOptions::ReadParameterFile(string filename){
     std::cout<<"Error parsing file. Is it valid json?"<<std::endl;
     return -1;
   }
+  BuildRunConfig();
+  if(m_sConfigErrors != ""){
+    std::cout<<"Invalid options in "<<filename<<": "<<m_sConfigErrors<<std::endl;
+    return -1;
+  }
   fLoaded=true;
   cout<<"Read parameter file from "<<filename<<endl;
   return 0;
 }
 
+void koOptions::SetBSON(mongo::BSONObj bson){
+  m_bson = bson;
+  BuildRunConfig();
+}
+
+void koOptions::BuildRunConfig(){
+  
+  // Build into a fresh struct so a failed field never leaves a value
+  // from the previous options behind
+  run_config_t config;
+  stringstream errors;
+  for(unsigned int x=0; x<sizeof(g_RunConfigSchema)/sizeof(g_RunConfigSchema[0]); x++){
+    const run_config_field_t &f = g_RunConfigSchema[x];
+    config.*(f.field) = f.default_value;
+    if(!m_bson.hasField(f.name)){
+      if(f.required)
+	errors<<"missing required option '"<<f.name<<"'. ";
+      continue;
+    }
+    mongo::BSONElement e = m_bson[f.name];
+    if(!e.isNumber()){
+      errors<<"option '"<<f.name<<"' must be an integer. ";
+      continue;
+    }
+    config.*(f.field) = e.numberInt();
+  }
+
+  // The codec is given by name. Old option files only have the
+  // compression flag, which means snappy.
+  config.codec = (config.compression == 1) ? CODEC_SNAPPY : CODEC_NONE;
+  if(m_bson.hasField("codec")){
+    mongo::BSONElement e = m_bson["codec"];
+    string name = (e.type() == mongo::String) ? e.String() : "";
+    if(name == "none")
+      config.codec = CODEC_NONE;
+    else if(name == "snappy")
+      config.codec = CODEC_SNAPPY;
+    else if(name == "lz4")
+      config.codec = CODEC_LZ4;
+    else if(name == "zstd")
+      config.codec = CODEC_ZSTD;
+    else if(name == "v1724")
+      config.codec = CODEC_V1724;
+    else
+      errors<<"option 'codec' must be one of none, snappy, lz4, zstd, v1724. ";
+  }
+
+  if(config.write_mode < WRITEMODE_NONE || config.write_mode > WRITEMODE_BINARY)
+    errors<<"option 'write_mode' must be between 0 and 3. ";
+  if(config.file_size_mb < 0)
+    errors<<"option 'file_size_mb' can't be negative. ";
+  if(config.time_chunk_ms < 0)
+    errors<<"option 'time_chunk_ms' can't be negative. ";
+  if(config.bundle_documents < BUNDLE_NONE || config.bundle_documents > BUNDLE_BOARD)
+    errors<<"option 'bundle_documents' must be 0, 1 or 2. ";
+  // Only the mongodb recorder writes bundles and the protobuf files can't
+  // hold a compressed block, the others would ignore these
+  if(config.bundle_documents != BUNDLE_NONE && config.write_mode != WRITEMODE_MONGODB)
+    errors<<"option 'bundle_documents' needs write_mode 2. ";
+  if(config.block_compression != 0 && config.write_mode != WRITEMODE_MONGODB &&
+     config.write_mode != WRITEMODE_BINARY)
+    errors<<"option 'block_compression' needs write_mode 2 or 3. ";
+
+  if(m_bson.hasField("mongo") && m_bson["mongo"].type() != mongo::Object)
+    errors<<"option 'mongo' must be an object. ";
+  config.mongo = ParseMongoOptions();
+  // A bulk insert goes out as one message and the server takes at most 48 MB
+  if(config.mongo.insert_bytes < 0 || config.mongo.insert_bytes > 32*1024*1024)
+    errors<<"option 'mongo.insert_bytes' must be between 0 and 32 MB. ";
+  if(config.mongo.max_insert_docs < 0 || config.mongo.insert_deadline_ms < 0)
+    errors<<"options 'mongo.max_insert_docs' and 'mongo.insert_deadline_ms' can't be negative. ";
+
+  m_runConfig = config;
+  m_sConfigErrors = errors.str();
+}
+
 int koOptions::GetArraySize(string key){
   try{
     return m_bson[key].Array().size();
@@ -94,15 +217,16 @@ void koOptions::SetString(string field_name, string value){
   builder.append(field_name, value);
   builder.appendElementsUnique(m_bson);
   m_bson = builder.obj();
-
+  BuildRunConfig();
 }
 void koOptions::SetInt(string field_name, int value){
   mongo::BSONObjBuilder builder;
   builder.append(field_name, value);
   builder.appendElementsUnique(m_bson);
   m_bson = builder.obj();
+  BuildRunConfig();
 }
-mongo_option_t koOptions::GetMongoOptions(){
+mongo_option_t koOptions::ParseMongoOptions(){
 
   mongo_option_t ret;
   ret.address = "";
@@ -115,6 +239,15 @@ mongo_option_t koOptions::GetMongoOptions(){
   ret.shard_string = "";
   ret.write_concern = 0;
   ret.min_insert_size = 1;
+  ret.max_insert_docs = 10000;
+  ret.insert_bytes = 4*1024*1024;
+  ret.insert_deadline_ms = 100;
+  ret.write_queue_depth = 4;
+  ret.connections_per_host = 0;
+  ret.spill_path = "";
+  ret.spill_latency_ms = 0;
+  ret.spill_chunk_mb = 256;
+  ret.progress_interval_ms = 0;
   ret.indices = vector<string>();
   ret.hosts = map<string, string>();
   
@@ -187,8 +320,42 @@ mongo_option_t koOptions::GetMongoOptions(){
     ret.write_concern = mongo_obj["write_concern"].Int();
   } catch ( ... ) {}
 
+  // Old configs only have min_insert_size, which sent an insert as soon
+  // as there were more documents than that
   try{
     ret.min_insert_size = mongo_obj["min_insert_size"].Int();
+    ret.max_insert_docs = ret.min_insert_size + 1;
+  } catch ( ... ) {}
+  try{
+    ret.max_insert_docs = mongo_obj["max_insert_docs"].Int();
+  } catch ( ... ) {}
+  try{
+    ret.insert_bytes = mongo_obj["insert_bytes"].Int();
+  } catch ( ... ) {}
+  try{
+    ret.insert_deadline_ms = mongo_obj["insert_deadline_ms"].Int();
+  } catch ( ... ) {}
+
+  try{
+    ret.write_queue_depth = mongo_obj["write_queue_depth"].Int();
+  } catch ( ... ) {}
+
+  try{
+    ret.connections_per_host = mongo_obj["connections_per_host"].Int();
+  } catch ( ... ) {}
+
+  // Spilling to local disk
+  try{
+    ret.spill_path = mongo_obj["spill_path"].String();
+  } catch ( ... ) {}
+  try{
+    ret.spill_latency_ms = mongo_obj["spill_latency_ms"].Int();
+  } catch ( ... ) {}
+  try{
+    ret.spill_chunk_mb = mongo_obj["spill_chunk_mb"].Int();
+  } catch ( ... ) {}
+  try{
+    ret.progress_interval_ms = mongo_obj["progress_interval_ms"].Int();
   } catch ( ... ) {}
 
   // Split hosts. If there is a split hosts options set then
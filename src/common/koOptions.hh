@@ -11,6 +11,19 @@ using namespace std;
 #define WRITEMODE_NONE    0
 #define WRITEMODE_FILE    1
 #define WRITEMODE_MONGODB 2
+#define WRITEMODE_BINARY  3 // kodiaq binary files, see BinaryFile
+
+// Payload compression codecs. These values are written to the output.
+#define CODEC_NONE   0
+#define CODEC_SNAPPY 1
+#define CODEC_LZ4    2
+#define CODEC_ZSTD   3
+#define CODEC_V1724  4    // koSampleCodec
+
+// How pulses are grouped into mongodb documents (bundle_documents)
+#define BUNDLE_NONE     0 // One document per pulse
+#define BUNDLE_CHANNEL  1 // One per board and channel in each batch
+#define BUNDLE_BOARD    2 // One per board in each batch
 
 /*! \brief Stores configuration information for an optical link.
  */
@@ -52,12 +65,68 @@ struct mongo_option_t{
   bool unordered_bulk_inserts;
   bool sharding;  
   string shard_string;
-  int min_insert_size;
+  int min_insert_size;     // Old configs only, see max_insert_docs
+  // An insert is sent when it reaches max_insert_docs documents or
+  // insert_bytes, or when its first document is insert_deadline_ms old.
+  // 0 turns a limit off.
+  int max_insert_docs;
+  int insert_bytes;
+  int insert_deadline_ms;
+  int write_queue_depth;   // Inserts each processor may have queued
+  int connections_per_host; // 0 = one per processor
+  // Inserts go to a local file in this directory while the writers are
+  // backed up or no host is left ("" = never)
+  string spill_path;
+  int spill_latency_ms;    // Also spill while inserts take longer (0 = off)
+  int spill_chunk_mb;      // The file grows in steps of this
+  // Each module's written time goes to <collection>_progress at most
+  // this often (0 = never)
+  int progress_interval_ms;
   int write_concern;
+  // Reader name or module number -> buffer host address
   map <string, string> hosts;
   vector<string> indices;
 };
 
+/*! \brief Typed snapshot of the options used while the run is going.
+
+    Built from the BSON every time the options are loaded or changed and
+    checked against the schema in koOptions.cc. Code that runs per BLT,
+    pulse or insert reads this instead of doing string lookups through
+    GetInt/HasField. Flags are kept as ints with the same values the
+    option file uses.
+ */
+struct run_config_t{
+  int processing_mode;
+  int processing_num_threads;
+  int processing_readout_threshold;
+  int write_mode;
+  int compression;
+  int codec;              // CODEC_*, from "codec" or else "compression"
+  int codec_level;
+  int adaptive_compression;
+  int block_compression;  // Bundles with a binary index, BUNDLE_BOARD if unset.
+                          // Binary output compresses each chunk as a block.
+  int bundle_documents;   // BUNDLE_*
+  int occurrence_integral;
+  int occurrence_features;
+  int occurrence_width_threshold;
+  int debug_output;
+  int lite_mode;
+  int rotating_collections;
+  int run_start;
+  int blt_size;
+  int blt_pool_size;
+  int parallel_readout;
+  int ordered_processing;
+  int read_busy_last;
+  int baseline_mode;
+  int baseline_level;
+  int file_size_mb;       // Binary files rotate at this size (0 = never)
+  int time_chunk_ms;      // Length of the time chunks (0 = no chunks)
+  mongo_option_t mongo;
+};
+
 struct ddc10_option_t{
   int component_status;
   int outer_ring_factor;
@@ -85,9 +154,7 @@ public:
 
   int Loaded(){ return fLoaded;}
   int ReadParameterFile(string filename);
-  void SetBSON(mongo::BSONObj bson){
-    m_bson = bson;
-  };
+  void SetBSON(mongo::BSONObj bson);
   mongo::BSONObj ExportBSON(){
     return m_bson;
   };
@@ -125,7 +192,19 @@ public:
   void ToStream(stringstream *retstream){
     (*retstream)<<m_bson.jsonString();
   };
-  mongo_option_t GetMongoOptions();
+  mongo_option_t GetMongoOptions(){
+    return m_runConfig.mongo;
+  };
+  // Typed options, rebuilt whenever the BSON changes. Do not hold on to
+  // the reference across a reload.
+  const run_config_t& GetRunConfig(){
+    return m_runConfig;
+  };
+  // Problems found checking the options against the schema. Empty if
+  // the options are fine.
+  string GetConfigErrors(){
+    return m_sConfigErrors;
+  };
   void ToStream_MongoUpdate(string run_name, stringstream *retstream,
 			    string host_name="");
   ddc10_option_t GetDDC10Options();
@@ -134,7 +213,11 @@ public:
 private:
   int GetArraySize(string key);
   mongo::BSONElement GetField(string key);
+  mongo_option_t ParseMongoOptions();
+  void BuildRunConfig();
   mongo::BSONObj m_bson;
+  run_config_t m_runConfig;
+  string m_sConfigErrors;
   bool fLoaded;
   ofstream m_profilefile;
   bool bProfiling;
@@ -0,0 +1,226 @@
+// *********************************************************
+//
+// kodiaq Data Acquisition Software
+//
+// Date     : 16.10.2026
+// File     : koPulse.cc
+//
+// Brief    : Single pass feature extraction for V1724 pulses
+// **********************************************************
+
+#include <cstddef>
+#include "koPulse.hh"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define KOPULSE_SSE2
+#include <emmintrin.h>
+#if (__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)
+#define KOPULSE_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+#define KOPULSE_SAMPLE_MASK 0x3FFF
+// Larger than any 14-bit sample
+#define KOPULSE_NO_MIN      0x7FFF
+// Iterations per chunk. Keeps the 16-bit counters and iteration indices
+// and the 32-bit sums in the vector registers from overflowing.
+#define KOPULSE_CHUNK       8192
+
+// Running totals over the samples after the baseline
+struct pulse_sums_t{
+  long long  sum;
+  int        min;
+  u_int32_t  minPos;
+  u_int32_t  count;
+};
+
+typedef void (*analyze_range_fn)(const u_int32_t*, u_int32_t, u_int32_t,
+				 int, pulse_sums_t*);
+
+// Counts samples below limit, so limit is the baseline minus the threshold
+static void AnalyzeRangeScalar(const u_int32_t *buffer, u_int32_t idx,
+			       u_int32_t nWords, int limit, pulse_sums_t *r)
+{
+  for(; idx<nWords; idx++){
+    int first  = buffer[idx]&KOPULSE_SAMPLE_MASK;
+    int second = (buffer[idx]>>16)&KOPULSE_SAMPLE_MASK;
+    r->sum += first + second;
+    if(first < r->min){
+      r->min = first;
+      r->minPos = 2*idx;
+    }
+    if(second < r->min){
+      r->min = second;
+      r->minPos = 2*idx+1;
+    }
+    r->count += (first < limit) + (second < limit);
+  }
+}
+
+// Merge per lane minima into the totals. Lane j of iteration i is sample
+// firstSample + i*nLanes + j.
+static void MergeLanes(const short *mins, const short *iters, int nLanes,
+		       u_int32_t firstSample, pulse_sums_t *r)
+{
+  for(int j=0; j<nLanes; j++){
+    if(mins[j] == KOPULSE_NO_MIN)
+      continue;
+    u_int32_t pos = firstSample + (u_int32_t)iters[j]*nLanes + j;
+    if(mins[j] < r->min || (mins[j] == r->min && pos < r->minPos)){
+      r->min = mins[j];
+      r->minPos = pos;
+    }
+  }
+}
+
+#ifdef KOPULSE_SSE2
+static void AnalyzeRangeSSE2(const u_int32_t *buffer, u_int32_t idx,
+			     u_int32_t nWords, int limit, pulse_sums_t *r)
+{
+  const __m128i mask = _mm_set1_epi32((KOPULSE_SAMPLE_MASK<<16)|KOPULSE_SAMPLE_MASK);
+  const __m128i one  = _mm_set1_epi16(1);
+  const __m128i lim  = _mm_set1_epi16((short)limit);
+  while(idx+4 <= nWords){
+    u_int32_t chunkStart = idx;
+    __m128i vsum  = _mm_setzero_si128();
+    __m128i vcnt  = _mm_setzero_si128();
+    __m128i vidx  = _mm_setzero_si128();
+    __m128i vit   = _mm_setzero_si128();
+    __m128i vmin  = _mm_set1_epi16(KOPULSE_NO_MIN);
+    for(int it=0; it<KOPULSE_CHUNK && idx+4 <= nWords; it++, idx+=4){
+      __m128i v  = _mm_and_si128(_mm_loadu_si128((const __m128i*)(buffer+idx)), mask);
+      vsum = _mm_add_epi32(vsum, _mm_madd_epi16(v, one));
+      vcnt = _mm_sub_epi16(vcnt, _mm_cmplt_epi16(v, lim));
+      __m128i lt = _mm_cmplt_epi16(v, vmin);
+      vmin = _mm_min_epi16(v, vmin);
+      vidx = _mm_or_si128(_mm_and_si128(lt, vit), _mm_andnot_si128(lt, vidx));
+      vit  = _mm_add_epi16(vit, one);
+    }
+    int sums[4];
+    short cnts[8], mins[8], iters[8];
+    _mm_storeu_si128((__m128i*)sums, vsum);
+    _mm_storeu_si128((__m128i*)cnts, vcnt);
+    _mm_storeu_si128((__m128i*)mins, vmin);
+    _mm_storeu_si128((__m128i*)iters, vidx);
+    for(int j=0; j<4; j++)
+      r->sum += sums[j];
+    for(int j=0; j<8; j++)
+      r->count += (unsigned short)cnts[j];
+    MergeLanes(mins, iters, 8, 2*chunkStart, r);
+  }
+  AnalyzeRangeScalar(buffer, idx, nWords, limit, r);
+}
+#endif
+
+#ifdef KOPULSE_AVX2
+__attribute__((target("avx2")))
+static void AnalyzeRangeAVX2(const u_int32_t *buffer, u_int32_t idx,
+			     u_int32_t nWords, int limit, pulse_sums_t *r)
+{
+  const __m256i mask = _mm256_set1_epi32((KOPULSE_SAMPLE_MASK<<16)|KOPULSE_SAMPLE_MASK);
+  const __m256i one  = _mm256_set1_epi16(1);
+  const __m256i lim  = _mm256_set1_epi16((short)limit);
+  while(idx+8 <= nWords){
+    u_int32_t chunkStart = idx;
+    __m256i vsum  = _mm256_setzero_si256();
+    __m256i vcnt  = _mm256_setzero_si256();
+    __m256i vidx  = _mm256_setzero_si256();
+    __m256i vit   = _mm256_setzero_si256();
+    __m256i vmin  = _mm256_set1_epi16(KOPULSE_NO_MIN);
+    for(int it=0; it<KOPULSE_CHUNK && idx+8 <= nWords; it++, idx+=8){
+      __m256i v  = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(buffer+idx)), mask);
+      vsum = _mm256_add_epi32(vsum, _mm256_madd_epi16(v, one));
+      vcnt = _mm256_sub_epi16(vcnt, _mm256_cmpgt_epi16(lim, v));
+      __m256i lt = _mm256_cmpgt_epi16(vmin, v);
+      vmin = _mm256_min_epi16(v, vmin);
+      vidx = _mm256_blendv_epi8(vidx, vit, lt);
+      vit  = _mm256_add_epi16(vit, one);
+    }
+    int sums[8];
+    short cnts[16], mins[16], iters[16];
+    _mm256_storeu_si256((__m256i*)sums, vsum);
+    _mm256_storeu_si256((__m256i*)cnts, vcnt);
+    _mm256_storeu_si256((__m256i*)mins, vmin);
+    _mm256_storeu_si256((__m256i*)iters, vidx);
+    for(int j=0; j<8; j++)
+      r->sum += sums[j];
+    for(int j=0; j<16; j++)
+      r->count += (unsigned short)cnts[j];
+    MergeLanes(mins, iters, 16, 2*chunkStart, r);
+  }
+  AnalyzeRangeSSE2(buffer, idx, nWords, limit, r);
+}
+#endif
+
+// Pick the best implementation once, when the library is loaded
+static int SelectImplementation()
+{
+#ifdef KOPULSE_AVX2
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2"))
+    return 2;
+#endif
+#ifdef KOPULSE_SSE2
+  return 1;
+#endif
+  return 0;
+}
+
+static const int         g_implementation = SelectImplementation();
+
+static analyze_range_fn  g_analyzeRange =
+#ifdef KOPULSE_AVX2
+  (g_implementation == 2) ? AnalyzeRangeAVX2 :
+#endif
+#ifdef KOPULSE_SSE2
+  (g_implementation == 1) ? AnalyzeRangeSSE2 :
+#endif
+  AnalyzeRangeScalar;
+
+int koPulse::Analyze(const u_int32_t *buffer, u_int32_t nWords,
+		     u_int32_t baselineBins, int widthThreshold,
+		     pulse_features_t *features)
+{
+  features->baseline = features->integral = 0.;
+  features->max_amplitude = 0;
+  features->max_position = features->width = 0;
+
+  // The baseline covers whole words, so it needs an even number of bins
+  baselineBins -= baselineBins%2;
+  if(buffer == NULL || baselineBins < 2 || nWords <= baselineBins/2)
+    return -1;
+
+  long long baselineSum = 0;
+  for(u_int32_t i=0; i<baselineBins/2; i++)
+    baselineSum += (buffer[i]&KOPULSE_SAMPLE_MASK) +
+      ((buffer[i]>>16)&KOPULSE_SAMPLE_MASK);
+  int baseline = (int)(baselineSum/baselineBins);
+
+  pulse_sums_t sums;
+  sums.sum = 0;
+  sums.min = KOPULSE_NO_MIN;
+  sums.minPos = 0;
+  sums.count = 0;
+  g_analyzeRange(buffer, baselineBins/2, nWords, baseline-widthThreshold, &sums);
+
+  // integral = sum(baselineSum/baselineBins - sample), kept in integers
+  // until the very end
+  long long nSamples = 2*(long long)(nWords - baselineBins/2);
+  features->baseline = (float)((double)baselineSum/baselineBins);
+  features->integral = (float)((double)(nSamples*baselineSum -
+					(long long)baselineBins*sums.sum)/baselineBins);
+  features->max_amplitude = baseline - sums.min;
+  features->max_position = sums.minPos;
+  features->width = sums.count;
+  return 0;
+}
+
+const char* koPulse::Implementation()
+{
+  if(g_implementation == 2)
+    return "avx2";
+  if(g_implementation == 1)
+    return "sse2";
+  return "scalar";
+}
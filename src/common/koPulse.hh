@@ -0,0 +1,67 @@
+#ifndef _KOPULSE_HH_
+#define _KOPULSE_HH_
+
+// *********************************************************
+//
+// kodiaq Data Acquisition Software
+//
+// Date     : 16.10.2026
+// File     : koPulse.hh
+//
+// Brief    : Single pass feature extraction for V1724 pulses
+// **********************************************************
+
+#include <sys/types.h>
+
+using namespace std;
+
+// Bits of the occurrence_features option
+#define KOPULSE_BASELINE      0x01
+#define KOPULSE_INTEGRAL      0x02
+#define KOPULSE_MAX_AMPLITUDE 0x04
+#define KOPULSE_MAX_POSITION  0x08
+#define KOPULSE_WIDTH         0x10
+
+/*! \brief Features of one pulse.
+
+    Amplitudes are in ADC counts below the baseline since the V1724
+    pulses are negative. Positions and widths are in samples.
+ */
+struct pulse_features_t{
+  float     baseline;       // Mean of the baseline samples
+  float     integral;       // Sum of (baseline - sample) after the baseline
+  int       max_amplitude;  // Baseline minus the lowest sample
+  u_int32_t max_position;   // Index of the lowest sample (first if tied)
+  u_int32_t width;          // Samples more than threshold below baseline
+};
+
+//
+// Object   : koPulse
+// Brief    : Pulse kernels shared by the processors
+//
+// The first baselineBins samples give the baseline. Everything after them
+// is the pulse, which is analyzed in one pass with integer accumulators
+// (SSE2 or AVX2, picked once when the library is loaded, like koScanner).
+// The result does not depend on the instruction set.
+//
+class koPulse
+{
+ public:
+  // Function    : Analyze
+  // Purpose     : Fill features for the nWords data words (two 14-bit
+  //               samples each) in buffer. baselineBins is rounded down to
+  //               an even number and must be at least 2. Returns 0 on success
+  //               and -1 (features all zero) if the pulse is not longer than
+  //               the baseline.
+  //
+  static int Analyze(const u_int32_t *buffer, u_int32_t nWords,
+		     u_int32_t baselineBins, int widthThreshold,
+		     pulse_features_t *features);
+
+  // Function    : Implementation
+  // Purpose     : Name of the instruction set used ("avx2", "sse2", "scalar")
+  //
+  static const char* Implementation();
+};
+
+#endif
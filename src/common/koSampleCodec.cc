@@ -0,0 +1,290 @@
+// *********************************************************
+//
+// kodiaq Data Acquisition Software
+//
+// Date     : 16.10.2026
+// File     : koSampleCodec.cc
+//
+// Brief    : Lossless compression of packed digitizer samples
+// **********************************************************
+
+#include <cstring>
+#include "koSampleCodec.hh"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define KOSAMPLECODEC_SSE2
+#include <emmintrin.h>
+#endif
+
+#define KOSAMPLECODEC_VERSION 1
+#define KOSAMPLECODEC_BLOCK   128
+#define KOSAMPLECODEC_LANES   8
+#define KOSAMPLECODEC_ROWS    (KOSAMPLECODEC_BLOCK/KOSAMPLECODEC_LANES)
+#define KOSAMPLECODEC_HEADER  5
+
+static inline u_int16_t ReadSample(const char *buffer, u_int32_t index)
+{
+  u_int16_t s;
+  memcpy(&s, buffer+2*index, 2);
+  return s;
+}
+
+static inline u_int16_t ZigZag(u_int16_t delta)
+{
+  return (u_int16_t)((delta<<1) ^ (u_int16_t)(-(delta>>15)));
+}
+
+static inline u_int16_t UnZigZag(u_int16_t value)
+{
+  return (u_int16_t)((value>>1) ^ (u_int16_t)(-(value&1)));
+}
+
+static int BitWidth(u_int16_t bits)
+{
+  int width = 0;
+  while(bits != 0){
+    width++;
+    bits >>= 1;
+  }
+  return width;
+}
+
+// Zigzag coded differences for one block. Samples past the end of the
+// data are coded as 0. Returns the OR of all values.
+static u_int16_t DeltaBlock(const char *in, u_int32_t first, u_int32_t count,
+			    u_int16_t *prev, u_int16_t *values)
+{
+  u_int16_t bits = 0;
+  u_int32_t i = 0;
+#ifdef KOSAMPLECODEC_SSE2
+  if(count == KOSAMPLECODEC_BLOCK){
+    __m128i orv = _mm_setzero_si128();
+    __m128i last = _mm_cvtsi32_si128(*prev);
+    for(; i<KOSAMPLECODEC_BLOCK; i+=KOSAMPLECODEC_LANES){
+      __m128i cur = _mm_loadu_si128((const __m128i*)(in + 2*(first+i)));
+      // Each lane minus the lane before it, the first minus the last
+      // sample of the previous row
+      __m128i before = _mm_or_si128(_mm_slli_si128(cur, 2), last);
+      __m128i d = _mm_sub_epi16(cur, before);
+      __m128i z = _mm_xor_si128(_mm_slli_epi16(d, 1), _mm_srai_epi16(d, 15));
+      _mm_storeu_si128((__m128i*)(values+i), z);
+      orv  = _mm_or_si128(orv, z);
+      last = _mm_srli_si128(cur, 14);
+    }
+    orv = _mm_or_si128(orv, _mm_srli_si128(orv, 8));
+    orv = _mm_or_si128(orv, _mm_srli_si128(orv, 4));
+    orv = _mm_or_si128(orv, _mm_srli_si128(orv, 2));
+    *prev = (u_int16_t)_mm_cvtsi128_si32(last);
+    return (u_int16_t)_mm_cvtsi128_si32(orv);
+  }
+#endif
+  for(; i<KOSAMPLECODEC_BLOCK; i++){
+    values[i] = 0;
+    if(i >= count)
+      continue;
+    u_int16_t s = ReadSample(in, first+i);
+    values[i] = ZigZag((u_int16_t)(s - *prev));
+    *prev = s;
+    bits |= values[i];
+  }
+  return bits;
+}
+
+// Store 128 values with width bits each as width rows of 8 lanes. Lane j
+// holds the values j, j+8, j+16, ... back to back.
+static void PackBlock(const u_int16_t *values, int width, char *out)
+{
+  if(width == 0)
+    return;
+#ifdef KOSAMPLECODEC_SSE2
+  __m128i acc = _mm_setzero_si128();
+  int shift = 0;
+  for(int row=0; row<KOSAMPLECODEC_ROWS; row++){
+    __m128i v = _mm_loadu_si128((const __m128i*)(values + row*KOSAMPLECODEC_LANES));
+    acc = _mm_or_si128(acc, _mm_sll_epi16(v, _mm_cvtsi32_si128(shift)));
+    shift += width;
+    if(shift >= 16){
+      _mm_storeu_si128((__m128i*)out, acc);
+      out += 16;
+      shift -= 16;
+      acc = _mm_srl_epi16(v, _mm_cvtsi32_si128(width - shift));
+      if(shift == 0)
+	acc = _mm_setzero_si128();
+    }
+  }
+#else
+  for(int lane=0; lane<KOSAMPLECODEC_LANES; lane++){
+    u_int32_t acc = 0;
+    int shift = 0, word = 0;
+    for(int row=0; row<KOSAMPLECODEC_ROWS; row++){
+      acc |= (u_int32_t)values[row*KOSAMPLECODEC_LANES + lane] << shift;
+      shift += width;
+      if(shift >= 16){
+	u_int16_t w = (u_int16_t)acc;
+	memcpy(out + 16*word + 2*lane, &w, 2);
+	word++;
+	acc >>= 16;
+	shift -= 16;
+      }
+    }
+  }
+#endif
+}
+
+static void UnpackBlock(const char *in, int width, u_int16_t *values)
+{
+  if(width == 0){
+    memset(values, 0, KOSAMPLECODEC_BLOCK*sizeof(u_int16_t));
+    return;
+  }
+#ifdef KOSAMPLECODEC_SSE2
+  const __m128i mask = _mm_set1_epi16((short)((1<<width)-1));
+  __m128i cur = _mm_loadu_si128((const __m128i*)in);
+  int shift = 0, word = 0;
+  for(int row=0; row<KOSAMPLECODEC_ROWS; row++){
+    __m128i v = _mm_srl_epi16(cur, _mm_cvtsi32_si128(shift));
+    shift += width;
+    if(shift >= 16){
+      word++;
+      shift -= 16;
+      if(word < width){
+	cur = _mm_loadu_si128((const __m128i*)(in + 16*word));
+	if(shift > 0)
+	  v = _mm_or_si128(v, _mm_sll_epi16(cur, _mm_cvtsi32_si128(width - shift)));
+      }
+    }
+    _mm_storeu_si128((__m128i*)(values + row*KOSAMPLECODEC_LANES),
+		     _mm_and_si128(v, mask));
+  }
+#else
+  u_int32_t mask = (1u<<width)-1;
+  for(int lane=0; lane<KOSAMPLECODEC_LANES; lane++){
+    u_int32_t acc = 0;
+    int bits = 0, word = 0;
+    for(int row=0; row<KOSAMPLECODEC_ROWS; row++){
+      if(bits < width){
+	u_int16_t w;
+	memcpy(&w, in + 16*word + 2*lane, 2);
+	acc |= (u_int32_t)w << bits;
+	bits += 16;
+	word++;
+      }
+      values[row*KOSAMPLECODEC_LANES + lane] = (u_int16_t)(acc & mask);
+      acc >>= width;
+      bits -= width;
+    }
+  }
+#endif
+}
+
+// Undo zigzag and the differences, in place
+static void IntegrateBlock(u_int16_t *values, u_int16_t *prev)
+{
+  u_int32_t i = 0;
+#ifdef KOSAMPLECODEC_SSE2
+  const __m128i one = _mm_set1_epi16(1);
+  __m128i last = _mm_set1_epi16((short)*prev);
+  for(; i<KOSAMPLECODEC_BLOCK; i+=KOSAMPLECODEC_LANES){
+    __m128i z = _mm_loadu_si128((const __m128i*)(values+i));
+    __m128i d = _mm_xor_si128(_mm_srli_epi16(z, 1),
+			      _mm_sub_epi16(_mm_setzero_si128(), _mm_and_si128(z, one)));
+    // Running sum over the 8 lanes
+    d = _mm_add_epi16(d, _mm_slli_si128(d, 2));
+    d = _mm_add_epi16(d, _mm_slli_si128(d, 4));
+    d = _mm_add_epi16(d, _mm_slli_si128(d, 8));
+    d = _mm_add_epi16(d, last);
+    _mm_storeu_si128((__m128i*)(values+i), d);
+    last = _mm_shufflehi_epi16(d, 0xFF);
+    last = _mm_unpackhi_epi64(last, last);
+  }
+  *prev = (u_int16_t)_mm_cvtsi128_si32(last);
+#else
+  for(; i<KOSAMPLECODEC_BLOCK; i++){
+    *prev = (u_int16_t)(*prev + UnZigZag(values[i]));
+    values[i] = *prev;
+  }
+#endif
+}
+
+u_int32_t koSampleCodec::MaxEncodedLength(u_int32_t size)
+{
+  u_int32_t blocks = (size/2 + KOSAMPLECODEC_BLOCK - 1)/KOSAMPLECODEC_BLOCK;
+  return KOSAMPLECODEC_HEADER + 2 + blocks*(1 + 2*KOSAMPLECODEC_BLOCK) + 1;
+}
+
+u_int32_t koSampleCodec::Encode(const char *in, u_int32_t size, char *out)
+{
+  u_int32_t pos = 0;
+  out[pos++] = KOSAMPLECODEC_VERSION;
+  memcpy(out+pos, &size, 4);
+  pos += 4;
+
+  u_int32_t nSamples = size/2;
+  if(nSamples > 0){
+    u_int16_t prev = ReadSample(in, 0);
+    memcpy(out+pos, &prev, 2);
+    pos += 2;
+    u_int16_t values[KOSAMPLECODEC_BLOCK];
+    for(u_int32_t first=0; first<nSamples; first+=KOSAMPLECODEC_BLOCK){
+      u_int32_t count = nSamples - first;
+      if(count > KOSAMPLECODEC_BLOCK)
+	count = KOSAMPLECODEC_BLOCK;
+      int width = BitWidth(DeltaBlock(in, first, count, &prev, values));
+      out[pos++] = (char)width;
+      PackBlock(values, width, out+pos);
+      pos += 2*width*KOSAMPLECODEC_LANES;
+    }
+  }
+  if(size%2 == 1)
+    out[pos++] = in[size-1];
+  return pos;
+}
+
+int koSampleCodec::DecodedLength(const char *in, u_int32_t size,
+				 u_int32_t *decodedSize)
+{
+  if(in == NULL || size < KOSAMPLECODEC_HEADER ||
+     in[0] != KOSAMPLECODEC_VERSION)
+    return -1;
+  memcpy(decodedSize, in+1, 4);
+  return 0;
+}
+
+int koSampleCodec::Decode(const char *in, u_int32_t size, char *out,
+			  u_int32_t capacity)
+{
+  u_int32_t decodedSize = 0;
+  if(DecodedLength(in, size, &decodedSize) != 0 || decodedSize > capacity)
+    return -1;
+  u_int32_t pos = KOSAMPLECODEC_HEADER;
+
+  u_int32_t nSamples = decodedSize/2;
+  if(nSamples > 0){
+    if(pos+2 > size)
+      return -1;
+    u_int16_t prev;
+    memcpy(&prev, in+pos, 2);
+    pos += 2;
+    u_int16_t values[KOSAMPLECODEC_BLOCK];
+    for(u_int32_t first=0; first<nSamples; first+=KOSAMPLECODEC_BLOCK){
+      if(pos >= size)
+	return -1;
+      int width = (unsigned char)in[pos++];
+      if(width > 16 || pos + 2*width*KOSAMPLECODEC_LANES > size)
+	return -1;
+      UnpackBlock(in+pos, width, values);
+      pos += 2*width*KOSAMPLECODEC_LANES;
+      IntegrateBlock(values, &prev);
+      u_int32_t count = nSamples - first;
+      if(count > KOSAMPLECODEC_BLOCK)
+	count = KOSAMPLECODEC_BLOCK;
+      memcpy(out + 2*first, values, 2*count);
+    }
+  }
+  if(decodedSize%2 == 1){
+    if(pos >= size)
+      return -1;
+    out[decodedSize-1] = in[pos++];
+  }
+  return (int)decodedSize;
+}
@@ -0,0 +1,70 @@
+#ifndef _KOSAMPLECODEC_HH_
+#define _KOSAMPLECODEC_HH_
+
+// *********************************************************
+//
+// kodiaq Data Acquisition Software
+//
+// Date     : 16.10.2026
+// File     : koSampleCodec.hh
+//
+// Brief    : Lossless compression of packed digitizer samples
+// **********************************************************
+
+#include <sys/types.h>
+
+using namespace std;
+
+//
+// Object   : koSampleCodec
+// Brief    : Delta, zigzag and bit packing for 16-bit samples
+//
+// The V1724 stores two samples per 32-bit word, so a pulse payload read
+// as little endian 16-bit values is the sample sequence. Each sample is
+// replaced by its difference to the previous one, zigzag coded so small
+// negative steps stay small, and packed in blocks of 128 with as many
+// bits as the largest value in the block needs. All 16 bits of every
+// sample are kept, so any payload comes back bit for bit.
+//
+// Encoded layout (little endian):
+//   u8  version (1)
+//   u32 payload size in bytes
+//   u16 first sample (only if there is at least one sample)
+//   per block of 128 samples: u8 bit width b, then 16*b bytes holding
+//     the values in 8 interleaved 16-bit lanes
+//   the last byte of the payload if the size is odd
+//
+// This file only needs the C++ standard library so that tools reading
+// the data can build it on its own.
+//
+class koSampleCodec
+{
+ public:
+  // Function    : MaxEncodedLength
+  // Purpose     : Upper bound of the encoded size of a size byte payload
+  //
+  static u_int32_t MaxEncodedLength(u_int32_t size);
+
+  // Function    : Encode
+  // Purpose     : Encode size bytes from in into out, which must hold
+  //               MaxEncodedLength(size) bytes. Returns the encoded size.
+  //
+  static u_int32_t Encode(const char *in, u_int32_t size, char *out);
+
+  // Function    : DecodedLength
+  // Purpose     : Read the payload size from an encoded buffer. Returns -1
+  //               if this is not a valid encoded buffer.
+  //
+  static int       DecodedLength(const char *in, u_int32_t size,
+				 u_int32_t *decodedSize);
+
+  // Function    : Decode
+  // Purpose     : Decode in into out, which must hold DecodedLength bytes.
+  //               Returns the number of bytes written or -1 if the input
+  //               is corrupt or out is too small.
+  //
+  static int       Decode(const char *in, u_int32_t size, char *out,
+			  u_int32_t capacity);
+};
+
+#endif
@@ -0,0 +1,178 @@
+// *********************************************************
+//
+// kodiaq Data Acquisition Software
+//
+// Date     : 16.10.2026
+// File     : koScanner.cc
+//
+// Brief    : Fast search for headers and filler in raw V1724
+//            block transfers
+// **********************************************************
+
+#include <cstddef>
+#include "koScanner.hh"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define KOSCANNER_SSE2
+#include <emmintrin.h>
+// AVX2 intrinsics in a target attributed function need gcc 4.9
+#if (__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)
+#define KOSCANNER_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+#define KOSCANNER_HEADER_MASK  0xFFF00000
+#define KOSCANNER_HEADER       0xA0000000
+#define KOSCANNER_FILLER       0xFFFFFFFF
+
+typedef u_int32_t (*find_header_fn)(const u_int32_t*, u_int32_t, u_int32_t, bool);
+typedef u_int32_t (*skip_filler_fn)(const u_int32_t*, u_int32_t, u_int32_t);
+
+static u_int32_t FindHeaderScalar(const u_int32_t *buffer, u_int32_t idx,
+				  u_int32_t nWords, bool stopAtFiller)
+{
+  for(; idx<nWords; idx++){
+    if((buffer[idx]&KOSCANNER_HEADER_MASK) == KOSCANNER_HEADER)
+      return idx;
+    if(stopAtFiller && buffer[idx] == KOSCANNER_FILLER)
+      return idx;
+  }
+  return nWords;
+}
+
+static u_int32_t SkipFillerScalar(const u_int32_t *buffer, u_int32_t idx,
+				  u_int32_t nWords)
+{
+  while(idx<nWords && buffer[idx] == KOSCANNER_FILLER)
+    idx++;
+  return idx;
+}
+
+#ifdef KOSCANNER_SSE2
+// SSE2 is part of x86_64 so this needs no CPU check
+static u_int32_t FindHeaderSSE2(const u_int32_t *buffer, u_int32_t idx,
+				u_int32_t nWords, bool stopAtFiller)
+{
+  const __m128i mask   = _mm_set1_epi32((int)KOSCANNER_HEADER_MASK);
+  const __m128i header = _mm_set1_epi32((int)KOSCANNER_HEADER);
+  const __m128i filler = _mm_set1_epi32((int)KOSCANNER_FILLER);
+  for(; idx+4 <= nWords; idx+=4){
+    __m128i words = _mm_loadu_si128((const __m128i*)(buffer+idx));
+    __m128i hits  = _mm_cmpeq_epi32(_mm_and_si128(words, mask), header);
+    if(stopAtFiller)
+      hits = _mm_or_si128(hits, _mm_cmpeq_epi32(words, filler));
+    int bits = _mm_movemask_ps(_mm_castsi128_ps(hits));
+    if(bits != 0)
+      return idx + __builtin_ctz(bits);
+  }
+  return FindHeaderScalar(buffer, idx, nWords, stopAtFiller);
+}
+
+static u_int32_t SkipFillerSSE2(const u_int32_t *buffer, u_int32_t idx,
+				u_int32_t nWords)
+{
+  const __m128i filler = _mm_set1_epi32((int)KOSCANNER_FILLER);
+  for(; idx+4 <= nWords; idx+=4){
+    __m128i words = _mm_loadu_si128((const __m128i*)(buffer+idx));
+    int bits = (~_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(words, filler)))) & 0xF;
+    if(bits != 0)
+      return idx + __builtin_ctz(bits);
+  }
+  return SkipFillerScalar(buffer, idx, nWords);
+}
+#endif
+
+#ifdef KOSCANNER_AVX2
+__attribute__((target("avx2")))
+static u_int32_t FindHeaderAVX2(const u_int32_t *buffer, u_int32_t idx,
+				u_int32_t nWords, bool stopAtFiller)
+{
+  const __m256i mask   = _mm256_set1_epi32((int)KOSCANNER_HEADER_MASK);
+  const __m256i header = _mm256_set1_epi32((int)KOSCANNER_HEADER);
+  const __m256i filler = _mm256_set1_epi32((int)KOSCANNER_FILLER);
+  for(; idx+8 <= nWords; idx+=8){
+    __m256i words = _mm256_loadu_si256((const __m256i*)(buffer+idx));
+    __m256i hits  = _mm256_cmpeq_epi32(_mm256_and_si256(words, mask), header);
+    if(stopAtFiller)
+      hits = _mm256_or_si256(hits, _mm256_cmpeq_epi32(words, filler));
+    int bits = _mm256_movemask_ps(_mm256_castsi256_ps(hits));
+    if(bits != 0)
+      return idx + __builtin_ctz(bits);
+  }
+  return FindHeaderSSE2(buffer, idx, nWords, stopAtFiller);
+}
+
+__attribute__((target("avx2")))
+static u_int32_t SkipFillerAVX2(const u_int32_t *buffer, u_int32_t idx,
+				u_int32_t nWords)
+{
+  const __m256i filler = _mm256_set1_epi32((int)KOSCANNER_FILLER);
+  for(; idx+8 <= nWords; idx+=8){
+    __m256i words = _mm256_loadu_si256((const __m256i*)(buffer+idx));
+    int bits = (~_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(words, filler)))) & 0xFF;
+    if(bits != 0)
+      return idx + __builtin_ctz(bits);
+  }
+  return SkipFillerSSE2(buffer, idx, nWords);
+}
+#endif
+
+// Pick the best implementation once, when the library is loaded
+static int SelectImplementation()
+{
+#ifdef KOSCANNER_AVX2
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2"))
+    return 2;
+#endif
+#ifdef KOSCANNER_SSE2
+  return 1;
+#endif
+  return 0;
+}
+
+static const int       g_implementation = SelectImplementation();
+
+static find_header_fn  g_findHeader =
+#ifdef KOSCANNER_AVX2
+  (g_implementation == 2) ? FindHeaderAVX2 :
+#endif
+#ifdef KOSCANNER_SSE2
+  (g_implementation == 1) ? FindHeaderSSE2 :
+#endif
+  FindHeaderScalar;
+
+static skip_filler_fn  g_skipFiller =
+#ifdef KOSCANNER_AVX2
+  (g_implementation == 2) ? SkipFillerAVX2 :
+#endif
+#ifdef KOSCANNER_SSE2
+  (g_implementation == 1) ? SkipFillerSSE2 :
+#endif
+  SkipFillerScalar;
+
+u_int32_t koScanner::FindHeader(const u_int32_t *buffer, u_int32_t start,
+				u_int32_t nWords, bool stopAtFiller)
+{
+  if(buffer == NULL || start >= nWords)
+    return nWords;
+  return g_findHeader(buffer, start, nWords, stopAtFiller);
+}
+
+u_int32_t koScanner::SkipFiller(const u_int32_t *buffer, u_int32_t start,
+				u_int32_t nWords)
+{
+  if(buffer == NULL || start >= nWords)
+    return nWords;
+  return g_skipFiller(buffer, start, nWords);
+}
+
+const char* koScanner::Implementation()
+{
+  if(g_implementation == 2)
+    return "avx2";
+  if(g_implementation == 1)
+    return "sse2";
+  return "scalar";
+}
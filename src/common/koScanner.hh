@@ -0,0 +1,54 @@
+#ifndef _KOSCANNER_HH_
+#define _KOSCANNER_HH_
+
+// *********************************************************
+//
+// kodiaq Data Acquisition Software
+//
+// Date     : 16.10.2026
+// File     : koScanner.hh
+//
+// Brief    : Fast search for headers and filler in raw V1724
+//            block transfers
+// **********************************************************
+
+#include <sys/types.h>
+
+using namespace std;
+
+//
+// Object   : koScanner
+// Brief    : Word scanning shared by all CAEN parsers
+//
+// The searches are done several words at a time with SSE2 (or AVX2 where
+// the CPU has it). The implementation is picked once when the library is
+// loaded. Machines without either use a plain loop with the same result.
+// Only use these to look for the next event. Data words inside an event
+// can look like headers.
+//
+class koScanner
+{
+ public:
+  // Function    : FindHeader
+  // Purpose     : Returns the index of the first word at or after start
+  //               which is a CAEN event header ((word>>20)==0xA00). If
+  //               stopAtFiller is set, 0xFFFFFFFF filler words also stop
+  //               the search. Returns nWords if nothing was found.
+  //
+  static u_int32_t FindHeader(const u_int32_t *buffer, u_int32_t start,
+			      u_int32_t nWords, bool stopAtFiller=false);
+
+  // Function    : SkipFiller
+  // Purpose     : Returns the index of the first word at or after start
+  //               which is not 0xFFFFFFFF filler, or nWords if there is none
+  //
+  static u_int32_t SkipFiller(const u_int32_t *buffer, u_int32_t start,
+			      u_int32_t nWords);
+
+  // Function    : Implementation
+  // Purpose     : Name of the instruction set used ("avx2", "sse2", "scalar")
+  //
+  static const char* Implementation();
+};
+
+#endif
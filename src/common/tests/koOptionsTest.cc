@@ -0,0 +1,94 @@
+// ****************************************************************
+//
+// kodiaq Data Acquisition Software
+//
+// File     : koOptionsTest.cc
+// Date     : 16.10.2026
+//
+// Brief    : Checks that the shipped option file parses and that its
+//            mongo settings end up in the run config
+//
+// *****************************************************************
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include "koOptions.hh"
+#include "mongo/db/json.h"
+
+#ifndef KODIAQ_CONFIG_DIR
+#define KODIAQ_CONFIG_DIR "../../daq_config"
+#endif
+
+using namespace std;
+
+static int g_iFailed = 0;
+
+static void Check(bool ok, string what)
+{
+  if(!ok){
+    cout<<"FAILED: "<<what<<endl;
+    g_iFailed++;
+  }
+}
+
+// Settings that ParseMongoOptions reads from the "mongo" object. Each has
+// to be there and not as a flat mongo_<name> key, which nothing reads.
+struct mongo_key_t{
+  const char         *name;
+  int mongo_option_t::*field;     // NULL if not an int
+};
+
+static const mongo_key_t g_MongoKeys[] = {
+  { "write_queue_depth",     &mongo_option_t::write_queue_depth },
+  { "max_insert_docs",       &mongo_option_t::max_insert_docs },
+  { "insert_bytes",          &mongo_option_t::insert_bytes },
+  { "insert_deadline_ms",    &mongo_option_t::insert_deadline_ms },
+  { "connections_per_host",  &mongo_option_t::connections_per_host },
+  { "spill_path",            NULL },
+  { "spill_latency_ms",      &mongo_option_t::spill_latency_ms },
+  { "spill_chunk_mb",        &mongo_option_t::spill_chunk_mb },
+  { "progress_interval_ms",  &mongo_option_t::progress_interval_ms },
+};
+
+int main(int argc, char **argv)
+{
+  string file = (argc > 1) ? argv[1] :
+    string(KODIAQ_CONFIG_DIR) + "/DAQOptionsMaster.ini";
+
+  koOptions options;
+  if(options.ReadParameterFile(file) != 0){
+    cout<<"FAILED: could not read "<<file<<endl;
+    return 1;
+  }
+
+  // The file as it is, to see where each key sits
+  ifstream infile(file.c_str());
+  string json_string = "", str;
+  while(getline(infile, str))
+    json_string += str;
+  mongo::BSONObj bson = mongo::fromjson(json_string);
+  Check(bson.hasField("mongo") && bson["mongo"].type() == mongo::Object,
+	"'mongo' object in the file");
+  mongo::BSONObj mongo_obj;
+  if(bson.hasField("mongo") && bson["mongo"].type() == mongo::Object)
+    mongo_obj = bson["mongo"].Obj();
+
+  const mongo_option_t &mongo = options.GetRunConfig().mongo;
+  for(unsigned int x=0; x<sizeof(g_MongoKeys)/sizeof(g_MongoKeys[0]); x++){
+    string key = g_MongoKeys[x].name;
+    Check(mongo_obj.hasField(key), "'" + key + "' in the mongo object");
+    Check(!bson.hasField("mongo_" + key), "no flat 'mongo_" + key + "'");
+    // The value given is the one the run config holds
+    if(mongo_obj.hasField(key) && g_MongoKeys[x].field != NULL)
+      Check(mongo.*(g_MongoKeys[x].field) == mongo_obj[key].Int(),
+	    "'" + key + "' parsed");
+  }
+
+  if(g_iFailed != 0){
+    cout<<g_iFailed<<" checks failed for "<<file<<endl;
+    return 1;
+  }
+  cout<<"All checks passed for "<<file<<endl;
+  return 0;
+}
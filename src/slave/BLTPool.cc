@@ -0,0 +1,136 @@
+// ****************************************************************
+//
+// kodiaq Data Acquisition Software
+//
+// File     : BLTPool.cc
+// Date     : 16.10.2026
+//
+// Brief    : Pool of recycled, fixed-size block transfer buffers
+//
+// *****************************************************************
+
+#include <iostream>
+#include <new>
+#include "BLTPool.hh"
+
+BLTPool::BLTPool()
+{
+  m_arena      = NULL;
+  m_refs       = NULL;
+  m_iSlabs     = 0;
+  m_iSlabWords = 0;
+  pthread_mutex_init(&m_lock, NULL);
+}
+
+BLTPool::~BLTPool()
+{
+  Clear();
+  pthread_mutex_destroy(&m_lock);
+}
+
+int BLTPool::Initialize(unsigned int nSlabs, u_int32_t slabWords)
+{
+  Clear();
+  if(nSlabs == 0 || slabWords == 0)
+    return -1;
+
+  // Note the arena is not initialized on purpose. Pages are only
+  // committed by the kernel once a BLT is actually written to them,
+  // so a generous pool does not cost memory until it is needed.
+  try{
+    m_arena = new u_int32_t[(size_t)nSlabs * slabWords];
+    m_refs  = new std::atomic<int>[nSlabs];
+  }
+  catch(const std::bad_alloc &e){
+    if(m_arena != NULL)
+      delete[] m_arena;
+    m_arena = NULL;
+    m_refs  = NULL;
+    return -1;
+  }
+  for(unsigned int x=0; x<nSlabs; x++)
+    m_refs[x] = 0;
+
+  pthread_mutex_lock(&m_lock);
+  m_iSlabs     = nSlabs;
+  m_iSlabWords = slabWords;
+  m_free.reserve(nSlabs);
+  // Fill backwards so slabs are handed out from the start of the arena
+  for(int x = (int)nSlabs-1; x >= 0; x--)
+    m_free.push_back(m_arena + (size_t)x * slabWords);
+  pthread_mutex_unlock(&m_lock);
+  return 0;
+}
+
+void BLTPool::Clear()
+{
+  pthread_mutex_lock(&m_lock);
+  m_free.clear();
+  if(m_arena != NULL)
+    delete[] m_arena;
+  if(m_refs != NULL)
+    delete[] m_refs;
+  m_arena      = NULL;
+  m_refs       = NULL;
+  m_iSlabs     = 0;
+  m_iSlabWords = 0;
+  pthread_mutex_unlock(&m_lock);
+}
+
+u_int32_t* BLTPool::Get()
+{
+  u_int32_t *slab = NULL;
+  pthread_mutex_lock(&m_lock);
+  if(m_free.size() != 0){
+    slab = m_free.back();
+    m_free.pop_back();
+  }
+  pthread_mutex_unlock(&m_lock);
+  if(slab != NULL)
+    m_refs[(slab - m_arena) / m_iSlabWords] = 1;
+  return slab;
+}
+
+bool BLTPool::Owns(u_int32_t *slab)
+{
+  if(m_arena == NULL || slab == NULL)
+    return false;
+  return (slab >= m_arena && slab < m_arena + (size_t)m_iSlabs*m_iSlabWords &&
+	  (slab - m_arena) % m_iSlabWords == 0);
+}
+
+void BLTPool::Retain(u_int32_t *slab, int n)
+{
+  if(!Owns(slab)){
+    cout<<"BLTPool: tried to retain a buffer that is not from this pool"<<endl;
+    return;
+  }
+  m_refs[(slab - m_arena) / m_iSlabWords] += n;
+}
+
+void BLTPool::Return(u_int32_t *slab)
+{
+  if(!Owns(slab)){
+    cout<<"BLTPool: tried to return a buffer that is not from this pool"<<endl;
+    return;
+  }
+  int refs = --m_refs[(slab - m_arena) / m_iSlabWords];
+  if(refs > 0)
+    return;
+  if(refs < 0){
+    cout<<"BLTPool: slab returned more often than it was handed out"<<endl;
+    m_refs[(slab - m_arena) / m_iSlabWords] = 0;
+    return;
+  }
+  pthread_mutex_lock(&m_lock);
+  m_free.push_back(slab);
+  pthread_mutex_unlock(&m_lock);
+}
+
+unsigned int BLTPool::GetUsed()
+{
+  pthread_mutex_lock(&m_lock);
+  unsigned int used = m_iSlabs - m_free.size();
+  pthread_mutex_unlock(&m_lock);
+  return used;
+}
@@ -0,0 +1,92 @@
+#ifndef _BLTPOOL_HH_
+#define _BLTPOOL_HH_
+
+// ****************************************************************
+//
+// kodiaq Data Acquisition Software
+//
+// File     : BLTPool.hh
+// Date     : 16.10.2026
+//
+// Brief    : Pool of recycled, fixed-size block transfer buffers
+//
+// *****************************************************************
+
+#include <sys/types.h>
+#include <pthread.h>
+#include <atomic>
+#include <vector>
+
+using namespace std;
+
+/*! \brief Fixed pool of block transfer slabs owned by one digitizer.
+
+    All slabs are carved out of one contiguous arena allocated when the
+    board is initialized. The read thread takes a slab, reads the BLT
+    directly into it and passes ownership on to the processors. The
+    processors give the slab back once they are finished with the data.
+    The arena is never touched by the allocator again while the run is
+    going, so there is no new/delete or memcpy on the read path.
+
+    Slabs are reference counted. Get hands out a slab with one reference.
+    Whoever keeps pointers into the slab (e.g. parsed pulses) takes more
+    with Retain, and the slab is only free again once every reference has
+    been given back with Return.
+ */
+class BLTPool
+{
+ public:
+  BLTPool();
+  virtual ~BLTPool();
+
+  //
+  // Name     : int BLTPool::Initialize(unsigned int nSlabs, u_int32_t slabWords)
+  // Purpose  : Allocate the arena for nSlabs slabs of slabWords 32-bit words
+  //            each. Any previous arena is freed, so this must not be called
+  //            while slabs are still in use. Returns 0 on success.
+  //
+  int          Initialize(unsigned int nSlabs, u_int32_t slabWords);
+  //
+  // Name     : u_int32_t* BLTPool::Get()
+  // Purpose  : Take a free slab from the pool. Returns NULL if all slabs are
+  //            in use. The caller should then leave the data on the board
+  //            until the processors catch up.
+  //
+  u_int32_t*   Get();
+  //
+  // Name     : void BLTPool::Retain(u_int32_t *slab, int n)
+  // Purpose  : Add n references to a slab that is already handed out.
+  //
+  void         Retain(u_int32_t *slab, int n=1);
+  //
+  // Name     : void BLTPool::Return(u_int32_t *slab)
+  // Purpose  : Drop one reference. The slab goes back to the pool when the
+  //            last reference is dropped.
+  //
+  void         Return(u_int32_t *slab);
+  //
+  // Name     : void BLTPool::Clear()
+  // Purpose  : Free the arena. All slabs are invalid after this call.
+  //
+  void         Clear();
+
+  bool         Owns(u_int32_t *slab);
+  unsigned int GetSlabs(){
+    return m_iSlabs;
+  };
+  u_int32_t    GetSlabWords(){
+    return m_iSlabWords;
+  };
+  // Number of slabs currently handed out
+  unsigned int GetUsed();
+
+ private:
+  u_int32_t          *m_arena;
+  std::atomic<int>   *m_refs;      // One count per slab
+  vector<u_int32_t*>  m_free;
+  unsigned int        m_iSlabs;
+  u_int32_t           m_iSlabWords;
+  pthread_mutex_t     m_lock;
+};
+
+#endif
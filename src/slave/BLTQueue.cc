@@ -0,0 +1,108 @@
+// ****************************************************************
+//
+// kodiaq Data Acquisition Software
+//
+// File     : BLTQueue.cc
+// Date     : 16.10.2026
+//
+// Brief    : Lock-free handoff of block transfers from the read
+//            thread to the processing threads
+//
+// *****************************************************************
+
+#include <cstddef>
+#include "BLTQueue.hh"
+
+BLTQueue::BLTQueue()
+{
+  m_cells = NULL;
+  m_mask  = 0;
+  m_head  = 0;
+  m_tail  = 0;
+}
+
+BLTQueue::~BLTQueue()
+{
+  if(m_cells != NULL)
+    delete[] m_cells;
+}
+
+void BLTQueue::Initialize(unsigned int capacity)
+{
+  if(m_cells != NULL)
+    delete[] m_cells;
+  u_int64_t size = 2;
+  while(size < capacity)
+    size <<= 1;
+  m_cells = new cell_t[size];
+  m_mask  = size-1;
+  for(u_int64_t x=0; x<size; x++)
+    m_cells[x].seq.store(x, std::memory_order_relaxed);
+  m_head.store(0, std::memory_order_relaxed);
+  m_tail.store(0, std::memory_order_release);
+}
+
+bool BLTQueue::Push(const blt_descriptor_t &blt)
+{
+  if(m_cells == NULL)
+    return false;
+  u_int64_t pos = m_head.load(std::memory_order_relaxed);
+  cell_t *cell = &m_cells[pos & m_mask];
+
+  // The cell is free once the consumer of the previous lap released it
+  if(cell->seq.load(std::memory_order_acquire) != pos)
+    return false;
+  cell->blt = blt;
+  cell->seq.store(pos+1, std::memory_order_release);
+  m_head.store(pos+1, std::memory_order_release);
+  return true;
+}
+
+bool BLTQueue::Pop(blt_descriptor_t &blt)
+{
+  if(m_cells == NULL)
+    return false;
+  u_int64_t pos = m_tail.load(std::memory_order_relaxed);
+  while(true){
+    cell_t *cell = &m_cells[pos & m_mask];
+    u_int64_t seq = cell->seq.load(std::memory_order_acquire);
+    long long diff = (long long)seq - (long long)(pos+1);
+    if(diff == 0){
+      // Cell is filled. Try to claim it.
+      if(m_tail.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)){
+	blt = cell->blt;
+	// Hand the cell back to the producer for the next lap
+	cell->seq.store(pos+m_mask+1, std::memory_order_release);
+	return true;
+      }
+      // pos was reloaded by the failed exchange
+    }
+    else if(diff < 0)
+      return false; // empty
+    else
+      pos = m_tail.load(std::memory_order_relaxed);
+  }
+}
+
+unsigned int BLTQueue::PopAll(vector<blt_descriptor_t> &blts)
+{
+  // Only take what is there now, otherwise a fast producer could keep
+  // the caller in here forever
+  unsigned int max = Size();
+  unsigned int n = 0;
+  blt_descriptor_t blt;
+  while(n < max && Pop(blt)){
+    blts.push_back(blt);
+    n++;
+  }
+  return n;
+}
+
+unsigned int BLTQueue::Size()
+{
+  u_int64_t head = m_head.load(std::memory_order_acquire);
+  u_int64_t tail = m_tail.load(std::memory_order_acquire);
+  if(head < tail)
+    return 0;
+  return (unsigned int)(head-tail);
+}
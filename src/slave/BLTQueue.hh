@@ -0,0 +1,89 @@
+#ifndef _BLTQUEUE_HH_
+#define _BLTQUEUE_HH_
+
+// ****************************************************************
+//
+// kodiaq Data Acquisition Software
+//
+// File     : BLTQueue.hh
+// Date     : 16.10.2026
+//
+// Brief    : Lock-free handoff of block transfers from the read
+//            thread to the processing threads
+//
+// *****************************************************************
+
+#include <sys/types.h>
+#include <atomic>
+#include <vector>
+
+using namespace std;
+
+/*! \brief Describes one block transfer sitting in a BLT pool slab.
+ */
+struct blt_descriptor_t{
+  u_int32_t  *buff;        // Slab holding the data (owned by the BLT pool)
+  u_int32_t   size;        // Bytes read into the slab
+  u_int32_t   headerTime;  // 31-bit trigger time tag of the first event,
+                           // 0xFFFFFFFF if no valid header was found
+  long long   headerTime64;// headerTime extended by the board's clock (or
+                           // the last good header's if this one is junk)
+  u_int64_t   sequence;    // Per-board BLT counter, starts at 0 each run
+};
+
+/*! \brief Bounded single-producer/multi-consumer queue of BLT descriptors.
+
+    The read thread is the only producer. Any number of processing threads
+    may pop. Neither side ever takes a lock, so a processor that is busy
+    with a batch can never stall the read thread. Each cell carries its own
+    sequence number (after D. Vyukov's bounded queue) which tells producer
+    and consumers whose turn it is to touch the cell.
+ */
+class BLTQueue
+{
+ public:
+  BLTQueue();
+  virtual ~BLTQueue();
+
+  //
+  // Name     : void BLTQueue::Initialize(unsigned int capacity)
+  // Purpose  : Size the queue. Capacity is rounded up to a power of two.
+  //            Must not be called while other threads use the queue.
+  //
+  void          Initialize(unsigned int capacity);
+  //
+  // Name     : bool BLTQueue::Push(const blt_descriptor_t &blt)
+  // Purpose  : Append a descriptor. Only one thread may push. Returns false
+  //            if the queue is full.
+  //
+  bool          Push(const blt_descriptor_t &blt);
+  //
+  // Name     : bool BLTQueue::Pop(blt_descriptor_t &blt)
+  // Purpose  : Take the oldest descriptor. Returns false if empty.
+  //
+  bool          Pop(blt_descriptor_t &blt);
+  //
+  // Name     : unsigned int BLTQueue::PopAll(vector<blt_descriptor_t> &blts)
+  // Purpose  : Append everything currently in the queue to blts. Returns
+  //            the number of descriptors taken.
+  //
+  unsigned int  PopAll(vector<blt_descriptor_t> &blts);
+  //
+  // Approximate number of queued descriptors
+  unsigned int  Size();
+
+ private:
+  struct cell_t{
+    std::atomic<u_int64_t> seq;
+    blt_descriptor_t       blt;
+  };
+  cell_t                  *m_cells;
+  u_int64_t                m_mask;
+  // Keep the producer and consumer indices on different cache lines
+  char                     m_pad0[64];
+  std::atomic<u_int64_t>   m_head;
+  char                     m_pad1[64];
+  std::atomic<u_int64_t>   m_tail;
+};
+
+#endif
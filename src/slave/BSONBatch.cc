@@ -0,0 +1,204 @@
+// ****************************************************************
+//
+// kodiaq Data Acquisition Software
+//
+// File     : BSONBatch.cc
+// Date     : 16.10.2026
+//
+// Brief    : Writes the documents of one bulk insert straight into
+//            a single reusable buffer
+//
+// *****************************************************************
+
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+#include <atomic>
+#include "BSONBatch.hh"
+
+// BSON element types
+#define BSON_DOUBLE    0x01
+#define BSON_OBJECT    0x03
+#define BSON_ARRAY     0x04
+#define BSON_BINDATA   0x05
+#define BSON_OID       0x07
+#define BSON_INT32     0x10
+#define BSON_INT64     0x12
+
+// Room for a few pulses before the first insert
+#define BSONBATCH_INITIAL_SIZE  65536
+
+// ObjectId = 4 byte time, 5 random bytes per process, 3 byte counter.
+// Time and counter are big endian so ids sort by time.
+static unsigned char g_oidProcess[5];
+static std::atomic<u_int32_t> g_oidCounter;
+
+static bool InitObjectIds()
+{
+  // Doesn't need to be good, only different for every process
+  u_int64_t seed = ((u_int64_t)time(NULL)<<20) ^ ((u_int64_t)getpid()<<40) ^
+    (u_int64_t)clock();
+  for(int i=0; i<8; i++){
+    seed ^= seed<<13;
+    seed ^= seed>>7;
+    seed ^= seed<<17;
+    if(i<5)
+      g_oidProcess[i] = (unsigned char)(seed&0xFF);
+  }
+  g_oidCounter = (u_int32_t)seed;
+  return true;
+}
+
+static const bool g_oidInitialized = InitObjectIds();
+
+BSONBatch::BSONBatch()
+{
+  m_data.resize(BSONBATCH_INITIAL_SIZE);
+  m_size = m_docStart = 0;
+}
+
+BSONBatch::~BSONBatch()
+{
+}
+
+void BSONBatch::Clear()
+{
+  m_size = m_docStart = 0;
+  m_offsets.clear();
+  m_open.clear();
+}
+
+char* BSONBatch::Grow(u_int32_t n)
+{
+  if(m_size + n > m_data.size()){
+    size_t size = m_data.size();
+    while(m_size + n > size)
+      size *= 2;
+    m_data.resize(size);
+  }
+  char *ret = &m_data[m_size];
+  m_size += n;
+  return ret;
+}
+
+void BSONBatch::AppendName(char type, const char *name)
+{
+  u_int32_t len = strlen(name)+1;
+  char *out = Grow(1+len);
+  out[0] = type;
+  memcpy(out+1, name, len);
+}
+
+void BSONBatch::StartDocument()
+{
+  m_docStart = m_size;
+  m_offsets.push_back(m_docStart);
+  Grow(4);
+  AppendName(BSON_OID, "_id");
+  unsigned char *oid = (unsigned char*)Grow(12);
+  u_int32_t now = (u_int32_t)time(NULL);
+  u_int32_t count = g_oidCounter++;
+  oid[0] = (now>>24)&0xFF;
+  oid[1] = (now>>16)&0xFF;
+  oid[2] = (now>>8)&0xFF;
+  oid[3] = now&0xFF;
+  memcpy(oid+4, g_oidProcess, 5);
+  oid[9] = (count>>16)&0xFF;
+  oid[10] = (count>>8)&0xFF;
+  oid[11] = count&0xFF;
+}
+
+void BSONBatch::AppendInt(const char *name, int value)
+{
+  AppendName(BSON_INT32, name);
+  memcpy(Grow(4), &value, 4);
+}
+
+void BSONBatch::AppendLong(const char *name, long long value)
+{
+  AppendName(BSON_INT64, name);
+  memcpy(Grow(8), &value, 8);
+}
+
+void BSONBatch::AppendDouble(const char *name, double value)
+{
+  AppendName(BSON_DOUBLE, name);
+  memcpy(Grow(8), &value, 8);
+}
+
+void BSONBatch::AppendBinData(const char *name, const char *data, u_int32_t size)
+{
+  AppendName(BSON_BINDATA, name);
+  char *out = Grow(5+size);
+  memcpy(out, &size, 4);
+  out[4] = 0;   // Generic binary subtype
+  memcpy(out+5, data, size);
+}
+
+void BSONBatch::AppendIntArray(const char *name, const u_int32_t *values,
+			       u_int32_t n)
+{
+  StartArray(name);
+  for(u_int32_t i=0; i<n; i++)
+    AppendInt(ArrayKey(i), (int)values[i]);
+  EndObject();
+}
+
+void BSONBatch::StartObject(const char *name)
+{
+  AppendName(BSON_OBJECT, name);
+  m_open.push_back(m_size);
+  Grow(4);
+}
+
+void BSONBatch::StartArray(const char *name)
+{
+  // An array is a document with the keys "0", "1", ...
+  AppendName(BSON_ARRAY, name);
+  m_open.push_back(m_size);
+  Grow(4);
+}
+
+void BSONBatch::EndObject()
+{
+  *Grow(1) = 0;
+  u_int32_t start = m_open.back();
+  m_open.pop_back();
+  u_int32_t len = m_size - start;
+  memcpy(&m_data[start], &len, 4);
+}
+
+const char* BSONBatch::ArrayKey(u_int32_t i)
+{
+  char *p = m_key + sizeof(m_key) - 1;
+  *p = 0;
+  do{
+    *--p = '0' + i%10;
+    i /= 10;
+  }while(i != 0);
+  return p;
+}
+
+void BSONBatch::EndDocument()
+{
+  *Grow(1) = 0;
+  u_int32_t len = m_size - m_docStart;
+  memcpy(&m_data[m_docStart], &len, 4);
+}
+
+void BSONBatch::AppendDocuments(const char *data, u_int32_t size)
+{
+  u_int32_t start = m_size;
+  memcpy(Grow(size), data, size);
+  // Each document starts with its length
+  u_int32_t pos = 0;
+  while(pos + 4 <= size){
+    u_int32_t len;
+    memcpy(&len, data + pos, 4);
+    if(len < 5 || pos + len > size)
+      break;
+    m_offsets.push_back(start + pos);
+    pos += len;
+  }
+  m_size = start + pos;
+}
@@ -0,0 +1,109 @@
+#ifndef _BSONBATCH_HH_
+#define _BSONBATCH_HH_
+
+// ****************************************************************
+//
+// kodiaq Data Acquisition Software
+//
+// File     : BSONBatch.hh
+// Date     : 16.10.2026
+//
+// Brief    : Writes the documents of one bulk insert straight into
+//            a single reusable buffer
+//
+// *****************************************************************
+
+#include <sys/types.h>
+#include <vector>
+
+using namespace std;
+
+/*! \brief Buffer holding the encoded BSON documents of one insert.
+
+    The processors write every pulse document field by field into one
+    growing buffer instead of going through a BSONObjBuilder and a copy
+    of the finished object per pulse. Every document starts with a
+    client-side ObjectId (time, per-process random bytes and a counter),
+    like the one the driver would generate.
+
+    A batch is handed to a MongoWriter with the insert and comes back
+    once it has been written (see MongoWriter::GetBatch), so after the
+    first few inserts the buffers are big enough and nothing is allocated
+    per pulse any more. Only one document can be open at a time.
+ */
+class BSONBatch
+{
+ public:
+  BSONBatch();
+  virtual ~BSONBatch();
+
+  //
+  // Name     : void BSONBatch::Clear()
+  // Purpose  : Drop all documents but keep the memory
+  //
+  void          Clear();
+  //
+  // Name     : void BSONBatch::StartDocument()
+  // Purpose  : Open a new document and write its _id
+  //
+  void          StartDocument();
+  void          AppendInt(const char *name, int value);
+  void          AppendLong(const char *name, long long value);
+  void          AppendDouble(const char *name, double value);
+  void          AppendBinData(const char *name, const char *data, u_int32_t size);
+  void          AppendIntArray(const char *name, const u_int32_t *values,
+			       u_int32_t n);
+  //
+  // Name     : void BSONBatch::StartObject(const char *name)
+  // Purpose  : Open an embedded document (or an array with StartArray).
+  //            Fields go into it until the matching EndObject. Array
+  //            elements are named with ArrayKey.
+  //
+  void          StartObject(const char *name);
+  void          StartArray(const char *name);
+  void          EndObject();
+  //
+  // Name     : const char* BSONBatch::ArrayKey(u_int32_t i)
+  // Purpose  : Name of element i of an array ("0", "1", ...). Valid until
+  //            the next call.
+  //
+  const char*   ArrayKey(u_int32_t i);
+  //
+  // Name     : void BSONBatch::EndDocument()
+  // Purpose  : Close the open document and fill in its size
+  //
+  void          EndDocument();
+  //
+  // Name     : void BSONBatch::AppendDocuments(const char *data, u_int32_t size)
+  // Purpose  : Add documents that are already encoded, e.g. the Data() of
+  //            another batch read back from a spill file
+  //
+  void          AppendDocuments(const char *data, u_int32_t size);
+
+  u_int32_t     Documents(){
+    return m_offsets.size();
+  };
+  u_int32_t     Bytes(){
+    return m_size;
+  };
+  const char*   Document(u_int32_t i){
+    return &m_data[m_offsets[i]];
+  };
+  // All documents back to back, Bytes() long
+  const char*   Data(){
+    return &m_data[0];
+  };
+
+ private:
+  char*         Grow(u_int32_t n);
+  void          AppendName(char type, const char *name);
+
+  vector<char>       m_data;       // Only grows, m_size bytes are used
+  u_int32_t          m_size;
+  u_int32_t          m_docStart;
+  vector<u_int32_t>  m_offsets;
+  vector<u_int32_t>  m_open;       // Start of the open embedded documents
+  char               m_key[12];
+};
+
+#endif
@@ -0,0 +1,217 @@
+// ****************************************************************
+//
+// kodiaq Data Acquisition Software
+//
+// File     : BinaryFile.cc
+// Date     : 16.10.2026
+//
+// Brief    : kodiaq's own binary output format. One stream of files
+//            per processor, written with writev from the BLTs.
+//
+// *****************************************************************
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <cstdio>
+#include <cstring>
+#include "BinaryFile.hh"
+#include "DataCodec.hh"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+BinaryFile::BinaryFile()
+{
+  m_fd = -1;
+  m_stream = 0;
+  m_sequence = 0;
+  m_maxBytes = m_fileBytes = m_written = 0;
+  m_chunkBytes = 0;
+}
+
+BinaryFile::~BinaryFile()
+{
+  Close();
+}
+
+int BinaryFile::Open(string base, int stream, u_int64_t maxBytes)
+{
+  Close();
+  m_base = base;
+  m_stream = stream;
+  m_maxBytes = maxBytes;
+  m_sequence = 0;
+  m_written = 0;
+  ClearChunk();
+  return OpenNext();
+}
+
+void BinaryFile::Close()
+{
+  if(m_fd >= 0){
+    close(m_fd);
+    m_fd = -1;
+  }
+}
+
+int BinaryFile::OpenNext()
+{
+  Close();
+  char name[32];
+  snprintf(name, sizeof(name), "_%d_%06u.kbin", m_stream, m_sequence);
+  m_fileName = m_base + name;
+  m_fd = open(m_fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(m_fd < 0)
+    return -1;
+
+  kbin_file_header_t header;
+  memset(&header, 0, sizeof(header));
+  header.magic = KBIN_FILE_MAGIC;
+  header.version = KBIN_VERSION;
+  header.stream = (u_int16_t)m_stream;
+  header.sequence = m_sequence;
+  if(write(m_fd, &header, sizeof(header)) != (ssize_t)sizeof(header)){
+    Close();
+    return -1;
+  }
+  m_fileBytes = sizeof(header);
+  m_written += sizeof(header);
+  m_sequence++;
+  return 0;
+}
+
+void BinaryFile::AddPulse(int module, int channel, long long time, int codec,
+			  const char *data, u_int32_t size, bool copy)
+{
+  kbin_pulse_record_t record;
+  record.time = time;
+  record.length = size;
+  record.module = (u_int16_t)module;
+  record.channel = (u_int8_t)channel;
+  record.codec = (u_int8_t)codec;
+  m_records.push_back(record);
+  if(copy){
+    m_payloads.push_back(NULL);
+    m_stagedAt.push_back(m_staging.size());
+    m_staging.insert(m_staging.end(), data, data + size);
+  }
+  else{
+    m_payloads.push_back(data);
+    m_stagedAt.push_back(0);
+  }
+  m_chunkBytes += size;
+}
+
+void BinaryFile::ClearChunk()
+{
+  m_records.clear();
+  m_payloads.clear();
+  m_stagedAt.clear();
+  m_staging.clear();
+  m_chunkBytes = 0;
+}
+
+int BinaryFile::WriteChunk(DataCodec *codec)
+{
+  if(m_records.size() == 0)
+    return 0;
+  if(m_fd < 0){
+    ClearChunk();
+    return -1;
+  }
+
+  // Block compression needs the payloads in one piece. If it fails or
+  // doesn't pay, the chunk goes out as it is.
+  char *block = NULL;
+  u_int32_t blockSize = 0;
+  if(codec != NULL && codec->GetID() != CODEC_NONE && m_chunkBytes > 0 &&
+     m_chunkBytes <= 0xFFFFFFFFULL){
+    m_block.clear();
+    m_block.reserve(m_chunkBytes);
+    for(unsigned int x=0; x<m_payloads.size(); x++){
+      const char *data = m_payloads[x];
+      if(data == NULL)
+	data = &m_staging[m_stagedAt[x]];
+      m_block.insert(m_block.end(), data, data + m_records[x].length);
+    }
+    if(codec->Compress(&m_block[0], m_block.size(), &block, &blockSize) != 0 ||
+       blockSize >= m_block.size())
+      block = NULL;
+  }
+
+  kbin_chunk_header_t header;
+  header.magic = KBIN_CHUNK_MAGIC;
+  header.records = m_records.size();
+  header.bytes = (block != NULL) ? blockSize : m_chunkBytes;
+  header.codec = (block != NULL) ? codec->GetID() : CODEC_NONE;
+  header.reserved = 0;
+  u_int64_t total = sizeof(header) +
+    m_records.size()*sizeof(kbin_pulse_record_t) + header.bytes;
+
+  // A chunk is never split, so a file can go over the limit by one chunk
+  // if that is all it holds
+  if(m_maxBytes > 0 && m_fileBytes > sizeof(kbin_file_header_t) &&
+     m_fileBytes + total > m_maxBytes && OpenNext() != 0){
+    ClearChunk();
+    return -1;
+  }
+
+  m_iov.resize(2 + m_records.size());
+  m_iov[0].iov_base = &header;
+  m_iov[0].iov_len  = sizeof(header);
+  m_iov[1].iov_base = &m_records[0];
+  m_iov[1].iov_len  = m_records.size()*sizeof(kbin_pulse_record_t);
+  unsigned int count = 2;
+  if(block != NULL){
+    m_iov[2].iov_base = block;
+    m_iov[2].iov_len  = blockSize;
+    count = 3;
+  }
+  for(unsigned int x=0; x<m_payloads.size() && block == NULL; x++){
+    if(m_records[x].length == 0)
+      continue;
+    const char *data = m_payloads[x];
+    if(data == NULL)
+      data = &m_staging[m_stagedAt[x]];
+    m_iov[count].iov_base = (void*)data;
+    m_iov[count].iov_len  = m_records[x].length;
+    count++;
+  }
+
+  int ret = WriteVector(&m_iov[0], count);
+  if(ret == 0){
+    m_fileBytes += total;
+    m_written += total;
+  }
+  ClearChunk();
+  return ret;
+}
+
+int BinaryFile::WriteVector(struct iovec *iov, int count)
+{
+  // writev takes at most IOV_MAX vectors and may stop early, so this
+  // goes on from wherever the last call ended
+  while(count > 0){
+    int n = (count > IOV_MAX) ? IOV_MAX : count;
+    ssize_t done = writev(m_fd, iov, n);
+    if(done < 0){
+      if(errno == EINTR)
+	continue;
+      return -1;
+    }
+    while(n > 0 && (size_t)done >= iov->iov_len){
+      done -= iov->iov_len;
+      iov++;
+      n--;
+      count--;
+    }
+    if(n > 0){
+      iov->iov_base = (char*)iov->iov_base + done;
+      iov->iov_len -= done;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,139 @@
+#ifndef _BINARYFILE_HH_
+#define _BINARYFILE_HH_
+
+// ****************************************************************
+//
+// kodiaq Data Acquisition Software
+//
+// File     : BinaryFile.hh
+// Date     : 16.10.2026
+//
+// Brief    : kodiaq's own binary output format. One stream of files
+//            per processor, written with writev from the BLTs.
+//
+// *****************************************************************
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+class DataCodec;
+
+#define KBIN_FILE_MAGIC    0x4E49424B   // "KBIN"
+#define KBIN_CHUNK_MAGIC   0x4B48434B   // "KCHK"
+#define KBIN_VERSION       2
+
+/*! \brief Header at the start of every file (16 bytes, little endian).
+ */
+struct kbin_file_header_t{
+  u_int32_t  magic;       // KBIN_FILE_MAGIC
+  u_int16_t  version;     // KBIN_VERSION
+  u_int16_t  stream;      // Processor stream the file belongs to
+  u_int32_t  sequence;    // Number of the file in the stream
+  u_int32_t  reserved;
+};
+
+/*! \brief Header of a chunk (24 bytes).
+
+    A chunk holds the pulses of one batch: this header, the pulse
+    records and then their payloads in the same order. With block
+    compression the payloads are compressed together as one block. The
+    records then give the uncompressed lengths, so the running sum of
+    them is each payload's offset in the decompressed block.
+ */
+struct kbin_chunk_header_t{
+  u_int32_t  magic;       // KBIN_CHUNK_MAGIC
+  u_int32_t  records;
+  u_int64_t  bytes;       // Payload bytes after the records, as stored
+  u_int32_t  codec;       // CODEC_* of the block, CODEC_NONE if none
+  u_int32_t  reserved;
+};
+
+/*! \brief Fixed size description of one pulse (16 bytes).
+ */
+struct kbin_pulse_record_t{
+  int64_t    time;        // 64-bit time stamp
+  u_int32_t  length;      // Payload size (bytes)
+  u_int16_t  module;
+  u_int8_t   channel;
+  u_int8_t   codec;       // CODEC_* the payload is compressed with
+};
+
+/*! \brief Writes one processor's pulses to a series of binary files.
+
+    The processor adds the pulses of a batch and writes them as one chunk
+    before it gives the BLTs back. Uncompressed payloads are not copied:
+    the chunk goes out in a single writev whose vectors point straight
+    into the BLTs. Compressed payloads live in the codec's scratch space
+    until the next pulse, so those are copied once into a staging buffer.
+
+    A new file is started once the next chunk would take the current one
+    past the size limit. Files are named <base>_<stream>_<sequence>.kbin.
+ */
+class BinaryFile
+{
+ public:
+  BinaryFile();
+  virtual ~BinaryFile();
+
+  //
+  // Name     : int BinaryFile::Open(string base, int stream, u_int64_t maxBytes)
+  // Purpose  : Start the first file of the stream. maxBytes 0 means one
+  //            file for the whole run. Returns 0 on success.
+  //
+  int           Open(string base, int stream, u_int64_t maxBytes);
+  void          Close();
+  //
+  // Name     : void BinaryFile::AddPulse(int module, int channel, long long time,
+  //                                      int codec, const char *data,
+  //                                      u_int32_t size, bool copy)
+  // Purpose  : Add a pulse to the open chunk. Unless copy is set, data
+  //            has to stay valid until WriteChunk.
+  //
+  void          AddPulse(int module, int channel, long long time, int codec,
+			 const char *data, u_int32_t size, bool copy);
+  //
+  // Name     : int BinaryFile::WriteChunk(DataCodec *codec)
+  // Purpose  : Write the open chunk, rotating the file first if needed.
+  //            With a codec the payloads are compressed as one block
+  //            (they should have been added uncompressed). The chunk is
+  //            cleared either way. Returns 0 on success.
+  //
+  int           WriteChunk(DataCodec *codec=NULL);
+  //
+  // Name     : void BinaryFile::ClearChunk()
+  // Purpose  : Drop the pulses added since the last WriteChunk
+  //
+  void          ClearChunk();
+
+  string        GetFileName(){
+    return m_fileName;
+  };
+  u_int64_t     GetBytesWritten(){
+    return m_written;
+  };
+
+ private:
+  int           OpenNext();
+  int           WriteVector(struct iovec *iov, int count);
+
+  string                       m_base, m_fileName;
+  int                          m_fd, m_stream;
+  u_int32_t                    m_sequence;
+  u_int64_t                    m_maxBytes, m_fileBytes, m_written;
+
+  // The open chunk. Payloads with a NULL pointer are in m_staging at
+  // m_stagedAt, since a pointer into it would move as it grows.
+  vector<kbin_pulse_record_t>  m_records;
+  vector<const char*>          m_payloads;
+  vector<size_t>               m_stagedAt;
+  vector<char>                 m_staging;
+  u_int64_t                    m_chunkBytes;
+  vector<struct iovec>         m_iov;
+  vector<char>                 m_block;      // Payloads to compress
+};
+
+#endif
@@ -27,23 +27,27 @@ CBV1724::CBV1724()
 {   
    fBLTSize=fBufferSize=0;
    bActivated=false;
-   fBuffers=NULL;
-   fSizes=NULL;
+   fBLTSequence=0;
    fBufferOccSize = 0;
    fBufferOccCount = 0;
    fReadoutThresh=10;
    pthread_mutex_init(&fDataLock,NULL);
    pthread_mutex_init(&fWaitLock,NULL);
    pthread_cond_init(&fReadyCondition,NULL);
-   i_clockResetCounter = 0;
    fBadBlockCounter = 0;
-   i64_blt_first_time = i64_blt_second_time = i64_blt_last_time = 0;
+   fPoolExhaustedCounter = 0;
+   fCompressionRung = 0;
    bOver15 = false;
    fIdealBaseline = 16000;
    fLastReadout=koLogger::GetCurrentTime();
    fReadoutTime = 1;
    m_lastprocessPID=0;
    fReadMeOut=false;
+   fNotifier = NULL;
+   fNextBLTSequence = fBatchSequence = 0;
+   fOrderedProcessing = false;
+   fClaimed = false;
+   fCompletedBatches = 0;
    m_tempBuff = NULL;
    bThreadOpen = false;
    m_temp_blt_bytes=0;
@@ -73,16 +77,16 @@ CBV1724::CBV1724(board_definition_t BoardDef, koLogger *kLog, bool profiling)
 {
   fBLTSize=fBufferSize=0;
   bActivated=false;
-  fBuffers=NULL;
-  fSizes=NULL;
+  fBLTSequence=0;
   fReadoutThresh=10;
   pthread_mutex_init(&fDataLock,NULL);
   pthread_mutex_init(&fWaitLock,NULL);
   pthread_cond_init(&fReadyCondition,NULL);
-  i64_blt_first_time = i64_blt_second_time = i64_blt_last_time = 0;
   fBufferOccSize = 0;
   fBufferOccCount = 0;
   fBadBlockCounter = 0;
+  fPoolExhaustedCounter = 0;
+  fCompressionRung = 0;
   bOver15 = false;
   fIdealBaseline = 16000;
   fLastReadout=koLogger::GetCurrentTime();
@@ -111,26 +115,44 @@ int CBV1724::Initialize(koOptions *options)
 
   // Set private members
   int retVal=0;
-  i_clockResetCounter=0;
+  fClock.Reset();
   bActivated=false;
   UnlockDataBuffer();
-  fBLTSize=options->GetInt("blt_size");
+  const run_config_t &config = options->GetRunConfig();
+  fBLTSize=config.blt_size;
   fBufferSize = fBLTSize;
-  if(options->HasField("read_busy_last") && options->GetInt("read_busy_last")==1)
-    fReadBusyLast = true;
-  else
-    fReadBusyLast = false;
-  fReadoutThresh = options->GetInt("processing_readout_threshold");
-  if(options->HasField("baseline_level"))
-    fIdealBaseline = options->GetInt("baseline_level");
-
-  // Data is stored in these two vectors
-  fBuffers = new vector<u_int32_t*>();
-  fSizes   = new vector<u_int32_t>();
+  fReadBusyLast = (config.read_busy_last==1);
+  fReadoutThresh = config.processing_readout_threshold;
+  fOrderedProcessing = (config.ordered_processing==1);
+  fIdealBaseline = config.baseline_level;
+
+  // The BLTs live in a pool of preallocated slabs. Each slab is large
+  // enough for a full read cycle (fBufferSize bytes) plus one more BLT,
+  // since the cycle only checks its size after each transfer.
+  // Descriptors of the filled slabs are handed to the processors through
+  // a lock-free queue which can hold every slab of the pool.
+  u_int32_t slabWords = (fBufferSize + fBLTSize + sizeof(u_int32_t) - 1) / 
+    sizeof(u_int32_t);
+  unsigned int poolSize = 100;
+  if(config.blt_pool_size>0)
+    poolSize = config.blt_pool_size;
+  fPoolExhaustedCounter = 0;
+  fCompressionRung = 0;
+  if(fBLTPool.Initialize(poolSize, slabWords)!=0){
+    stringstream err;
+    err<<"Board "<<fBID.id<<" failed to allocate BLT pool of "<<poolSize
+       <<" slabs with "<<slabWords<<" words each";
+    LogError(err.str());
+    return -1;
+  }
+  fBLTQueue.Initialize(poolSize);
+  fBLTSequence = 0;
+  fNextBLTSequence = fBatchSequence = 0;
+  fClaimed = false;
+  fCompletedBatches = 0;
 
   // Determine baselines if required
-  if(options->HasField("baseline_mode") && 
-     options->GetInt("baseline_mode")==1)    {	
+  if(config.baseline_mode==1)    {	
     m_koLog->Message("Determining baselines ");
     int tries = 0;
     int ret=-1;
@@ -160,8 +182,7 @@ int CBV1724::Initialize(koOptions *options)
   }
 
   // Load baselines
-  if(!options->HasField("baseline_mode") ||
-     options->GetInt("baseline_mode") != 2){
+  if(config.baseline_mode != 2){
     LoadBaselines();
     m_koLog->Message("Baselines loaded from file");
   }
@@ -180,14 +201,12 @@ int CBV1724::Initialize(koOptions *options)
     m_koLog->Message( messstr.str() );
   }
 
-  i_clockResetCounter=0;
-  i64_blt_last_time = 0;
    return retVal;
 }
 
 int CBV1724::GetBufferSize(int &count, vector<string> &reports){
-  LockDataBuffer();
   count = fBufferOccCount;
+  LockDataBuffer();
   reports = fReadoutReports;
   fReadoutReports.clear();
   UnlockDataBuffer();
@@ -196,14 +215,26 @@ int CBV1724::GetBufferSize(int &count, vector<string> &reports){
 
 unsigned int CBV1724::ReadMBLT()
 // Performs a FIFOBLT read cycle for this board and reads the
-// data into the buffer of this CBV1724 object
+// data into the buffer of this CBV1724 object. Only ever called from
+// one thread (the producer side of the BLT queue).
 {
   // Initialize
   unsigned int blt_bytes=0;
   int nb=0,ret=-5;   
    
-  // The buffer must be freed in this function (fBufferSize can be large!)
-  u_int32_t *buff = new u_int32_t[fBufferSize];       
+  // Read straight into a slab from the pool. If the processors are holding
+  // every slab we leave the data on the board until they catch up.
+  u_int32_t *buff = fBLTPool.Get();
+  if(buff == NULL){
+    fPoolExhaustedCounter++;
+    if(fPoolExhaustedCounter%100000==1){
+      stringstream ss;
+      ss<<"Board "<<fBID.id<<" BLT pool exhausted ("<<fBLTPool.GetSlabs()
+	<<" slabs in use). Readout is waiting on processing.";
+      m_koLog->Error(ss.str());
+    }
+    return 0;
+  }
   do{
     ret = CAENVME_FIFOBLTReadCycle(fCrateHandle,fBID.vme_address,
 				   ((unsigned char*)buff)+blt_bytes,
@@ -222,7 +253,7 @@ unsigned int CBV1724::ReadMBLT()
       }
       LogError(ess.str());
 	
-      delete[] buff;
+      fBLTPool.Return(buff);
       return 0;
     }
 
@@ -236,7 +267,7 @@ unsigned int CBV1724::ReadMBLT()
       ss<<"Board "<<fBID.id<<" reports insufficient BLT buffer size. ("
 	<<blt_bytes<<" > "<<fBufferSize<<")"<<endl; 
       m_koLog->Error(ss.str());
-      delete[] buff;
+      fBLTPool.Return(buff);
       return 0;
     }
   }while(ret!=cvBusError);
@@ -265,24 +296,33 @@ unsigned int CBV1724::ReadMBLT()
   }
 
   if(blt_bytes>0){
-    // We reserve too much space for the buffer (block transfers can get long). 
-    // In order to avoid shipping huge amounts of empty space around we copy
-    // the buffer here to a new buffer that is just large enough for the data.
-    // This memory is reserved here but it's ownership will be passed to the
-    // processing function that drains it (that function must free it!)
-    u_int32_t *writeBuff = new u_int32_t[blt_bytes/(sizeof(u_int32_t))]; 
-    memcpy(writeBuff,buff,blt_bytes);
-    LockDataBuffer();
-    fBuffers->push_back(writeBuff);
-    fSizes->push_back(blt_bytes);
+    // Ownership of the slab passes to the processing function that drains
+    // it. That function must give it back with ReturnBuffers.
+    blt_descriptor_t blt;
+    blt.buff = buff;
+    blt.size = blt_bytes;
+    blt.headerTime = koHelper::GetTimeStamp(buff, blt_bytes/sizeof(u_int32_t));
+    // Clock resets are followed here, one BLT at a time, so handing the
+    // data to a processor is just a pop
+    blt.headerTime64 = fClock.AddHeader(blt.headerTime);
+    blt.sequence = fBLTSequence;
+    if(!fBLTQueue.Push(blt)){
+      // Can't happen as long as the queue holds the whole pool
+      LogError("Board " + koHelper::IntToString(fBID.id) + 
+	       " BLT queue full. Dropping block.");
+      fBLTPool.Return(buff);
+      return 0;
+    }
+    fBLTSequence++;
     
     // Update total buffer size
     fBufferOccSize += blt_bytes;
     fBufferOccCount++;
+    unsigned int queued = fBLTQueue.Size();
 
     if(bProfiling && m_profilefile.is_open())
       m_profilefile<<"READ "<<koLogger::GetTimeMus()<<" "<<blt_bytes<<" "<<
-	fBufferOccSize<<" "<<fBuffers->size()<<endl;
+	fBufferOccSize<<" "<<queued<<endl;
    
     
     // Priority. If we defined a time stamp frequency, signal the readout
@@ -290,34 +330,43 @@ unsigned int CBV1724::ReadMBLT()
     double tdiff = difftime(current_time, fLastReadout);
     
     // If we have enough BLTs (user option) signal that board can be read out
-    if(fBuffers->size()>fReadoutThresh || fabs(tdiff) > fReadoutTime){
-      fReadMeOut=true;
+    if(queued>fReadoutThresh || fabs(tdiff) > fReadoutTime){
+      // Only wake a processor when the flag goes up, not for every BLT
+      if(!fReadMeOut.exchange(true) && fNotifier!=NULL)
+	fNotifier->Signal();
       if(bProfiling && m_profilefile.is_open())
 	m_profilefile<<"SIGNAL "<<koLogger::GetTimeMus()<<" "<<blt_bytes<<" "<<
-	  fBufferOccSize<<" "<<fBuffers->size()<<" "<<tdiff<<endl;
+	  fBufferOccSize<<" "<<queued<<" "<<tdiff<<endl;
     }
-    UnlockDataBuffer();
   }
+  else
+    fBLTPool.Return(buff);
 
-  delete[] buff;
   return blt_bytes;
 }
 
 void CBV1724::SetActivated(bool active)
 // Set this board to active and ready to go
 {
-  if(active)
-    i_clockResetCounter=0;
+  if(active){
+    fClock.Reset();
+  }
    bActivated=active;
    if(active==false){
+     clock_stats_t clock = fClock.GetStats();
+     if(clock.ambiguous_headers + clock.ambiguous_times + clock.junk_headers > 0){
+       stringstream ss;
+       ss<<"Board "<<fBID.id<<" clock: "<<clock.resets<<" resets, "
+	 <<clock.junk_headers<<" junk headers, "<<clock.ambiguous_headers
+	 <<" headers and "<<clock.ambiguous_times
+	 <<" pulse times going backwards";
+       LogMessage(ss.str());
+     }
      cout<<"Signaling final read"<<endl;
-
-      if(pthread_mutex_trylock(&fDataLock)==0){	      
-	//pthread_cond_signal(&fReadyCondition);
-	fReadMeOut=true;
-	pthread_mutex_unlock(&fDataLock);
-      }
-      cout<<"Done"<<endl;
+     fReadMeOut=true;
+     if(fNotifier!=NULL)
+       fNotifier->Broadcast();
+     cout<<"Done"<<endl;
 
       if(m_profilefile.is_open())
 	m_profilefile.close();
@@ -329,21 +378,50 @@ void CBV1724::SetActivated(bool active)
 void CBV1724::ResetBuff()
 {  
    LockDataBuffer();
-   if(fBuffers!=NULL){      
-      for(unsigned int x=0;x<fBuffers->size();x++)
-	delete[] (*fBuffers)[x];
-      delete fBuffers;
-      fBuffers=NULL;
-   }
-   if(fSizes!=NULL){	
-      delete fSizes;
-      fSizes   = NULL;
+   blt_descriptor_t blt;
+   while(fBLTQueue.Pop(blt)){
+     fBLTPool.Return(blt.buff);
+     fNextBLTSequence = blt.sequence+1;
    }
    fBufferOccSize = 0;
    fBufferOccCount = 0;
    UnlockDataBuffer();
 }
 
+void CBV1724::ReturnBuffers(vector<u_int32_t*> *buffs)
+{
+  if(buffs==NULL)
+    return;
+  for(unsigned int x=0; x<buffs->size(); x++)
+    fBLTPool.Return((*buffs)[x]);
+  buffs->clear();
+}
+
+void CBV1724::ReleaseBoard(u_int64_t batchSequence)
+{
+  if(!fOrderedProcessing)
+    return;
+  if(batchSequence < fCompletedBatches){
+    stringstream err;
+    err<<"Board "<<fBID.id<<" finished batch "<<batchSequence
+       <<" after batch "<<fCompletedBatches-1;
+    LogError(err.str());
+  }
+  else
+    fCompletedBatches = batchSequence+1;
+  fClaimed = false;
+
+  // The board may have signalled while we held it
+  if(fReadMeOut && fNotifier!=NULL)
+    fNotifier->Signal();
+}
+
+int CBV1724::GetPoolOccupancy(int &total)
+{
+  total = fBLTPool.GetSlabs();
+  return fBLTPool.GetUsed();
+}
+
 int CBV1724::LockDataBuffer()
 {
    int error = pthread_mutex_lock(&fDataLock);
@@ -360,7 +438,7 @@ int CBV1724::UnlockDataBuffer()
    return -1;
 }
 
-int CBV1724::RequestDataLock()
+int CBV1724::RequestReadout()
 {
   if(fReadMeOut){
     
@@ -379,16 +457,25 @@ int CBV1724::RequestDataLock()
 	  ReadReg32(channelBufferRegs[x],ch);	
 	  if(ch >= 1023){
 	    bBoardBusy = true;
-	    return -1;
+	    return 1;
 	  }
 	}
       }
     }
     
-    int error = pthread_mutex_trylock(&fDataLock);
     bBoardBusy = false;
-    if(error!=0) return -1;
-    return 0;
+
+    // With ordered processing a board belongs to one processor until 
+    // its batch is written. Whoever holds it signals again on release.
+    if(fOrderedProcessing && fClaimed.exchange(true))
+      return -1;
+
+    // Only one caller gets to clear the flag
+    bool expected = true;
+    if(fReadMeOut.compare_exchange_strong(expected, false))
+      return 0;
+    if(fOrderedProcessing)
+      fClaimed = false;
   }
   return -1;
 }
@@ -396,133 +483,63 @@ int CBV1724::RequestDataLock()
 vector<u_int32_t*>* CBV1724::ReadoutBuffer(vector<u_int32_t> *&sizes, 
 					   unsigned int &resetCounter, 
 					   u_int32_t &headerTime,
-					   int m_ID)
+					   int m_ID, u_int64_t *batchSequence)
 // Note this PASSES OWNERSHIP of the returned vectors to the 
-// calling function! They must be cleared by the caller!
-// The reset counter is computed (did the clock reset during this buffer?) and
-// updated if needed. The value of this counter at the BEGINNING of the buffer
-// is passed by reference to the caller
-// THE MUTEX MUST BE LOCKED IF THIS FUNCTION IS CALLED
+// calling function! They must be cleared by the caller and the data
+// given back to the pool with ReturnBuffers!
+// The reset counter and header time at the BEGINNING of the buffer are
+// passed by reference to the caller. The read thread already followed the
+// clock when it queued the BLTs, so nothing is scanned here.
+// The BLTs are popped from the lock-free queue so the read thread keeps 
+// going while this runs. fDataLock only serializes the processors so that
+// batches are numbered in order.
 {
+  LockDataBuffer();
   fReadMeOut=false;
   headerTime = 0;
   fLastReadout=koLogger::GetCurrentTime();
 
-  // Memory management, pass pointer to caller *with ownsership*                      
-  vector<u_int32_t*> *retVec = fBuffers;
-  fBuffers = new vector<u_int32_t*>();
-  sizes = fSizes;
-  fSizes = new vector<u_int32_t>();
-  long int occSize = fBufferOccSize;
-  fBufferOccSize = 0;
-    
-  if(retVec->size()!=0 ) {
-    i64_blt_first_time = koHelper::GetTimeStamp((*retVec)[0]);
-    
-    // CAEN farts. I don't necessarily want the first time, I want the first
-    // one that isn't garbage. If all are garbage skip checking I guess.
-    unsigned int iPosition = 1;
-    if(i64_blt_first_time == 0xFFFFFFFF){
-      
-      // Keep searching for a good one
-      for(unsigned int x=1; x<retVec->size(); x++){
-	i64_blt_first_time = koHelper::GetTimeStamp((*retVec)[x]);
-	if(i64_blt_first_time != 0xFFFFFFFF){
-	  iPosition = x;
-	  LogError("CAEN fart on header time for BLT[0] but found a good one at position " + koHelper::IntToString(x));
-	  break;
-	}
-      }
-      
-    }
-
-    // If it still sucks dump it to threads and see what they make of it
-    if(i64_blt_first_time == 0xFFFFFFFF){
-      headerTime = i64_blt_last_time;
-      i64_blt_first_time = headerTime;
-      resetCounter = i_clockResetCounter;
-      LogError("Irrecoverable CAEN fart with "+koHelper::IntToString(int(retVec->size()))+" buffers.");
-      UnlockDataBuffer();
-      return retVec;
+  // Take everything that is queued right now
+  vector<blt_descriptor_t> blts;
+  blts.reserve(fBLTQueue.Size());
+  fBLTQueue.PopAll(blts);
+
+  // Stamp the batch and make sure no BLT went missing since the last one
+  if(batchSequence != NULL)
+    *batchSequence = fBatchSequence;
+  fBatchSequence++;
+  if(blts.size()!=0){
+    if(blts[0].sequence != fNextBLTSequence){
+      stringstream err;
+      err<<"Board "<<fBID.id<<" expected BLT "<<fNextBLTSequence
+	 <<" but batch starts with "<<blts[0].sequence;
+      LogError(err.str());
     }
+    fNextBLTSequence = blts.back().sequence+1;
+  }
 
-
-    headerTime = i64_blt_first_time;
-    resetCounter = i_clockResetCounter;
-
-    // If the clock reset before this buffer, then we can 
-    // record a clock reset here
-    // CASE 1: CLOCK RESET AT T0
-    if(i64_blt_last_time > i64_blt_first_time && 
-       fabs(long(i64_blt_first_time)-long(i64_blt_last_time))>5E8){
-      i_clockResetCounter ++;
-      resetCounter = i_clockResetCounter;
-
-      //stringstream st;
-      /*st<<"Clock reset condition 1: board "<<fBID.id<<
-	": first time ("<<i64_blt_first_time
-        <<") last time ("<<i64_blt_last_time<<") reset counter ("
-	<<i_clockResetCounter<<") size of buffer vector ("<<retVec->size()<<")";
-      LogError(st.str());
-      */
-
-    }
+  // Memory management, pass pointer to caller *with ownsership*                      
+  vector<u_int32_t*> *retVec = new vector<u_int32_t*>();
+  sizes = new vector<u_int32_t>();
+  retVec->reserve(blts.size());
+  sizes->reserve(blts.size());
+  long int occSize = 0;
+  for(unsigned int x=0; x<blts.size(); x++){
+    retVec->push_back(blts[x].buff);
+    sizes->push_back(blts[x].size);
+    occSize += blts[x].size;
+  }
+  fBufferOccSize -= occSize;
     
-    // Now check for resets within the buffer
-    i64_blt_last_time = i64_blt_first_time;
-    for(unsigned int x=iPosition; x<retVec->size(); x++){
-      u_int64_t thisTime = koHelper::GetTimeStamp((*retVec)[x]);
-      if(thisTime == 0xFFFFFFFF){
-	cout<<"Junk data!"<<endl;
-	continue;
-      }
-      if(thisTime < i64_blt_last_time && 
-	 fabs(long(thisTime)-long(i64_blt_last_time))>5E8){
-	i_clockResetCounter++;
-	/*stringstream st;
-	st<<"Clock reset condition 2: board "<<fBID.id<<
-	  ": this time ("<<thisTime
-	  <<") last time ("<<i64_blt_last_time<<") reset counter ("
-	  <<i_clockResetCounter<<") size of buffer vector ("<<retVec->size()<<")";
-	LogError(st.str());
-	*/
-      }
-      i64_blt_last_time = thisTime;
-    }
-
-    // REMOVE THIS IF LATER
-    /*if(reset != i_clockResetCounter){
-      stringstream st;
-      st<<"Clock reset board "<<fBID.id<<": first time ("<<i64_blt_first_time
-	<<") second time ("<<i64_blt_second_time<<") last time ("<<
-	i64_blt_last_time<<") reset counter ("<<resetCounter
-	<<") size of buffer vector ("<<retVec->size()<<")";
-      LogError(st.str());
-      } */ 
-
-    // Now we have another issue. It can be that we have very unphysical data
-    // where the clock resets many, many times in a buffer. If we get one 
-    // of these buffers dump the ENTIRE BINARY HEADER to a special file.
-    // It will be a lot
-    /*if( i_clockResetCounter - reset > 5){ // 5 resets seems suitably crappy
-      ofstream outfile;
-      stringstream filename;
-      filename<<"crapData_"<<fBID.id<<"_"<<i_clockResetCounter<<".txt";
-      outfile.open(filename.str());
-      
-      // Print each word      
-      outfile<<koLogger::GetTimeString()<<" Record for digi "<<fBID.id
-	     <<" with "<<i_clockResetCounter-reset<<
-	" clock resets and a buffer size of "<<(*fSizes)[0]<<" and "
-	     <<fBuffers->size()<<" buffers."<<endl;
-      for(unsigned int bidx=0; bidx<fBuffers->size(); bidx++){	
-	for(unsigned int idx = 0; idx < (*fSizes)[bidx]/4; idx++){
-	  outfile<<hex<<(*fBuffers)[bidx][idx]<<endl;
-	}
-      }
-      outfile.close();
-    }// end remove later
-    */
+  // The read thread stamped every BLT with its 64-bit header time. The
+  // first one is the reference for the batch.
+  if(retVec->size()!=0 ) {
+    resetCounter = (unsigned int)(blts[0].headerTime64>>31);
+    headerTime = (u_int32_t)(blts[0].headerTime64&0x7FFFFFFF);
+    // CAEN farts. Junk headers read 0xFFFFFFFF, the last good time is
+    // used instead.
+    if(blts[0].headerTime == 0xFFFFFFFF)
+      LogError("CAEN fart on header time for BLT[0] of "+koHelper::IntToString(int(retVec->size()))+" buffers.");
   }
   
   // PROFILING                  
@@ -729,40 +746,37 @@ int CBV1724::DetermineBaselines()
     unsigned int rc=0;
     u_int32_t ht=0;
     vector <u_int32_t> *dsizes;
-    LockDataBuffer();
     vector<u_int32_t*> *buff= ReadoutBuffer(dsizes, rc, ht);
 
-    vector <u_int32_t> *dchannels = new vector<u_int32_t>;
-    vector <u_int32_t> *dtimes = new vector<u_int32_t>;
-
+    // The parsers only point into the raw BLTs
+    vector<pulse_view_t> views;
     bool berr; string serr;
     if(fwVERSION!=0)
-      DataProcessor::SplitChannelsNewFW(buff,dsizes,
-					dtimes,dchannels,berr,serr);
+      DataProcessor::SplitChannelsNewFW(buff,dsizes,views,berr,serr);
     else
-      DataProcessor::SplitChannels(buff,dsizes,dtimes,dchannels,NULL,false);
+      DataProcessor::SplitChannels(buff,dsizes,views,NULL,false);
 
     
     //loop through channels
-    for(unsigned int x=0;x<dchannels->size();x++){
-      if(channelFinished[(*dchannels)[x]]>=5 || (*dsizes)[x]==0) {
-	delete[] (*buff)[x];
+    for(unsigned int x=0;x<views.size();x++){
+      u_int32_t *data    = (*buff)[views[x].blt] + views[x].offset;
+      u_int32_t  channel = views[x].channel;
+      if(channelFinished[channel]>=5 || views[x].size==0)
 	continue;
-      }
 
       //compute baseline
       double baseline=0.,bdiv=0.;
       int maxval=-1,minval=17000;
 
       // Loop through data
-      for(unsigned int y=0;y<(*dsizes)[x]/4;y++){
+      for(unsigned int y=0;y<views[x].size/4;y++){
 	// Second loop for first/second sample in word
 	for(int z=0;z<2;z++){
 	  int dbase=0;
 	  if(z==0) 
-	    dbase=(((*buff)[x][y])&0xFFFF);
+	    dbase=((data[y])&0xFFFF);
 	  else 
-	    dbase=(((*buff)[x][y]>>16)&0xFFFF);
+	    dbase=((data[y]>>16)&0xFFFF);
 	  if(dbase == 0 || dbase == 4) 
 	    continue;
 	  baseline+=dbase;
@@ -776,7 +790,7 @@ int CBV1724::DetermineBaselines()
       baseline/=bdiv;
       if(abs(maxval-minval) > 100) {
 	//stringstream error;
-	//error<<"Channel "<<(*dchannels)[x]<<" signal in baseline?";
+	//error<<"Channel "<<channel<<" signal in baseline?";
 	//LogMessage( error.str() );	
 	
 	LogMessage("maxval - minval for about " + 
@@ -785,10 +799,8 @@ int CBV1724::DetermineBaselines()
 		   koHelper::IntToString(maxval) + " min " 
 		   + koHelper::IntToString(minval) + 
 		   " maybe there's a signal in the baseline." + 
-		   " Event length " + koHelper::IntToString((*dsizes)[x]/4) 
+		   " Event length " + koHelper::IntToString(views[x].size/4) 
 		   + " words.");
-	
-	delete[] (*buff)[x];
 	continue; //signal in baseline?
       }
 
@@ -798,21 +810,20 @@ int CBV1724::DetermineBaselines()
       //LogMessage("Discrepancy is " + koHelper::IntToString(discrepancy));
       if(abs(discrepancy)<=maxDev) { 
 
-	if(channelFinished[(*dchannels)[x]]>=5){
+	if(channelFinished[channel]>=5){
 	  stringstream message;
-	  message<<"Board "<<fBID.id<< " Channel "<< (*dchannels)[x]
+	  message<<"Board "<<fBID.id<< " Channel "<< channel
 		 <<" finished with value "<<baseline
 		 <<" discrepancy: "<<discrepancy<<" and value "
-		 <<DACValues[(*dchannels)[x]]<<endl;
+		 <<DACValues[channel]<<endl;
 	  LogMessage(message.str());
 	}
 	
-	//channelFinished[(*dchannels)[x]]=true;
-	channelFinished[(*dchannels)[x]]+=1;
-	delete[] (*buff)[x];
+	//channelFinished[channel]=true;
+	channelFinished[channel]+=1;
 	continue;
       }
-      channelFinished[(*dchannels)[x]]=0;
+      channelFinished[channel]=0;
 
 
       // Have a range of 0xFFFF
@@ -831,24 +842,21 @@ int CBV1724::DetermineBaselines()
 	offset = 1;
       
       if(discrepancy < 0)
-	DACValues[(*dchannels)[x]] -= offset;
+	DACValues[channel] -= offset;
       else 
-	DACValues[(*dchannels)[x]] += offset;
+	DACValues[channel] += offset;
       
       // Check out of bounds
-      if(DACValues[(*dchannels)[x]] <= 0)
-	DACValues[(*dchannels)[x]] = 0x0;
-      if(DACValues[(*dchannels)[x]] >= 0xFFFF)
-	DACValues[(*dchannels)[x]] = 0xFFFF;
-
-      delete[] (*buff)[x];
+      if(DACValues[channel] <= 0)
+	DACValues[channel] = 0x0;
+      if(DACValues[channel] >= 0xFFFF)
+	DACValues[channel] = 0xFFFF;
     } //end loop through channels
     LoadDAC(DACValues);
+    ReturnBuffers(buff);
     
     delete buff;
     delete dsizes;
-    delete dchannels;
-    delete dtimes;
     
   }//end while through iterations
   
@@ -14,6 +14,10 @@
 // *****************************************************************
 
 #include "VMEBoard.hh"
+#include "BLTPool.hh"
+#include "BLTQueue.hh"
+#include "ReadoutNotifier.hh"
+#include "ClockReconstructor.hh"
 #include <pthread.h>
 #include <atomic>
 
@@ -42,32 +46,57 @@ class CBV1724 : public VMEBoard {
 
    int Initialize(koOptions *options);                             /*!<  Initialize all VME options using a XeDAQOptions object. Other run parameters are also set.*/
   int DoNoiseSpectra(string mongo_addr, string mongo_coll, u_int32_t length);
-   unsigned int ReadMBLT();                                        /*!<  Performs a read cycle (reads from the buffer until buffer is exhausted or BERR is read) and puts the data into the CBV1724 object buffer. It is assumed that another process is clearing this object's buffer using the ReadoutBuffer function.*/
+   unsigned int ReadMBLT();                                        /*!<  Performs a read cycle (reads from the buffer until buffer is exhausted or BERR is read) and puts a descriptor of the data into the lock-free BLT queue of this object. It is assumed that another process is clearing this object's buffer using the ReadoutBuffer function.*/
   board_definition_t GetBoardDef()  {                              /*!   Return the board definition object, which holds the board's parameters as defined from the XeDAQOptions .ini file.*/
       return fBID;
    };  
    
   vector<u_int32_t*>* ReadoutBuffer(vector <u_int32_t> *&sizes,
 				    unsigned int &resetCounter, u_int32_t &headerTime,
-				    int m_ID=-1);           
-  /*!<  Passes a pointer to a vector of raw data that has been read from the board. Please note: this passes ownership of the raw data vector to the caller! That means the calling function is responsible for freeing this memory again later. A new buffer is created that will act as the board buffer until the next ReadoutBuffer call. The vector sizes contains the size in bytes of each element in the returned buffer. Ownership of sizes also passes to the caller.*/
+				    int m_ID=-1, u_int64_t *batchSequence=NULL);           
+  /*!<  Passes a pointer to a vector of raw data that has been read from the board. Everything currently in the BLT queue is taken. Please note: this passes ownership of the vectors to the caller! The data pointers are slabs from the BLT pool and must be given back with ReturnBuffers. The vector sizes contains the size in bytes of each element in the returned buffer. Ownership of sizes also passes to the caller. The read thread is never blocked by this call. If batchSequence is given it is set to the per-board number of this batch.*/
    
    void ResetBuff();                                               /*!<  Clears and resets the object buffer.*/
+  void ReturnBuffers(vector<u_int32_t*> *buffs);                  /*!<  Give the raw BLTs obtained with ReadoutBuffer back to the board's BLT pool. Must be called by whoever holds the buffers once they are done with the data. The pointers are invalid afterwards.*/
+  void ReturnBuffer(u_int32_t *buff){                              /*!   Drop one reference on a single raw BLT. */
+    fBLTPool.Return(buff);
+  };
+  void RetainBuffer(u_int32_t *buff, int n=1){                     /*!   Take n more references on a raw BLT, e.g. one per parsed pulse pointing into it. Each must be dropped with ReturnBuffer.*/
+    fBLTPool.Retain(buff, n);
+  };
    u_int32_t GetBLTSize()  {                                       /*!   Returns the block transfer size. */
       return fBLTSize;
    };
   static void* CopyWrapper(void* data);
   void CopyThread();
 
-   int LockDataBuffer();                                           /*!<  This is a thread-safe program. In order to do anything with the buffer you have to lock the mutex. This function locks it for you.*/
-   int UnlockDataBuffer();                                         /*!<  When a recorder function is done clearing the buffer of this object it can (and should) free the mutex so that acquisition can continue. As long as the user is accessing the buffer the digitizer cannot read any new data.*/
-   int RequestDataLock();                                          /*!<  If the object's mutex is not locked this function puts it on hold using trylock. Trylock waits for a signal over a pthread_cond_t object which will indicate that the buffer is ready to be read. If the condition is meant this function returns true and the buffer can be accessed. If the condition is not meant (or if someone else was controlling the mutex) this function returns -1 and the caller should not try to access the buffer. This may seem a bit confusing, but this class was not meant to be used alone and should be accessed through the XeProcessor object, where all of these steps are done automatically.*/
+   int LockDataBuffer();                                           /*!<  Serializes the processors draining this board (batch numbering and readout reports). The read thread never takes this lock.*/
+   int UnlockDataBuffer();                                         /*!<  Release the lock taken with LockDataBuffer.*/
+   int RequestReadout();                                           /*!<  Returns 0 if the board signalled that it should be read out and the caller won the right to do it. The signal is cleared atomically, so only one caller gets 0 per signal. Returns 1 if the board has data but was skipped on purpose (read_busy_last) and should be tried again on the next pass. Otherwise returns -1 and the caller should move on to the next board. With ordered processing a caller getting 0 holds the board until ReleaseBoard.*/
+  void ReleaseBoard(u_int64_t batchSequence);                      /*!<  Call once the batch from ReadoutBuffer has been fully handed to the recorder. With ordered processing this lets the next processor claim the board. Batches finishing out of order are logged.*/
+  bool OrderedProcessing(){                                        /*!   True if batches of this board are processed one at a time, in order. */
+    return fOrderedProcessing;
+  };
+  ClockReconstructor* GetClock(){                                  /*!   64-bit time reconstruction for this board. ReadoutBuffer feeds it the BLT header times, processors use it for the pulse times.*/
+    return &fClock;
+  };
+  int GetCompressionRung(){                                        /*!   Rung of the CompressionController ladder the processors use for this board.*/
+    return fCompressionRung.load(std::memory_order_relaxed);
+  };
+  void SetCompressionRung(int rung){
+    fCompressionRung.store(rung, std::memory_order_relaxed);
+  };
+  void SetNotifier(ReadoutNotifier *notifier){                     /*!   Notifier to poke when the board signals it should be read out. Owned by the caller.*/
+    fNotifier = notifier;
+  };
    
    int DetermineBaselines();                                       /*!<  Simple baseline determination is performed. Basically this just takes data for some time and averages the value on the wire. The DAC register is adjusted iteratively until the baseline minimizes around 16000 (ADC units). There will be problems if there is a lot of activity on the channels, since obviously the baselines are not flat in this case. Do not try to call this function if there is a high rate on the channels or if a strong source is in. At best it will fail and revert back to the old baselines anyway while at worst it will determine poor baselines which can cause undefined behavior.*/
    void SetActivated(bool active);                                 /*!<  Set if this board is active (taking data).*/
 
   /* GetBufferSize: get the size of the buffer in this digitizer in bytes. */
   int GetBufferSize(int &count, vector<string> &reports);
+  /* GetPoolOccupancy: number of BLT slabs in use. Total slabs by reference. */
+  int GetPoolOccupancy(int &total);
 
  private:
 
@@ -79,23 +108,32 @@ class CBV1724 : public VMEBoard {
 
    unsigned int         fReadoutThresh;
    pthread_mutex_t      fDataLock;
+  BLTQueue              fBLTQueue;
+  u_int64_t             fBLTSequence;
+  // Batch bookkeeping. fNextBLTSequence and fBatchSequence are only
+  // touched under fDataLock. 
+  u_int64_t             fNextBLTSequence, fBatchSequence;
+  bool                  fOrderedProcessing;
+  std::atomic<bool>     fClaimed;
+  std::atomic<u_int64_t> fCompletedBatches;
+  ClockReconstructor    fClock;
    pthread_mutex_t      fWaitLock;
    pthread_cond_t       fReadyCondition;
    u_int32_t            fBufferSize;
    u_int32_t            fBLTSize;
-   vector <u_int32_t>  *fSizes;
-   vector <u_int32_t*> *fBuffers;
-   u_int64_t                  i_clockResetCounter;
-   u_int64_t            i64_blt_first_time,i64_blt_second_time,i64_blt_last_time;  
+  BLTPool               fBLTPool;
+  std::atomic<int>      fPoolExhaustedCounter;
+  std::atomic<int>      fCompressionRung;
   u_int32_t            fIdealBaseline;
-   int                  fBufferOccSize;
+  std::atomic<int>      fBufferOccSize;
   std::atomic<int>      fBufferOccCount, fBadBlockCounter;
   bool                  bOver15;
-  time_t                fLastReadout;
+  std::atomic<time_t>   fLastReadout;
   double                fReadoutTime;
   vector <string>       fReadoutReports;
   pid_t                 m_lastprocessPID;
-  bool                  fReadMeOut;
+  std::atomic<bool>     fReadMeOut;
+  ReadoutNotifier      *fNotifier;
   bool                  bThreadOpen;
   pthread_t             m_copyThread;
   u_int32_t             m_temp_blt_bytes;
@@ -0,0 +1,162 @@
+// ****************************************************************
+//
+// kodiaq Data Acquisition Software
+//
+// File     : ChunkTracker.cc
+// Date     : 16.10.2026
+//
+// Brief    : Follows how far the processors got with every board and
+//            says when a time chunk is complete
+//
+// *****************************************************************
+
+#include "ChunkTracker.hh"
+#include <climits>
+
+// The V1724 clock runs at 100 MHz
+#define CHUNK_TICKS_PER_MS  100000LL
+
+ChunkTracker::ChunkTracker()
+{
+  m_length = 0;
+  m_bEnabled = false;
+  pthread_mutex_init(&m_lock, NULL);
+}
+
+ChunkTracker::~ChunkTracker()
+{
+  pthread_mutex_destroy(&m_lock);
+}
+
+void ChunkTracker::Initialize(int chunkMs, bool bTrack)
+{
+  pthread_mutex_lock(&m_lock);
+  m_length = (chunkMs > 0) ? (long long)chunkMs * CHUNK_TICKS_PER_MS : 0;
+  m_bEnabled = (m_length > 0 || bTrack);
+  m_modules.clear();
+  pthread_mutex_unlock(&m_lock);
+}
+
+void ChunkTracker::BatchDone(int module, u_int64_t batch, long long firstTime,
+			     long long lastTime, bool bFailed,
+			     vector<chunk_marker_t> &closed, long long &passed)
+{
+  passed = -1;
+  if(!m_bEnabled)
+    return;
+  pthread_mutex_lock(&m_lock);
+  map<int, module_progress_t>::iterator it = m_modules.find(module);
+  if(it == m_modules.end()){
+    module_progress_t progress;
+    progress.nextBatch = 0;
+    progress.passed = -1;
+    progress.nextChunk = -1;
+    progress.bGap = false;
+    progress.gapFrom = LLONG_MAX;
+    it = m_modules.insert(make_pair(module, progress)).first;
+  }
+  module_progress_t &progress = it->second;
+  if(batch < progress.nextBatch){
+    passed = progress.passed;
+    pthread_mutex_unlock(&m_lock);
+    return;
+  }
+  batch_done_t done;
+  done.firstTime = firstTime;
+  done.lastTime = lastTime;
+  done.bFailed = bFailed;
+  progress.early[batch] = done;
+
+  // Take in every batch that has all the ones before it done
+  map<u_int64_t, batch_done_t>::iterator next;
+  while((next = progress.early.find(progress.nextBatch)) != progress.early.end()){
+    const batch_done_t &taken = next->second;
+    if(m_length > 0 && taken.bFailed){
+      // Its pulses may be anywhere from the module's time on
+      if(!progress.bGap){
+	progress.bGap = true;
+	progress.gapFrom = (progress.passed >= 0) ? 
+	  ChunkOf(progress.passed) : LLONG_MAX;
+      }
+      if(taken.firstTime >= 0 && ChunkOf(taken.firstTime) < progress.gapFrom)
+	progress.gapFrom = ChunkOf(taken.firstTime);
+    }
+    if(taken.lastTime >= 0){
+      if(m_length > 0 && progress.nextChunk < 0)
+	progress.nextChunk = ChunkOf(taken.firstTime);
+      if(m_length > 0 && progress.bGap && !taken.bFailed){
+	// Up to the chunk the good data starts again in
+	long long from = progress.gapFrom, to = ChunkOf(taken.firstTime);
+	if(from > to)
+	  from = to;
+	for(long long chunk = from; chunk <= to; chunk++)
+	  progress.incomplete.insert(chunk);
+	progress.bGap = false;
+	progress.gapFrom = LLONG_MAX;
+      }
+      if(taken.lastTime > progress.passed)
+	progress.passed = taken.lastTime;
+    }
+    progress.early.erase(next);
+    progress.nextBatch++;
+  }
+
+  // A chunk is done once the module is a chunk past its end (see above)
+  passed = progress.passed;
+  if(m_length > 0 && progress.nextChunk >= 0){
+    long long current = ChunkOf(progress.passed);
+    while(progress.nextChunk < current - 1)
+      CloseChunk(module, progress, closed);
+  }
+  pthread_mutex_unlock(&m_lock);
+}
+
+void ChunkTracker::CloseChunk(int module, module_progress_t &progress,
+			      vector<chunk_marker_t> &closed)
+{
+  chunk_marker_t marker;
+  marker.module = module;
+  marker.chunk = progress.nextChunk;
+  marker.bComplete = (progress.incomplete.erase(marker.chunk) == 0 &&
+		      !(progress.bGap && marker.chunk >= progress.gapFrom));
+  closed.push_back(marker);
+  progress.nextChunk++;
+}
+
+void ChunkTracker::Finish(vector<chunk_marker_t> &closed)
+{
+  if(m_length <= 0)
+    return;
+  pthread_mutex_lock(&m_lock);
+  for(map<int, module_progress_t>::iterator it = m_modules.begin();
+      it != m_modules.end(); it++){
+    module_progress_t &progress = it->second;
+    // Batches that never came make a gap up to the last one that did
+    long long last = progress.passed, first = -1;
+    if(!progress.early.empty() && !progress.bGap){
+      progress.bGap = true;
+      progress.gapFrom = (progress.passed >= 0) ? 
+	ChunkOf(progress.passed) : LLONG_MAX;
+    }
+    for(map<u_int64_t, batch_done_t>::iterator early = progress.early.begin();
+	early != progress.early.end(); early++){
+      if(early->second.lastTime < 0)
+	continue;
+      if(ChunkOf(early->second.firstTime) < progress.gapFrom)
+	progress.gapFrom = ChunkOf(early->second.firstTime);
+      if(first < 0 || early->second.firstTime < first)
+	first = early->second.firstTime;
+      if(early->second.lastTime > last)
+	last = early->second.lastTime;
+    }
+    progress.early.clear();
+    if(progress.nextChunk < 0 && first >= 0)
+      progress.nextChunk = ChunkOf(first);
+    if(progress.nextChunk < 0)
+      continue;
+    long long current = ChunkOf(last);
+    while(progress.nextChunk <= current)
+      CloseChunk(it->first, progress, closed);
+  }
+  pthread_mutex_unlock(&m_lock);
+}
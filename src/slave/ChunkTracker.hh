@@ -0,0 +1,135 @@
+#ifndef _CHUNKTRACKER_HH_
+#define _CHUNKTRACKER_HH_
+
+// ****************************************************************
+//
+// kodiaq Data Acquisition Software
+//
+// File     : ChunkTracker.hh
+// Date     : 16.10.2026
+//
+// Brief    : Follows how far the processors got with every board and
+//            says when a time chunk is complete
+//
+// *****************************************************************
+
+#include <sys/types.h>
+#include <pthread.h>
+#include <map>
+#include <set>
+#include <vector>
+
+using namespace std;
+
+/*! \brief A time chunk of one module that all processors are done with.
+ */
+struct chunk_marker_t{
+  int        module;
+  long long  chunk;       // Chunk number, time / chunk length
+  bool       bComplete;   // False if a batch failed in it, data is missing
+};
+
+/*! \brief Splits the run into time chunks of time_chunk_ms and tracks when
+    each one is complete for each module.
+
+    The batches of a board are processed by any processor in any order,
+    so a chunk is only complete once every batch before the one that
+    passed its end is done as well. Batches that finish early wait here
+    until the ones before them are in. A module's chunks are reported
+    once, in order.
+
+    The module's time is that of its latest pulse, but the channels of a
+    board don't arrive in time order against each other: one channel can
+    be past a chunk's end while another still has pulses for it in the
+    next batch. So chunk n is only closed once the module is a whole
+    chunk further, past (n+2)*length. This assumes the channels of a
+    board are never more than one chunk length apart, which holds for
+    any time_chunk_ms longer than the board's buffer.
+
+    Failed batches are reported too, so the chunks after them still
+    close. Their data is lost, so every chunk from where the module was
+    up to where the next good batch starts is reported as incomplete.
+
+    The same bookkeeping gives each module's processed time, the last
+    time of the batches done in order, which the mongodb recorder's
+    progress documents start from. It is kept even without chunks if the
+    tracker is asked to.
+
+    Times are the reconstructed 64-bit times in 10 ns ticks. Chunk n of a
+    module covers [n*length, (n+1)*length).
+ */
+class ChunkTracker
+{
+ public:
+  ChunkTracker();
+  virtual ~ChunkTracker();
+
+  //
+  // Name     : void ChunkTracker::Initialize(int chunkMs, bool bTrack)
+  // Purpose  : Forget all modules and set the chunk length. 0 turns
+  //            chunking off. bTrack follows the batches without chunks.
+  //            Call before the processors start.
+  //
+  void          Initialize(int chunkMs, bool bTrack=false);
+  bool          Enabled(){
+    return m_bEnabled;
+  };
+  long long     GetLength(){
+    return m_length;
+  };
+  // -1 without chunks
+  long long     ChunkOf(long long time){
+    return (m_length > 0) ? time / m_length : -1;
+  };
+  //
+  // Name     : void ChunkTracker::BatchDone(int module, u_int64_t batch,
+  //                                        long long firstTime, long long lastTime,
+  //                                        bool bFailed,
+  //                                        vector<chunk_marker_t> &closed,
+  //                                        long long &passed)
+  // Purpose  : A processor is done with this batch, and has handed all its
+  //            pulses to the recorder unless bFailed. Every batch has to
+  //            be reported. The times are those of its first and last
+  //            pulse, -1 if it had none. The chunks of the module that
+  //            can be closed now are added to closed and passed is set to
+  //            the module's processed time (-1 if none yet). Thread safe.
+  //
+  void          BatchDone(int module, u_int64_t batch, long long firstTime,
+			  long long lastTime, bool bFailed,
+			  vector<chunk_marker_t> &closed, long long &passed);
+  //
+  // Name     : void ChunkTracker::Finish(vector<chunk_marker_t> &closed)
+  // Purpose  : The run is over, so every chunk left is closed. If a
+  //            module still has batches missing, the chunks from there
+  //            on are incomplete.
+  //
+  void          Finish(vector<chunk_marker_t> &closed);
+
+ private:
+  struct batch_done_t{
+    long long                    firstTime, lastTime;
+    bool                         bFailed;
+  };
+  struct module_progress_t{
+    u_int64_t                    nextBatch;   // Oldest batch not done yet
+    map<u_int64_t, batch_done_t> early;       // Done batches after it
+    long long                    passed;      // Last time of the done batches
+    long long                    nextChunk;   // Oldest not reported, -1 = none yet
+    // A failed batch was taken in and no good one with pulses since.
+    // Chunks from gapFrom on are incomplete.
+    bool                         bGap;
+    long long                    gapFrom;
+    set<long long>               incomplete;  // Not reported yet
+  };
+
+  // With m_lock held
+  void          CloseChunk(int module, module_progress_t &progress,
+			   vector<chunk_marker_t> &closed);
+
+  long long                     m_length;
+  bool                          m_bEnabled;
+  map<int, module_progress_t>   m_modules;
+  pthread_mutex_t               m_lock;
+};
+
+#endif
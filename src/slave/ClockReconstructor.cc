@@ -0,0 +1,134 @@
+// ****************************************************************
+//
+// kodiaq Data Acquisition Software
+//
+// File     : ClockReconstructor.cc
+// Date     : 16.10.2026
+//
+// Brief    : Extends the 31-bit V1724 trigger time tags to 64 bits
+//
+// *****************************************************************
+
+#include "ClockReconstructor.hh"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CLOCKRECONSTRUCTOR_SSE2
+#include <emmintrin.h>
+#endif
+
+#define CLOCK_BITS       31
+#define CLOCK_MASK       0x7FFFFFFF
+#define CLOCK_JUNK       0xFFFFFFFF
+
+// Signed distance from ref to time on the 31-bit clock, in [-2^30, 2^30)
+static inline long long ClockDistance(u_int32_t time, u_int32_t ref)
+{
+  return (long long)((int32_t)((time - ref)<<1)>>1);
+}
+
+ClockReconstructor::ClockReconstructor(unsigned int nChannels)
+{
+  pthread_mutex_init(&m_lock, NULL);
+  m_channelSeen.assign(nChannels, false);
+  m_channelLast64.assign(nChannels, 0);
+  Reset();
+}
+
+ClockReconstructor::~ClockReconstructor()
+{
+  pthread_mutex_destroy(&m_lock);
+}
+
+void ClockReconstructor::Reset()
+{
+  m_bHeaderSeen = false;
+  m_lastHeader64 = 0;
+  m_resets = m_junkHeaders = m_ambiguousHeaders = 0;
+  pthread_mutex_lock(&m_lock);
+  m_ambiguousTimes = m_lateBatches = 0;
+  m_bBatchSeen = false;
+  m_lastBatch = 0;
+  m_channelSeen.assign(m_channelSeen.size(), false);
+  m_channelLast64.assign(m_channelLast64.size(), 0);
+  pthread_mutex_unlock(&m_lock);
+}
+
+long long ClockReconstructor::AddHeader(u_int32_t headerTime)
+{
+  if(headerTime == CLOCK_JUNK){
+    m_junkHeaders++;
+    return m_lastHeader64;
+  }
+  u_int32_t time = headerTime&CLOCK_MASK;
+  long long time64 = time;
+  if(m_bHeaderSeen){
+    long long step = ClockDistance(time, (u_int32_t)m_lastHeader64);
+    if(step < 0)
+      m_ambiguousHeaders++;
+    time64 = m_lastHeader64 + step;
+    if((time64>>CLOCK_BITS) > (m_lastHeader64>>CLOCK_BITS))
+      m_resets++;
+  }
+  m_bHeaderSeen = true;
+  m_lastHeader64 = time64;
+  return time64;
+}
+
+void ClockReconstructor::Reconstruct(u_int64_t batch, unsigned int resetCounter,
+				     u_int32_t headerTime, const u_int32_t *times,
+				     const u_int32_t *channels, u_int32_t n,
+				     long long *times64)
+{
+  long long ref64 = ((long long)resetCounter<<CLOCK_BITS) + headerTime;
+  u_int32_t i = 0;
+#ifdef CLOCKRECONSTRUCTOR_SSE2
+  const __m128i ref = _mm_set1_epi32(headerTime);
+  const __m128i base = _mm_set1_epi64x(ref64);
+  for(; i+4 <= n; i+=4){
+    __m128i d = _mm_sub_epi32(_mm_loadu_si128((const __m128i*)(times+i)), ref);
+    // Sign extend 31 to 32 bits, then to 64
+    d = _mm_srai_epi32(_mm_slli_epi32(d, 1), 1);
+    __m128i sign = _mm_srai_epi32(d, 31);
+    _mm_storeu_si128((__m128i*)(times64+i),
+		     _mm_add_epi64(base, _mm_unpacklo_epi32(d, sign)));
+    _mm_storeu_si128((__m128i*)(times64+i+2),
+		     _mm_add_epi64(base, _mm_unpackhi_epi32(d, sign)));
+  }
+#endif
+  for(; i<n; i++)
+    times64[i] = ref64 + ClockDistance(times[i], headerTime);
+
+  // Check against the channels' last times. A batch finished after a
+  // newer one can't be checked since the state has moved on.
+  pthread_mutex_lock(&m_lock);
+  if(m_bBatchSeen && batch <= m_lastBatch){
+    m_lateBatches++;
+    pthread_mutex_unlock(&m_lock);
+    return;
+  }
+  m_bBatchSeen = true;
+  m_lastBatch = batch;
+  for(i=0; i<n; i++){
+    u_int32_t channel = channels[i];
+    if(channel >= m_channelSeen.size())
+      continue;
+    if(m_channelSeen[channel] && times64[i] < m_channelLast64[channel])
+      m_ambiguousTimes++;
+    m_channelSeen[channel] = true;
+    m_channelLast64[channel] = times64[i];
+  }
+  pthread_mutex_unlock(&m_lock);
+}
+
+clock_stats_t ClockReconstructor::GetStats()
+{
+  clock_stats_t stats;
+  stats.resets = m_resets;
+  stats.junk_headers = m_junkHeaders;
+  stats.ambiguous_headers = m_ambiguousHeaders;
+  pthread_mutex_lock(&m_lock);
+  stats.ambiguous_times = m_ambiguousTimes;
+  stats.late_batches = m_lateBatches;
+  pthread_mutex_unlock(&m_lock);
+  return stats;
+}
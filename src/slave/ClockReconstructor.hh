@@ -0,0 +1,100 @@
+#ifndef _CLOCKRECONSTRUCTOR_HH_
+#define _CLOCKRECONSTRUCTOR_HH_
+
+// ****************************************************************
+//
+// kodiaq Data Acquisition Software
+//
+// File     : ClockReconstructor.hh
+// Date     : 16.10.2026
+//
+// Brief    : Extends the 31-bit V1724 trigger time tags to 64 bits
+//
+// *****************************************************************
+
+#include <sys/types.h>
+#include <pthread.h>
+#include <vector>
+#include <atomic>
+
+using namespace std;
+
+/*! \brief Counters kept by the ClockReconstructor since the last Reset.
+ */
+struct clock_stats_t{
+  u_int64_t  resets;             // Clock rollovers seen in the BLT headers
+  u_int64_t  junk_headers;       // BLT headers reading 0xFFFFFFFF
+  u_int64_t  ambiguous_headers;  // BLT header times that went backwards
+  u_int64_t  ambiguous_times;    // Pulses earlier than the channel's last one
+  u_int64_t  late_batches;       // Batches finished after a newer one
+};
+
+/*! \brief 64-bit time reconstruction for one board.
+
+    The V1724 time tag is 31 bits of 10 ns and cycles every 21 s. Every
+    time is extended to 64 bits by taking the value closest to a reference
+    that is already known in 64 bits, so a time may be up to 2^30 ticks
+    (10.7 s) before or after its reference.
+
+    The read thread follows the BLT header times one by one as the data
+    arrives (AddHeader) and stamps each BLT with the 64-bit time. This
+    never takes a lock. The stamp of the first BLT of a batch is the
+    reference for all pulse times of the batch, which are extended in a
+    single vectorized pass (Reconstruct), so processors can work on
+    batches of the same board in parallel and in any order.
+
+    The last 64-bit time of each channel is kept across batches to check
+    the result. Times that go backwards are counted as ambiguous, which
+    is how wrongly assigned resets show up.
+ */
+class ClockReconstructor
+{
+ public:
+  ClockReconstructor(unsigned int nChannels=8);
+  virtual ~ClockReconstructor();
+
+  //
+  // Name     : void ClockReconstructor::Reset()
+  // Purpose  : Forget all clock state and counters. Call at run start.
+  //
+  void          Reset();
+  //
+  // Name     : long long ClockReconstructor::AddHeader(u_int32_t headerTime)
+  // Purpose  : Follow the header time of the next BLT. Returns its 64-bit
+  //            time, or the one of the last good header if this one is
+  //            junk (0xFFFFFFFF). Only the read thread may call this.
+  //
+  long long     AddHeader(u_int32_t headerTime);
+  //
+  // Name     : void ClockReconstructor::Reconstruct(u_int64_t batch,
+  //                     unsigned int resetCounter, u_int32_t headerTime,
+  //                     const u_int32_t *times, const u_int32_t *channels,
+  //                     u_int32_t n, long long *times64)
+  // Purpose  : Extend the n pulse times of a batch to 64 bits using the
+  //            reference from AddHeader. Thread safe. batch is the
+  //            per-board batch sequence, so that the channel check only
+  //            moves forward.
+  //
+  void          Reconstruct(u_int64_t batch, unsigned int resetCounter,
+			    u_int32_t headerTime, const u_int32_t *times,
+			    const u_int32_t *channels, u_int32_t n,
+			    long long *times64);
+
+  clock_stats_t GetStats();
+
+ private:
+  // Board clock. Only touched by the read thread.
+  bool               m_bHeaderSeen;
+  long long          m_lastHeader64;
+  std::atomic<u_int64_t> m_resets, m_junkHeaders, m_ambiguousHeaders;
+
+  // Channel check, under m_lock
+  pthread_mutex_t    m_lock;
+  u_int64_t          m_ambiguousTimes, m_lateBatches;
+  bool               m_bBatchSeen;
+  u_int64_t          m_lastBatch;
+  vector<bool>       m_channelSeen;
+  vector<long long>  m_channelLast64;
+};
+
+#endif
@@ -0,0 +1,93 @@
+// ****************************************************************
+//
+// kodiaq Data Acquisition Software
+//
+// File     : CompressionController.cc
+// Date     : 16.10.2026
+//
+// Brief    : Picks how hard to compress each board's data depending
+//            on how well the processors keep up
+//
+// *****************************************************************
+
+#include "CompressionController.hh"
+#include "DataCodec.hh"
+
+// A board is behind if this much of its BLT pool is waiting or the
+// machine is this busy. It is allowed back up a rung only when both are
+// well below, so it doesn't flip every second.
+#define COMPRESSION_POOL_HIGH  0.5
+#define COMPRESSION_POOL_LOW   0.1
+#define COMPRESSION_CPU_HIGH   90.
+#define COMPRESSION_CPU_LOW    75.
+
+CompressionController::CompressionController()
+{
+  AddRung(CODEC_NONE, 0);
+}
+
+CompressionController::~CompressionController()
+{
+}
+
+void CompressionController::AddRung(int codec, int level)
+{
+  m_codecs.push_back(codec);
+  m_levels.push_back(level);
+}
+
+void CompressionController::Initialize(const run_config_t &config)
+{
+  m_codecs.clear();
+  m_levels.clear();
+  AddRung(config.codec, config.codec_level);
+  // Protocol buffer files have one codec for the whole file. Mongodb
+  // documents and binary file records say which one they use.
+  if(config.adaptive_compression != 1 || config.codec == CODEC_NONE ||
+     (config.write_mode != WRITEMODE_MONGODB && 
+      config.write_mode != WRITEMODE_BINARY))
+    return;
+
+  // Only zstd has slower settings worth stepping down from before
+  // falling back to a fast codec. The others go straight to none.
+  if(config.codec == CODEC_ZSTD){
+    if(config.codec_level != 1)
+      AddRung(CODEC_ZSTD, 1);
+    if(DataCodec::Available(CODEC_LZ4))
+      AddRung(CODEC_LZ4, 0);
+    else
+      AddRung(CODEC_SNAPPY, 0);
+  }
+  AddRung(CODEC_NONE, 0);
+}
+
+int CompressionController::Update(int rung, double poolFraction, double cpuPct)
+{
+  if(poolFraction > COMPRESSION_POOL_HIGH || cpuPct > COMPRESSION_CPU_HIGH){
+    if(rung < (int)m_codecs.size()-1)
+      return rung+1;
+    return rung;
+  }
+  if(poolFraction < COMPRESSION_POOL_LOW && cpuPct < COMPRESSION_CPU_LOW &&
+     rung > 0)
+    return rung-1;
+  return rung;
+}
+
+string CompressionController::CodecName(int codec)
+{
+  switch(codec){
+  case CODEC_NONE:
+    return "none";
+  case CODEC_SNAPPY:
+    return "snappy";
+  case CODEC_LZ4:
+    return "lz4";
+  case CODEC_ZSTD:
+    return "zstd";
+  case CODEC_V1724:
+    return "v1724";
+  default:
+    return "unknown";
+  }
+}
@@ -0,0 +1,71 @@
+#ifndef _COMPRESSIONCONTROLLER_HH_
+#define _COMPRESSIONCONTROLLER_HH_
+
+// ****************************************************************
+//
+// kodiaq Data Acquisition Software
+//
+// File     : CompressionController.hh
+// Date     : 16.10.2026
+//
+// Brief    : Picks how hard to compress each board's data depending
+//            on how well the processors keep up
+//
+// *****************************************************************
+
+#include <vector>
+#include <string>
+#include <koOptions.hh>
+
+using namespace std;
+
+/*! \brief Ladder of codecs from the configured one down to none.
+
+    Rung 0 is the codec from the options. Every further rung is cheaper
+    and the last one is always CODEC_NONE. With adaptive_compression off
+    the ladder only has rung 0, and the same goes for file output since
+    libpbf has one codec per file.
+
+    Once a second Update is called for each board with the fraction of
+    its BLT pool in use and the CPU load from koSysmon. If the board
+    falls behind it moves one rung down the ladder, and once things are
+    quiet again it moves one rung back up. Every processor builds its
+    codecs from the same ladder (see DataProcessor), and each document
+    records the codec that was really used.
+ */
+class CompressionController
+{
+ public:
+  CompressionController();
+  virtual ~CompressionController();
+
+  //
+  // Name     : void CompressionController::Initialize(const run_config_t &config)
+  // Purpose  : Build the ladder for the codec in the options
+  //
+  void          Initialize(const run_config_t &config);
+  //
+  // Name     : int CompressionController::Update(int rung, double poolFraction,
+  //                                              double cpuPct)
+  // Purpose  : Returns the rung a board currently on rung should use now
+  //
+  int           Update(int rung, double poolFraction, double cpuPct);
+
+  int           GetRungs(){
+    return m_codecs.size();
+  };
+  int           GetCodec(int rung){
+    return m_codecs[rung];
+  };
+  int           GetLevel(int rung){
+    return m_levels[rung];
+  };
+  static string CodecName(int codec);
+
+ private:
+  void          AddRung(int codec, int level);
+  vector<int>   m_codecs;
+  vector<int>   m_levels;
+};
+
+#endif
@@ -13,6 +13,9 @@
 // ****************************************************************
 
 #include "DAQRecorder.hh"
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
 
 DAQRecorder::DAQRecorder()
 {
@@ -73,21 +76,49 @@ void DAQRecorder::ResetError()
 #ifdef HAVE_LIBMONGOCLIENT
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <cstdlib>
+#include <climits>
+#include <unistd.h>
+#include <sys/time.h>
 //
 // DAQRecorder_mongodb
 // 
 
+#define MONGO_RECONNECT_S      10     // Retry lost hosts this often
+#define MONGO_INSERT_ATTEMPTS  3      // Then a turned down insert is dropped
+
+// The driver only needs this once per process
+static pthread_once_t g_mongoClientOnce = PTHREAD_ONCE_INIT;
+static void InitializeMongoClient()
+{
+  mongo::client::initialize();
+}
+
 DAQRecorder_mongodb::DAQRecorder_mongodb()
                     :DAQRecorder()
 {
   pthread_mutex_init(&m_childlock, NULL);
   m_DB_USER=m_DB_PASSWORD="";
+  m_iCollectionVersion = 0;
+  m_iProcessors = m_iPoolSize = 0;
+  m_iReplays = 0;
+  m_pSpill = NULL;
+  m_iSpillLeft = 0;
+  m_pStatus = NULL;
+  pthread_mutex_init(&m_ProgressMutex, NULL);
+  m_bAcknowledged = false;
+  m_bReconnectRunning = m_bReconnectStop = false;
+  pthread_mutex_init(&m_ReconnectLock, NULL);
+  pthread_cond_init(&m_ReconnectCond, NULL);
 }
 
 DAQRecorder_mongodb::~DAQRecorder_mongodb()
 {
   pthread_mutex_destroy(&m_childlock);
    CloseConnections();
+  pthread_mutex_destroy(&m_ProgressMutex);
+  pthread_cond_destroy(&m_ReconnectCond);
+  pthread_mutex_destroy(&m_ReconnectLock);
 }
 
 DAQRecorder_mongodb::DAQRecorder_mongodb(koLogger *koLog, string DB_USER,
@@ -97,10 +128,71 @@ DAQRecorder_mongodb::DAQRecorder_mongodb(koLogger *koLog, string DB_USER,
   m_DB_USER=DB_USER;
   m_DB_PASSWORD=DB_PASSWORD;
   pthread_mutex_init(&m_childlock, NULL);
+  m_iCollectionVersion = 0;
+  m_iProcessors = m_iPoolSize = 0;
+  m_iReplays = 0;
+  m_pSpill = NULL;
+  m_iSpillLeft = 0;
+  m_pStatus = NULL;
+  pthread_mutex_init(&m_ProgressMutex, NULL);
+  m_bAcknowledged = false;
+  m_bReconnectRunning = m_bReconnectStop = false;
+  pthread_mutex_init(&m_ReconnectLock, NULL);
+  pthread_cond_init(&m_ReconnectCond, NULL);
 }
 
 void DAQRecorder_mongodb::CloseConnections()
 {
+   // No more new connections
+   if(m_bReconnectRunning){
+     pthread_mutex_lock(&m_ReconnectLock);
+     m_bReconnectStop = true;
+     pthread_cond_broadcast(&m_ReconnectCond);
+     pthread_mutex_unlock(&m_ReconnectLock);
+     pthread_join(m_ReconnectThread, NULL);
+     m_bReconnectRunning = false;
+   }
+   // Writers first, they still need their connection for what's queued.
+   // Those of lost hosts pass their queue on, so they stop before the
+   // writers they hand it to.
+   for(unsigned int x=0; x<m_vHosts.size(); x++)
+     if(m_vHosts[x].bFailed)
+       for(unsigned int y=0; y<m_vHosts[x].writers.size(); y++)
+	 m_vWriters[m_vHosts[x].writers[y]]->Stop();
+   // Then whatever was spilled, as far as the writers still take it
+   if(m_pSpill != NULL){
+     m_pSpill->Close();
+     u_int64_t left = m_pSpill->Pending();
+     m_iSpillLeft = left;
+     if(left != 0){
+       stringstream err;
+       err<<"DAQRecorder_mongodb - "<<left<<" bytes of data could not be "
+	  <<"written, they are in "<<m_sSpillPath<<"_*.dat";
+       LogError(err.str());
+     }
+     delete m_pSpill;
+     m_pSpill = NULL;
+   }
+   for(unsigned int x=0; x<m_vWriters.size(); x++)
+     m_vWriters[x]->Stop();
+   // Markers last, everything they stand for is written now
+   if(m_pStatus != NULL){
+     int left = m_pStatus->Stop();
+     if(left != 0)
+       LogMessage("DAQRecorder_mongodb - " + koHelper::IntToString(left) +
+		  " chunk markers or progress documents could not be written");
+     delete m_pStatus;
+     m_pStatus = NULL;
+   }
+   for(unsigned int x=0; x<m_vWriters.size(); x++)
+     delete m_vWriters[x];
+   m_vWriters.clear();
+   m_vHosts.clear();
+   m_moduleHosts.clear();
+   m_iProcessors = m_iPoolSize = 0;
+   pthread_mutex_lock(&m_ProgressMutex);
+   m_openTimes.clear();
+   pthread_mutex_unlock(&m_ProgressMutex);
    for(unsigned int x=0; x<m_vScopedConnections.size(); x++)  {	
      //m_vScopedConnections[x]->done();
      delete m_vScopedConnections[x];
@@ -114,23 +206,90 @@ int DAQRecorder_mongodb::Initialize(koOptions *options)
 {
    if(options == NULL) return -1;
    m_options = options;
+   m_mongoOptions = options->GetRunConfig().mongo;
+   m_iCollectionVersion++;
    CloseConnections();
    ResetError();
    m_children.clear();
    m_bInitialized = true;
    pthread_mutex_init(&m_ConnectionMutex,NULL);
-      
+
+   // Host 0 is the address the master gave this reader. Modules listed
+   // in the hosts map go to their own host, reader names in it are only
+   // for the master.
+   mongo_host_t host;
+   host.address = m_mongoOptions.address;
+   host.bFailed = false;
+   m_vHosts.push_back(host);
+   for(map<string,string>::const_iterator it = m_mongoOptions.hosts.begin();
+       it != m_mongoOptions.hosts.end(); it++){
+     if(it->first.empty() || 
+	it->first.find_first_not_of("0123456789") != string::npos)
+       continue;
+     unsigned int index = 0;
+     while(index < m_vHosts.size() && m_vHosts[index].address != it->second)
+       index++;
+     if(index == m_vHosts.size()){
+       host.address = it->second;
+       m_vHosts.push_back(host);
+     }
+     m_moduleHosts[atoi(it->first.c_str())] = index;
+   }
+
+   // Local spill file, one per process
+   if(m_mongoOptions.spill_path != ""){
+     stringstream path;
+     path<<m_mongoOptions.spill_path<<"/kodiaq_spill_"<<getpid()<<"_"
+	 <<koLogger::GetCurrentTime();
+     m_sSpillPath = path.str();
+     m_pSpill = new SpillFile(this);
+     if(m_pSpill->Open(m_sSpillPath, 
+		       (u_int64_t)m_mongoOptions.spill_chunk_mb*1048576) != 0){
+       LogError("DAQRecorder_mongodb - Can't create spill file " + m_sSpillPath);
+       delete m_pSpill;
+       m_pSpill = NULL;
+       return -1;
+     }
+   }
+   m_iSpillLeft = 0;
+
+   // Failover only notices a lost insert if the server answers
+   m_bAcknowledged = (m_mongoOptions.write_concern != 0);
+   if(!m_bAcknowledged && (m_vHosts.size() > 1 || m_pSpill != NULL)){
+     m_bAcknowledged = true;
+     LogMessage("DAQRecorder_mongodb - Using acknowledged writes since "
+		"inserts can fail over to other hosts or the spill file");
+   }
+
+   // Lost hosts are retried whether or not there is a spill file
+   m_bReconnectStop = false;
+   if(pthread_create(&m_ReconnectThread, NULL, 
+		     DAQRecorder_mongodb::ReconnectWrapper,
+		     static_cast<void*>(this)) != 0){
+     LogError("DAQRecorder_mongodb - Failed to start the reconnect thread");
+     return -1;
+   }
+   m_bReconnectRunning = true;
+
+   if(options->GetRunConfig().time_chunk_ms > 0 || 
+      m_mongoOptions.progress_interval_ms > 0){
+     m_pStatus = new StatusWriter(this, m_mongoOptions.progress_interval_ms);
+     if(m_pStatus->Start() != 0){
+       LogError("DAQRecorder_mongodb - Failed to start the status thread");
+       delete m_pStatus;
+       m_pStatus = NULL;
+       return -1;
+     }
+   }
    return 0;
 }
 
-int DAQRecorder_mongodb::RegisterProcessor()
+mongo::DBClientBase* DAQRecorder_mongodb::Connect(const string &address)
 {
-  int retval=-1;
   mongo::DBClientBase *conn;
    
   // Create connection string
-  mongo_option_t mongo_opts = m_options->GetMongoOptions();
-  string connstring = mongo_opts.address;
+  string connstring = address;
   if(m_DB_USER!="" && m_DB_PASSWORD!=""){
     connstring=connstring.substr(10, connstring.size()-10);
     connstring = "mongodb://" + m_DB_USER + ":" + m_DB_PASSWORD +"@"+ connstring;
@@ -144,54 +303,304 @@ int DAQRecorder_mongodb::RegisterProcessor()
     LogError(connstring);
     LogError("Invalid MongoDB connection string provided. Error returned: " + 
 	     errstring);
-    return -1;
+    return NULL;
   }
   errstring = "";
   try{
-    mongo::client::initialize();
+    pthread_once(&g_mongoClientOnce, InitializeMongoClient);
     conn = cstring.connect(errstring);
-
-    //using mongo::client::initialize;
-    //using mongo::client::Options;
-    // Configure the mongo C++ client driver, enabling SSL and setting
-    // the SSL Certificate Authority file to "mycafile".
-    //initialize(Options().setSSLMode(Options::kSSLRequired));
-    //mongo::client::initialize();
-    
+    if(conn == NULL){
+      // Not fatal, the other hosts take over
+      LogMessage("DAQRecorder_mongodb - Error connecting to " + address + 
+		 ": " + errstring);
+      return NULL;
+    }
 
     // Set write concern
-    if( mongo_opts.write_concern == 0 ){
+    if( !m_bAcknowledged ){
       conn->setWriteConcern( mongo::WriteConcern::unacknowledged );
       LogMessage( "MongoDB WriteConcern set to NONE" );  
-      LogMessage( mongo_opts.address );
+      LogMessage( address );
     }
     else{      
       conn->setWriteConcern( mongo::WriteConcern::acknowledged );
       LogMessage( "MongoDB WriteConcern set to NORMAL" );
-      LogMessage( mongo_opts.address );
+      LogMessage( address );
     }
   }
   catch(const mongo::DBException &e)  {
     stringstream err;
-    err<<"DAQRecorder_mongodb::RegisterProcessor - Error connecting to mongodb "<<e.toString();
-    LogError(err.str());
-    return -1;
+    err<<"DAQRecorder_mongodb - Error connecting to mongodb "<<e.toString();
+    LogMessage(err.str());
+    return NULL;
+  }
+  return conn;
+}
+
+int DAQRecorder_mongodb::RegisterProcessor()
+{
+  const mongo_option_t &mongo_opts = m_mongoOptions;
+  pthread_mutex_lock(&m_ConnectionMutex);
+  int retval = m_iProcessors++;
+  bool bGrow = (mongo_opts.connections_per_host <= 0 ||
+		m_iPoolSize < mongo_opts.connections_per_host);
+  if(bGrow)
+    m_iPoolSize++;
+  vector<string> addresses;
+  for(unsigned int x=0; x<m_vHosts.size(); x++)
+    addresses.push_back(m_vHosts[x].address);
+  pthread_mutex_unlock(&m_ConnectionMutex);
+
+  // One more connection and writer on every host. Connecting takes a
+  // while, so it's done without the lock.
+  for(unsigned int x=0; bGrow && x<addresses.size(); x++){
+    if(HostFailed(x))
+      continue;
+    mongo::DBClientBase *conn = Connect(addresses[x]);
+    if(conn == NULL){
+      SetHostFailed(x);
+      continue;
+    }
+    if(AddWriter(x, conn) != 0){
+      LogError("DAQRecorder_mongodb::RegisterProcessor - Failed to start writer thread");
+      return -1;
+    }
   }
-  int lock = pthread_mutex_lock(&m_ConnectionMutex);
-  if(lock!=0)  {
+
+  // Good as long as some host takes the data
+  pthread_mutex_lock(&m_ConnectionMutex);
+  bool bHaveHost = false;
+  for(unsigned int x=0; x<m_vHosts.size(); x++)
+    if(!m_vHosts[x].bFailed && m_vHosts[x].writers.size() != 0)
+      bHaveHost = true;
+  pthread_mutex_unlock(&m_ConnectionMutex);
+  if(!bHaveHost){
+    LogError("DAQRecorder_mongodb::RegisterProcessor - No buffer database could be reached");
     return -1;
   }
+  return retval;
+}
+
+int DAQRecorder_mongodb::AddWriter(int host, mongo::DBClientBase *conn)
+{
+  pthread_mutex_lock(&m_ConnectionMutex);
   m_vScopedConnections.push_back(conn);
-  retval = m_vScopedConnections.size()-1;
   m_children.push_back(0);
+  MongoWriter *writer = new MongoWriter(this, conn, m_vWriters.size(), host,
+					m_mongoOptions.write_queue_depth);
+  if(writer->Start()!=0){
+    pthread_mutex_unlock(&m_ConnectionMutex);
+    delete writer;
+    return -1;
+  }
+  m_vHosts[host].writers.push_back(m_vWriters.size());
+  m_vWriters.push_back(writer);
   pthread_mutex_unlock(&m_ConnectionMutex);
-       
-  return retval;
+  return 0;
+}
+
+void DAQRecorder_mongodb::ReconnectHosts()
+{
+  pthread_mutex_lock(&m_ConnectionMutex);
+  vector<int> lost;
+  for(unsigned int x=0; x<m_vHosts.size(); x++)
+    if(m_vHosts[x].bFailed)
+      lost.push_back(x);
+  pthread_mutex_unlock(&m_ConnectionMutex);
+
+  for(unsigned int x=0; x<lost.size(); x++){
+    int host = lost[x];
+    pthread_mutex_lock(&m_ConnectionMutex);
+    string address = m_vHosts[host].address;
+    vector<int> writers = m_vHosts[host].writers;
+    pthread_mutex_unlock(&m_ConnectionMutex);
+
+    // Every writer needs a fresh connection. The old ones may still be
+    // in use, they are only deleted with the others.
+    vector<mongo::DBClientBase*> conns;
+    unsigned int nConns = (writers.size() == 0) ? 1 : writers.size();
+    for(unsigned int y=0; y<nConns; y++){
+      mongo::DBClientBase *conn = Connect(address);
+      if(conn == NULL)
+	break;
+      conns.push_back(conn);
+    }
+    if(conns.size() < nConns){
+      for(unsigned int y=0; y<conns.size(); y++)
+	delete conns[y];
+      continue;
+    }
+    if(writers.size() == 0){
+      // Never reached at the start
+      if(AddWriter(host, conns[0]) != 0)
+	continue;
+    }
+    else{
+      pthread_mutex_lock(&m_ConnectionMutex);
+      for(unsigned int y=0; y<writers.size(); y++){
+	m_vScopedConnections.push_back(conns[y]);
+	m_vWriters[writers[y]]->SetConnection(conns[y]);
+      }
+      pthread_mutex_unlock(&m_ConnectionMutex);
+    }
+    pthread_mutex_lock(&m_ConnectionMutex);
+    m_vHosts[host].bFailed = false;
+    pthread_mutex_unlock(&m_ConnectionMutex);
+    LogMessage("DAQRecorder_mongodb - Buffer database " + address + " is back");
+  }
+}
+
+void* DAQRecorder_mongodb::ReconnectWrapper(void *data)
+{
+  DAQRecorder_mongodb *recorder = static_cast<DAQRecorder_mongodb*>(data);
+  recorder->ReconnectThread();
+  return data;
+}
+
+void DAQRecorder_mongodb::ReconnectThread()
+{
+  pthread_mutex_lock(&m_ReconnectLock);
+  while(!m_bReconnectStop){
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    struct timespec until;
+    until.tv_sec = now.tv_sec + MONGO_RECONNECT_S;
+    until.tv_nsec = now.tv_usec * 1000;
+    pthread_cond_timedwait(&m_ReconnectCond, &m_ReconnectLock, &until);
+    if(m_bReconnectStop)
+      break;
+    pthread_mutex_unlock(&m_ReconnectLock);
+    ReconnectHosts();
+    pthread_mutex_lock(&m_ReconnectLock);
+  }
+  pthread_mutex_unlock(&m_ReconnectLock);
+}
+
+bool DAQRecorder_mongodb::CanReplay()
+{
+  // Only into writers that keep up, live data comes first
+  bool ret = false;
+  pthread_mutex_lock(&m_ConnectionMutex);
+  for(unsigned int x=0; x<m_vHosts.size() && !ret; x++){
+    if(m_vHosts[x].bFailed)
+      continue;
+    for(unsigned int y=0; y<m_vHosts[x].writers.size() && !ret; y++)
+      if(!m_vWriters[m_vHosts[x].writers[y]]->Congested(m_mongoOptions.spill_latency_ms))
+	ret = true;
+  }
+  pthread_mutex_unlock(&m_ConnectionMutex);
+  return ret;
+}
+
+int DAQRecorder_mongodb::UpdateProgressDoc(int module, long long time, int ID)
+{
+  if(m_pStatus == NULL || ID < 0)
+    return 0;
+  pthread_mutex_lock(&m_ProgressMutex);
+  vector<long long> &times = m_openTimes[module];
+  if((int)times.size() <= ID)
+    times.resize(ID+1, LLONG_MAX);
+  times[ID] = time;
+  pthread_mutex_unlock(&m_ProgressMutex);
+  return 0;
+}
+
+long long DAQRecorder_mongodb::LowestOpenTime(int module)
+{
+  long long ret = LLONG_MAX;
+  pthread_mutex_lock(&m_ProgressMutex);
+  map<int, vector<long long> >::const_iterator it = m_openTimes.find(module);
+  if(it != m_openTimes.end())
+    for(unsigned int x=0; x<it->second.size(); x++)
+      if(it->second[x] < ret)
+	ret = it->second[x];
+  pthread_mutex_unlock(&m_ProgressMutex);
+  return ret;
+}
+
+void DAQRecorder_mongodb::ModuleProcessed(int module, long long time)
+{
+  if(m_pStatus != NULL)
+    m_pStatus->SetProcessed(module, time);
+}
+
+void DAQRecorder_mongodb::ChunkComplete(int module, long long chunk,
+					long long start, long long end,
+					bool bComplete)
+{
+  if(m_pStatus != NULL)
+    m_pStatus->AddMarker(module, chunk, start, end, bComplete);
+}
+
+u_int64_t DAQRecorder_mongodb::SpillPending()
+{
+  if(m_pSpill == NULL)
+    return m_iSpillLeft;
+  return m_pSpill->Pending();
+}
+
+string DAQRecorder_mongodb::GetHostAddress(int host)
+{
+  pthread_mutex_lock(&m_ConnectionMutex);
+  string ret;
+  if(host >= 0 && host < (int)m_vHosts.size())
+    ret = m_vHosts[host].address;
+  pthread_mutex_unlock(&m_ConnectionMutex);
+  return ret;
+}
+
+int DAQRecorder_mongodb::GetRoute(int module)
+{
+  map<int,int>::const_iterator it = m_moduleHosts.find(module);
+  if(it == m_moduleHosts.end())
+    return 0;
+  return it->second;
+}
+
+void DAQRecorder_mongodb::SetHostFailed(int host)
+{
+  pthread_mutex_lock(&m_ConnectionMutex);
+  bool bNew = (host>=0 && host<(int)m_vHosts.size() && !m_vHosts[host].bFailed);
+  string address;
+  if(bNew){
+    m_vHosts[host].bFailed = true;
+    address = m_vHosts[host].address;
+  }
+  pthread_mutex_unlock(&m_ConnectionMutex);
+  if(bNew)
+    LogMessage("DAQRecorder_mongodb - Lost buffer database " + address +
+	       ", its inserts go to the others");
+}
+
+bool DAQRecorder_mongodb::HostFailed(int host)
+{
+  pthread_mutex_lock(&m_ConnectionMutex);
+  bool ret = (host<0 || host>=(int)m_vHosts.size() || m_vHosts[host].bFailed);
+  pthread_mutex_unlock(&m_ConnectionMutex);
+  return ret;
+}
+
+MongoWriter* DAQRecorder_mongodb::PickWriter(int ID, int host)
+{
+  // Lock must be held. The host itself if it works, otherwise the next
+  // one that does.
+  int nHosts = m_vHosts.size();
+  if(host < 0 || host >= nHosts)
+    host = 0;
+  for(int x=0; x<nHosts; x++){
+    const mongo_host_t &h = m_vHosts[(host+x)%nHosts];
+    if(h.bFailed || h.writers.size() == 0)
+      continue;
+    return m_vWriters[h.writers[(unsigned int)ID % h.writers.size()]];
+  }
+  return NULL;
 }
 
 void DAQRecorder_mongodb::UpdateCollection(koOptions *options)
 {
    m_options = options;
+   m_mongoOptions = options->GetRunConfig().mongo;
+   m_iCollectionVersion++;
 }
 
 void DAQRecorder_mongodb::Shutdown()
@@ -232,32 +641,32 @@ void DAQRecorder_mongodb::Fillicide(int ID){
   pthread_mutex_unlock(&m_childlock);
 }
 
-int DAQRecorder_mongodb::InsertThreaded(vector <mongo::BSONObj> *insvec,
-					int ID, int resetCount)
+string DAQRecorder_mongodb::GetCollectionName(int resetCount)
+{
+  stringstream cS;
+  cS<<m_mongoOptions.database<<"."<<m_mongoOptions.collection;
+  if(resetCount!=-1)
+    cS<<"_"<<resetCount;
+  return cS.str();
+}
+
+int DAQRecorder_mongodb::InsertThreaded(const vector <mongo::BSONObj> &insvec,
+					mongo::DBClientBase *conn,
+					const string &ns)
 {  
   //  Fillicide(ID);
 
-  // The ownership of insvec is passed to this function!
-  mongo_option_t mongo_opts = m_options->GetMongoOptions();
+  const mongo_option_t &mongo_opts = m_mongoOptions;
 
-  if(m_vScopedConnections.size()==0 || !m_bInitialized 
-     || insvec->size() == 0)  {
-      delete insvec;
+  if(!m_bInitialized || insvec.size() == 0)  {
       return 0;
    }
    
-   if(ID>(int)m_vScopedConnections.size() || ID<0 )  {
-      delete insvec;
+   if(conn == NULL)  {
       LogError("DAQRecorder_mongodb - Received request for out of scope insert.");
       return -1;
    }
 
-   stringstream cS;
-   cS<<mongo_opts.database<<"."<<
-     mongo_opts.collection;
-   if(resetCount!=-1)
-     cS<<"_"<<resetCount;
-
    // Fork the insert
    //pid_t pid = fork();
    //if (pid == 0)
@@ -279,7 +688,7 @@ int DAQRecorder_mongodb::InsertThreaded(vector <mongo::BSONObj> *insvec,
      mongo::WriteResult RES;
      mongo::WriteConcern WC;
      
-     if(mongo_opts.write_concern == 0)
+     if(!m_bAcknowledged)
        WC = mongo::WriteConcern::unacknowledged;
      else
        WC = mongo::WriteConcern::acknowledged;
@@ -287,9 +696,9 @@ int DAQRecorder_mongodb::InsertThreaded(vector <mongo::BSONObj> *insvec,
      // Using mongo bulk op API     
      if(mongo_opts.unordered_bulk_inserts){
        mongo:: BulkOperationBuilder bulky = 
-	 m_vScopedConnections[ID]->initializeUnorderedBulkOp(cS.str());
-       for(unsigned int i=0; i<insvec->size(); i+=1)
-	 bulky.insert((*insvec)[i]);
+	 conn->initializeUnorderedBulkOp(ns);
+       for(unsigned int i=0; i<insvec.size(); i+=1)
+	 bulky.insert(insvec[i]);
        bulky.execute(&WC, &RES);
        //std::cout<<"Unordered write "<<insvec->size()<<" docs with WC "<<WC.obj().toString()<<endl;
      }
@@ -304,17 +713,21 @@ int DAQRecorder_mongodb::InsertThreaded(vector <mongo::BSONObj> *insvec,
        
 	 //old line
        //       cout<<"Inserting "<<insvec->size()<<" documents ("<<ID<<")"<<endl;
-       ( m_vScopedConnections[ID])->insert( cS.str(), (*insvec), 0, &WC );
+       conn->insert( ns, insvec, 0, &WC );
 
      }
    }
    catch(const mongo::DBException &e)  {
      stringstream elog;
      elog<<"DAQRecorder_mongodb - Caught mongodb exception writing to "
-	 <<cS.str()<<" : "<<e.what()<<endl;
-     LogError(elog.str());
-     delete insvec;	 
-     //return -1;
+	 <<ns<<" : "<<e.what()<<endl;
+     // A lost connection is the host's problem, the writer moves
+     // the insert to another one. Otherwise it is spilled and tried
+     // again (InsertFailed).
+     if(conn->isFailed())
+       return -1;
+     LogMessage(elog.str());
+     return -2;
    }
    //_exit(0);
    //}
@@ -322,9 +735,117 @@ int DAQRecorder_mongodb::InsertThreaded(vector <mongo::BSONObj> *insvec,
    //m_children[ID]=(pid);
    //pthread_mutex_unlock(&m_childlock);
    
-   delete insvec;
    return 0;            
 }
+
+int DAQRecorder_mongodb::InsertAsync(BSONBatch *batch, int ID, int resetCount,
+				     int host)
+{
+  return Queue(batch, ID, resetCount, host, true, true, 0);
+}
+
+int DAQRecorder_mongodb::HandOff(BSONBatch *batch, int ID, int resetCount,
+				 int host, int attempts)
+{
+  return Queue(batch, ID, resetCount, host, true, false, attempts);
+}
+
+int DAQRecorder_mongodb::InsertFailed(BSONBatch *batch, int resetCount,
+				      int host, int attempts)
+{
+  stringstream err;
+  err<<"DAQRecorder_mongodb - Dropped an insert of "<<batch->Documents()
+     <<" documents that failed "<<attempts<<" times";
+  if(attempts >= MONGO_INSERT_ATTEMPTS || m_pSpill == NULL){
+    LogError(err.str());
+    return -1;
+  }
+  if(m_pSpill->Write(batch, resetCount, host, attempts) != 0){
+    LogError("DAQRecorder_mongodb - Could not write to the spill file " + 
+	     m_sSpillPath);
+    LogError(err.str());
+    return -1;
+  }
+  return 0;
+}
+
+int DAQRecorder_mongodb::ReplayInsert(BSONBatch *batch, int resetCount, int host,
+				      int attempts)
+{
+  return Queue(batch, m_iReplays++, resetCount, host, false, true, attempts);
+}
+
+int DAQRecorder_mongodb::Queue(BSONBatch *batch, int ID, int resetCount,
+			       int host, bool bSpill, bool bWait, int attempts)
+{
+  // A writer that just lost its host turns the insert down, the next
+  // pick skips that host
+  int nHosts = GetHosts();
+  for(int attempt=0; attempt<=nHosts; attempt++){
+    pthread_mutex_lock(&m_ConnectionMutex);
+    MongoWriter *writer = PickWriter(ID, host);
+    pthread_mutex_unlock(&m_ConnectionMutex);
+
+    // Rather than wait for a backed up writer (or lose the data if there
+    // is no host left) write it to disk. The replay thread brings it back.
+    if(bSpill && m_pSpill != NULL &&
+       (writer == NULL || writer->Congested(m_mongoOptions.spill_latency_ms))){
+      int ret = m_pSpill->Write(batch, resetCount, host, attempts);
+      if(ret == 0){
+	batch->Clear();
+	if(writer != NULL)
+	  writer->Recycle(batch);
+	else
+	  delete batch;
+	return 0;
+      }
+      LogError("DAQRecorder_mongodb - Could not write to the spill file " + 
+	       m_sSpillPath);
+    }
+    if(writer == NULL)
+      break;
+    int ret = writer->Push(batch, resetCount, bWait, attempts);
+    if(ret != 2)
+      return ret;
+  }
+  if(!bWait)
+    return 1;
+  delete batch;
+  LogError("DAQRecorder_mongodb - No buffer database left to insert into.");
+  return -1;
+}
+
+BSONBatch* DAQRecorder_mongodb::GetBatch(int ID, int host)
+{
+  pthread_mutex_lock(&m_ConnectionMutex);
+  MongoWriter *writer = PickWriter(ID, host);
+  pthread_mutex_unlock(&m_ConnectionMutex);
+  if(writer == NULL)
+    return new BSONBatch();
+  return writer->GetBatch();
+}
+
+void DAQRecorder_mongodb::GetWriterStats(mongo_writer_stats_t &stats)
+{
+  stats.depth = stats.capacity = stats.peak = 0;
+  stats.stalls = stats.inserts = 0;
+  stats.spilled = (m_pSpill != NULL) ? m_pSpill->Pending() : 0;
+  pthread_mutex_lock(&m_ConnectionMutex);
+  for(unsigned int x=0; x<m_vWriters.size(); x++)
+    m_vWriters[x]->GetStats(stats);
+  pthread_mutex_unlock(&m_ConnectionMutex);
+}
+
+void DAQRecorder_mongodb::GetWriterProgress(vector<u_int64_t> &pushed,
+					    vector<u_int64_t> &finished)
+{
+  pthread_mutex_lock(&m_ConnectionMutex);
+  pushed.resize(m_vWriters.size());
+  finished.resize(m_vWriters.size());
+  for(unsigned int x=0; x<m_vWriters.size(); x++)
+    m_vWriters[x]->GetProgress(pushed[x], finished[x]);
+  pthread_mutex_unlock(&m_ConnectionMutex);
+}
 #endif
 
 #ifdef HAVE_LIBPBF
@@ -370,8 +891,15 @@ int DAQRecorder_protobuff::Initialize(koOptions *options)
   else
      m_SWritePath = m_options->GetString("file_path");
    
+   // libpbf records snappy compression in the file itself ("pz"). It has
+   // no way to say which other codec was used, so those are refused.
    stringstream sstream;
-   if(m_options->GetInt("compression")==1)
+   int codec = m_options->GetRunConfig().codec;
+   if(codec != CODEC_NONE && codec != CODEC_SNAPPY){
+     LogError("DAQRecorder_protobuff - Files can only be written with snappy or no compression");
+     return -1;
+   }
+   if(codec==CODEC_SNAPPY)
      sstream<<"pz:";
    sstream<<"n"<<m_options->GetInt("file_events_per_file");
    
@@ -402,3 +930,127 @@ void DAQRecorder_protobuff::Shutdown()
 
 #endif
 
+
+//
+// DAQRecorder_binary
+//
+
+DAQRecorder_binary::DAQRecorder_binary()
+                   :DAQRecorder()
+{
+  m_SWritePath = "data";
+  m_iMaxFileBytes = 0;
+  m_iNextStream = 0;
+  m_iChunksFd = -1;
+  pthread_mutex_init(&m_StreamMutex, NULL);
+}
+
+DAQRecorder_binary::DAQRecorder_binary(koLogger *koLog)
+                   :DAQRecorder(koLog)
+{
+  m_SWritePath = "data";
+  m_iMaxFileBytes = 0;
+  m_iNextStream = 0;
+  m_iChunksFd = -1;
+  pthread_mutex_init(&m_StreamMutex, NULL);
+}
+
+DAQRecorder_binary::~DAQRecorder_binary()
+{
+  Shutdown();
+  if(m_iChunksFd >= 0)
+    close(m_iChunksFd);
+  pthread_mutex_destroy(&m_StreamMutex);
+}
+
+int DAQRecorder_binary::Initialize(koOptions *options)
+{
+  Shutdown();
+  m_options = options;
+
+  // Same names as the protocol buffer files, the stream and file
+  // numbers are added to them
+  string path = m_options->GetString("file_path");
+  if(m_options->GetInt("dynamic_run_names") == 1){
+    std::size_t pos = path.find_first_of("*", 0);
+    if(pos != string::npos)
+      path = path.substr(0, pos);
+    if(path.size() != 0 && path[path.size()-1] != '/' &&
+       path[path.size()-1] != '_')
+      path += "_";
+    path += koHelper::GetRunNumber("run");
+  }
+  if(path == ""){
+    LogError("DAQRecorder_binary - No file_path given");
+    return -1;
+  }
+  m_SWritePath = path;
+  m_iMaxFileBytes = (u_int64_t)m_options->GetRunConfig().file_size_mb*1024*1024;
+  m_iNextStream = 0;
+
+  if(m_iChunksFd >= 0)
+    close(m_iChunksFd);
+  m_iChunksFd = -1;
+  if(m_options->GetRunConfig().time_chunk_ms > 0){
+    string chunks = m_SWritePath + "_chunks.txt";
+    m_iChunksFd = open(chunks.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if(m_iChunksFd < 0){
+      LogError("DAQRecorder_binary - Can't create " + chunks);
+      return -1;
+    }
+  }
+  m_bInitialized = true;
+  return 0;
+}
+
+int DAQRecorder_binary::RegisterProcessor()
+{
+  pthread_mutex_lock(&m_StreamMutex);
+  int ID = m_vStreams.size();
+  BinaryFile *stream = new BinaryFile();
+  if(stream->Open(m_SWritePath, m_iNextStream, m_iMaxFileBytes) != 0){
+    pthread_mutex_unlock(&m_StreamMutex);
+    LogError("DAQRecorder_binary - Can't create " + stream->GetFileName());
+    delete stream;
+    return -1;
+  }
+  m_iNextStream++;
+  m_vStreams.push_back(stream);
+  pthread_mutex_unlock(&m_StreamMutex);
+  return ID;
+}
+
+BinaryFile* DAQRecorder_binary::GetStream(int ID)
+{
+  pthread_mutex_lock(&m_StreamMutex);
+  BinaryFile *stream = NULL;
+  if(ID >= 0 && ID < (int)m_vStreams.size())
+    stream = m_vStreams[ID];
+  pthread_mutex_unlock(&m_StreamMutex);
+  return stream;
+}
+
+void DAQRecorder_binary::Shutdown()
+{
+  pthread_mutex_lock(&m_StreamMutex);
+  for(unsigned int x=0; x<m_vStreams.size(); x++)
+    delete m_vStreams[x];
+  m_vStreams.clear();
+  pthread_mutex_unlock(&m_StreamMutex);
+}
+
+void DAQRecorder_binary::ChunkComplete(int module, long long chunk,
+				       long long start, long long end,
+				       bool bComplete)
+{
+  if(m_iChunksFd < 0)
+    return;
+  char line[96];
+  int len = snprintf(line, sizeof(line), "%d %lld %lld %lld %d\n", module,
+		     chunk, start, end, bComplete ? 1 : 0);
+  // One write per line, so readers never see half of one
+  pthread_mutex_lock(&m_StreamMutex);
+  if(write(m_iChunksFd, line, len) != len)
+    LogError("DAQRecorder_binary - Can't write the chunk list");
+  pthread_mutex_unlock(&m_StreamMutex);
+}
@@ -19,6 +19,8 @@
 #include <koHelper.hh>
 #include <pthread.h>
 #include <iomanip>
+#include <atomic>
+#include "BinaryFile.hh"
 
 using namespace std;
 
@@ -41,6 +43,17 @@ class DAQRecorder
    virtual int   Initialize(koOptions *options) = 0;
    virtual int   RegisterProcessor()            = 0;
    virtual void  Shutdown()                     = 0;
+   //
+   // Name     : void DAQRecorder::ChunkComplete(int module, long long chunk,
+   //                                            long long start, long long end,
+   //                                            bool bComplete)
+   // Purpose  : All data of this module with times in [start, end) has
+   //            been handed to the recorder (see ChunkTracker), or was
+   //            lost in a failed batch if !bComplete. Recorders that can
+   //            tell downstream publish a marker for it. Thread safe.
+   //
+   virtual void  ChunkComplete(int module, long long chunk, long long start,
+			       long long end, bool bComplete){};
       
    // Name     : bool DAQRecorder::QueryError(string err)
    // Purpose  : Returns true if an error was logged in recording with the 
@@ -75,12 +88,35 @@ class DAQRecorder
 #ifdef HAVE_LIBMONGOCLIENT
 
 #include "mongo/client/dbclient.h"
+#include "MongoWriter.hh"
+#include "SpillFile.hh"
+#include "StatusWriter.hh"
+
+/*! \brief One buffer database of the connection pool.
+ */
+struct mongo_host_t{
+  string       address;
+  vector<int>  writers;    // Index in m_vWriters, one connection each
+  bool         bFailed;    // Lost, its traffic goes to the others
+};
 
 /*! \brief Derived class for recording to a mongodb database
    
       Derived class of DAQRecorder designed to insert data into a mongodb
       database. Takes in user options to determine the database parameters
       from the .ini file.
+
+      Inserts go through a pool of connections to one or more buffer
+      hosts: the address option plus every host that modules are mapped
+      to in the hosts option (e.g. "hosts": {"830": "mongodb://buffer1/"}).
+      Each host gets connections_per_host connections with a MongoWriter
+      each, so inserts to different hosts run in parallel.
+
+      With time_chunk_ms documents carry the number of their time chunk
+      and a StatusWriter adds a marker to <collection>_chunks once a chunk
+      is complete and written. With progress_interval_ms it also keeps one
+      document per module in <collection>_progress with the time up to
+      which all of the module's data is written.
    */
 class DAQRecorder_mongodb : public DAQRecorder
 {
@@ -102,11 +138,23 @@ class DAQRecorder_mongodb : public DAQRecorder
    // Name      : int DAQRecorder_mongodb::RegisterProcessor()
    // Purpose   : A data processor registers with the recorder using this
    //             function and received an ID value. This ID should be 
-   //             used when recording data. Internally, a scoped connection
-   //             to the mongo db is created just for this processor.
+   //             used when recording data. Internally the connection pool
+   //             grows by one connection and MongoWriter thread per host
+   //             until it has connections_per_host (or one per processor
+   //             if that is 0).
    // 
    int            RegisterProcessor();
    //
+   // Name      : int DAQRecorder_mongodb::GetRoute(int module)
+   // Purpose   : Host that the documents of this module go to. Modules
+   //             named in the hosts option have their own, all others
+   //             go to host 0, the address option.
+   //
+   int            GetRoute(int module);
+   int            GetHosts(){
+     return m_vHosts.size();
+   };
+   //
    // Name      : int DAQRecorder_mongodb::Shutdown()
    // Purpose   : When the DAQ is done with the mongo connection is can be
    //             terminated using this function
@@ -114,13 +162,127 @@ class DAQRecorder_mongodb : public DAQRecorder
    void           Shutdown();
    //
    // Name      : int DAQRecorder_mongodb::InsertThreaded
-   //                   (vector <mongo::BSONObj> *insvec, int ID)
-   // Purpose   : Used to insert a vector of BSON documents into the mongodb
-   //             using a thread-safe method from mongo
+   //                   (const vector <mongo::BSONObj> &insvec,
+   //                    mongo::DBClientBase *conn, const string &ns)
+   // Purpose   : Used to insert a vector of BSON documents into the 
+   //             collection ns on connection conn. Blocks for the round
+   //             trip, so it is called by the MongoWriter threads. Returns
+   //             -1 if the connection is lost and -2 if the server turned
+   //             the insert down.
    // 
-  int            InsertThreaded(vector <mongo::BSONObj> *insvec, int ID,
-				int resetCount=-1);
-  int            UpdateProgressDoc(int module, int resetCount, int ID);
+  int            InsertThreaded(const vector <mongo::BSONObj> &insvec,
+				mongo::DBClientBase *conn, const string &ns);
+   //
+   // Name      : int DAQRecorder_mongodb::InsertAsync
+   //                   (BSONBatch *batch, int ID, int resetCount, int host)
+   // Purpose   : Queue the documents in batch with one of the host's 
+   //             writers, picked by processor ID. If the host is lost the
+   //             next working one takes it. Returns at once unless the
+   //             queue is full. Ownership of batch is passed.
+   //
+  int            InsertAsync(BSONBatch *batch, int ID, int resetCount=-1,
+			     int host=0);
+   //
+   // Name      : int DAQRecorder_mongodb::HandOff(BSONBatch *batch, int ID,
+   //                                            int resetCount, int host)
+   // Purpose   : InsertAsync for a writer whose host was lost. Never
+   //             waits: returns 1 and keeps the batch with the caller if
+   //             no writer has room and it can't be spilled.
+   //
+  int            HandOff(BSONBatch *batch, int ID, int resetCount, int host,
+			 int attempts=0);
+   //
+   // Name      : int DAQRecorder_mongodb::InsertFailed(BSONBatch *batch,
+   //                      int resetCount, int host, int attempts)
+   // Purpose   : An insert the server turned down for the attempts-th 
+   //             time. It is spilled and replayed later, unless there is
+   //             no spill file or it failed MONGO_INSERT_ATTEMPTS times.
+   //             The batch stays with the caller. Returns 0 if spilled.
+   //
+  int            InsertFailed(BSONBatch *batch, int resetCount, int host,
+			      int attempts);
+   //
+   // Name      : BSONBatch* DAQRecorder_mongodb::GetBatch(int ID, int host)
+   // Purpose   : Empty batch for processor ID, recycled by a writer
+   //
+  BSONBatch*     GetBatch(int ID, int host=0);
+   //
+   // Name      : void DAQRecorder_mongodb::SetHostFailed(int host)
+   // Purpose   : Called by a writer that lost its connection. Inserts
+   //             for this host go to the other hosts from now on.
+   //
+  void           SetHostFailed(int host);
+  bool           HostFailed(int host);
+   //
+   // Name      : void DAQRecorder_mongodb::ReconnectHosts()
+   // Purpose   : Try to connect the lost hosts again. Called every
+   //             MONGO_RECONNECT_S by a thread of the recorder.
+   //
+  void           ReconnectHosts();
+   //
+   // Name      : bool DAQRecorder_mongodb::CanReplay()
+   // Purpose   : True if some writer has room for spilled inserts
+   //
+  bool           CanReplay();
+   //
+   // Name      : int DAQRecorder_mongodb::ReplayInsert(BSONBatch *batch,
+   //                      int resetCount, int host, int attempts)
+   // Purpose   : InsertAsync for inserts read back from the spill file.
+   //             Waits for room instead of spilling again.
+   //
+  int            ReplayInsert(BSONBatch *batch, int resetCount, int host,
+			      int attempts);
+   //
+   // Name      : string DAQRecorder_mongodb::GetCollectionName(int resetCount)
+   // Purpose   : Full name of the collection for this reset counter
+   //             (-1 without rotating collections). Changes when
+   //             GetCollectionVersion does.
+   //
+  string         GetCollectionName(int resetCount);
+  int            GetCollectionVersion(){
+    return m_iCollectionVersion;
+  };
+   //
+   // Name      : void DAQRecorder_mongodb::GetWriterStats(mongo_writer_stats_t &stats)
+   // Purpose   : Queue depths of all writers added up
+   //
+  void           GetWriterStats(mongo_writer_stats_t &stats);
+   //
+   // Name      : void DAQRecorder_mongodb::GetWriterProgress(vector<u_int64_t> &pushed,
+   //                                                      vector<u_int64_t> &finished)
+   // Purpose   : Inserts each writer has been given and has finished
+   //
+  void           GetWriterProgress(vector<u_int64_t> &pushed,
+				   vector<u_int64_t> &finished);
+   //
+   // Name      : int DAQRecorder_mongodb::UpdateProgressDoc(int module,
+   //                                                     long long time, int ID)
+   // Purpose   : Time of the oldest document of this module in the open
+   //             inserts of processor ID, LLONG_MAX once they have none.
+   //             The progress documents and chunk markers never go past
+   //             the lowest of these. Called when the value changes, i.e.
+   //             about once per insert.
+   //
+  int            UpdateProgressDoc(int module, long long time, int ID);
+  long long      LowestOpenTime(int module);
+   //
+   // Name      : void DAQRecorder_mongodb::ModuleProcessed(int module, long long time)
+   // Purpose   : The processors are done with all batches of the module up
+   //             to this time (see ChunkTracker)
+   //
+  void           ModuleProcessed(int module, long long time);
+   //
+   // Name      : void DAQRecorder_mongodb::ChunkComplete(int module, long long chunk,
+   //                                                   long long start, long long end,
+   //                                                   bool bComplete)
+   // Purpose   : Queue the chunk's marker with the StatusWriter
+   //
+  void           ChunkComplete(int module, long long chunk, long long start,
+			       long long end, bool bComplete);
+  // Bytes waiting in the spill file, or left in it at the end
+  u_int64_t      SpillPending();
+  string         GetHostAddress(int host);
+  mongo::DBClientBase* Connect(const string &address);
    //
    // Name      : int DAQRecorder_mongodb::UpdateCollection
    // Purpose   : Change the mongodb collection without disconnecting
@@ -131,11 +293,40 @@ class DAQRecorder_mongodb : public DAQRecorder
  private:
    //
    void            CloseConnections();
+   MongoWriter*    PickWriter(int ID, int host);
+   int             AddWriter(int host, mongo::DBClientBase *conn);
+   int             Queue(BSONBatch *batch, int ID, int resetCount, int host,
+			 bool bSpill, bool bWait, int attempts);
+   static void*    ReconnectWrapper(void *data);
+   void            ReconnectThread();
 
   string           m_DB_USER, m_DB_PASSWORD;
+  // Copy of the mongo options taken at Initialize/UpdateCollection so
+  // inserts don't go through koOptions
+  mongo_option_t   m_mongoOptions;
+  std::atomic<int> m_iCollectionVersion;
    pthread_mutex_t m_ConnectionMutex;
   //vector <mongo::ScopedDbConnection*> m_vScopedConnections;   
   vector <mongo::DBClientBase*> m_vScopedConnections;
+  vector <MongoWriter*> m_vWriters;
+  // Connection pool. Host 0 is the address option.
+  vector <mongo_host_t> m_vHosts;
+  map <int, int>        m_moduleHosts;
+  int                   m_iProcessors, m_iPoolSize;
+  SpillFile            *m_pSpill;
+  string                m_sSpillPath;
+  u_int64_t             m_iSpillLeft;
+  StatusWriter         *m_pStatus;
+  // Oldest open document time per module and processor
+  map<int, vector<long long> > m_openTimes;
+  pthread_mutex_t       m_ProgressMutex;
+  std::atomic<int>      m_iReplays;
+  // Also with write_concern 0 if inserts can fail over
+  bool                  m_bAcknowledged;
+  pthread_t             m_ReconnectThread;
+  pthread_mutex_t       m_ReconnectLock;
+  pthread_cond_t        m_ReconnectCond;
+  bool                  m_bReconnectRunning, m_bReconnectStop;
   pthread_mutex_t  m_childlock;
   vector<pid_t>    m_children;
 };
@@ -199,4 +390,66 @@ class DAQRecorder_protobuff : public DAQRecorder
 
 #endif
 
+/*! \brief Derived class for recording to kodiaq binary files
+
+      Every processor that registers gets a BinaryFile stream of its own,
+      so the processors never share a file or a lock while writing. The
+      files are named after file_path (plus the run name with
+      dynamic_run_names) and rotate at file_size_mb. Needs no external
+      library, so it is also there in lite builds.
+
+      With time_chunk_ms every closed chunk is added to <name>_chunks.txt
+      as a line "module chunk start end complete", complete being 0 if a
+      batch failed in it. The streams write each batch before it counts
+      as done, so the data is in the files by then.
+   */
+class DAQRecorder_binary : public DAQRecorder
+{
+ public:
+                  DAQRecorder_binary();
+   virtual       ~DAQRecorder_binary();
+   explicit       DAQRecorder_binary(koLogger *koLog);
+
+   // Name      : int DAQRecorder_binary::Initialize(koOptions* options)
+   // Purpose   : Work out the file names. The files are only opened when
+   //             the processors register. Returns 0 on success.
+   //
+   int            Initialize(koOptions *options);
+   //
+   // Name      : int DAQRecorder_binary::RegisterProcessor()
+   // Purpose   : Open a new stream and return its ID, -1 if the file
+   //             can't be created.
+   //
+   int            RegisterProcessor();
+   //
+   // Name      : BinaryFile* DAQRecorder_binary::GetStream(int ID)
+   // Purpose   : The stream of a registered processor. It is only used by
+   //             that processor's thread.
+   //
+   BinaryFile*    GetStream(int ID);
+   //
+   // Name      : void DAQRecorder_binary::ChunkComplete(int module, long long chunk,
+   //                                                  long long start, long long end,
+   //                                                  bool bComplete)
+   // Purpose   : Add the chunk to the chunk list
+   //
+   void           ChunkComplete(int module, long long chunk, long long start,
+				long long end, bool bComplete);
+   //
+   // Name      : void DAQRecorder_binary::Shutdown()
+   // Purpose   : Close all streams. The processors must be done.
+   //
+   void           Shutdown();
+
+ private:
+   string               m_SWritePath;
+   u_int64_t            m_iMaxFileBytes;
+   vector<BinaryFile*>  m_vStreams;
+   // Stream numbers go on after a stop so a restart doesn't overwrite
+   // the files of the last one
+   int                  m_iNextStream;
+   int                  m_iChunksFd;
+   pthread_mutex_t      m_StreamMutex;
+};
+
 #endif
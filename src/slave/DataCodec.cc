@@ -0,0 +1,139 @@
+// ****************************************************************
+//
+// kodiaq Data Acquisition Software
+//
+// File     : DataCodec.cc
+// Date     : 16.10.2026
+//
+// Brief    : Compression codecs for pulse payloads
+//
+// *****************************************************************
+
+#include <cstddef>
+#include <snappy.h>
+#include <koSampleCodec.hh>
+#include "DataCodec.hh"
+#ifdef HAVE_LIBLZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#endif
+
+DataCodec::DataCodec()
+{
+}
+
+DataCodec::~DataCodec()
+{
+}
+
+DataCodec* DataCodec::Create(int codec, int level)
+{
+  switch(codec){
+  case CODEC_NONE:
+    return new DataCodec_none();
+  case CODEC_SNAPPY:
+    return new DataCodec_snappy();
+  case CODEC_V1724:
+    return new DataCodec_v1724();
+#ifdef HAVE_LIBLZ4
+  case CODEC_LZ4:
+    return new DataCodec_lz4();
+#endif
+#ifdef HAVE_LIBZSTD
+  case CODEC_ZSTD:
+    return new DataCodec_zstd(level);
+#endif
+  default:
+    return NULL;
+  }
+}
+
+bool DataCodec::Available(int codec)
+{
+  DataCodec *test = Create(codec);
+  if(test == NULL)
+    return false;
+  delete test;
+  return true;
+}
+
+char* DataCodec::Scratch(size_t size)
+{
+  if(m_scratch.size() < size)
+    m_scratch.resize(size);
+  return &m_scratch[0];
+}
+
+int DataCodec_none::Compress(const char *in, u_int32_t size, 
+			     char **out, u_int32_t *outSize)
+{
+  *out = (char*)in;
+  *outSize = size;
+  return 0;
+}
+
+int DataCodec_snappy::Compress(const char *in, u_int32_t size, 
+			       char **out, u_int32_t *outSize)
+{
+  char *buff = Scratch(snappy::MaxCompressedLength(size));
+  size_t compressedSize = 0;
+  snappy::RawCompress(in, size, buff, &compressedSize);
+  *out = buff;
+  *outSize = compressedSize;
+  return 0;
+}
+
+int DataCodec_v1724::Compress(const char *in, u_int32_t size, 
+			      char **out, u_int32_t *outSize)
+{
+  char *buff = Scratch(koSampleCodec::MaxEncodedLength(size));
+  *outSize = koSampleCodec::Encode(in, size, buff);
+  *out = buff;
+  return 0;
+}
+
+#ifdef HAVE_LIBLZ4
+int DataCodec_lz4::Compress(const char *in, u_int32_t size, 
+			    char **out, u_int32_t *outSize)
+{
+  int bound = LZ4_compressBound(size);
+  char *buff = Scratch(bound);
+  int compressedSize = LZ4_compress_default(in, buff, size, bound);
+  if(compressedSize <= 0)
+    return -1;
+  *out = buff;
+  *outSize = compressedSize;
+  return 0;
+}
+#endif
+
+#ifdef HAVE_LIBZSTD
+DataCodec_zstd::DataCodec_zstd(int level)
+{
+  m_context = ZSTD_createCCtx();
+  m_level = level;
+}
+
+DataCodec_zstd::~DataCodec_zstd()
+{
+  ZSTD_freeCCtx((ZSTD_CCtx*)m_context);
+}
+
+int DataCodec_zstd::Compress(const char *in, u_int32_t size, 
+			     char **out, u_int32_t *outSize)
+{
+  if(m_context == NULL)
+    return -1;
+  size_t bound = ZSTD_compressBound(size);
+  char *buff = Scratch(bound);
+  size_t compressedSize = ZSTD_compressCCtx((ZSTD_CCtx*)m_context, buff, bound,
+					    in, size, m_level);
+  if(ZSTD_isError(compressedSize))
+    return -1;
+  *out = buff;
+  *outSize = compressedSize;
+  return 0;
+}
+#endif
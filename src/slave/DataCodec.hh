@@ -0,0 +1,125 @@
+#ifndef _DATACODEC_HH_
+#define _DATACODEC_HH_
+
+// ****************************************************************
+//
+// kodiaq Data Acquisition Software
+//
+// File     : DataCodec.hh
+// Date     : 16.10.2026
+//
+// Brief    : Compression codecs for pulse payloads
+//
+// *****************************************************************
+
+#include <config.h>
+#include <sys/types.h>
+#include <string>
+#include <vector>
+#include <koOptions.hh>
+
+using namespace std;
+
+/*! \brief Base class for the payload compression codecs.
+
+    Every processing thread owns one codec. The codec compresses into its
+    own scratch buffer, which only grows, so there is no allocation per
+    pulse once the largest pulse has been seen. The result stays valid
+    until the next call to Compress.
+
+    The codec IDs (CODEC_NONE, CODEC_SNAPPY, ...) are defined in
+    koOptions.hh and are written to the output so readers can decode.
+ */
+class DataCodec
+{
+ public:
+  DataCodec();
+  virtual ~DataCodec();
+
+  //
+  // Name     : DataCodec* DataCodec::Create(int codec, int level)
+  // Purpose  : Factory. Returns a new codec for the ID or NULL if the codec
+  //            was not compiled in. level is only used by codecs that
+  //            have one (zstd). 0 means the codec's default.
+  //
+  static DataCodec*  Create(int codec, int level=0);
+  //
+  // Name     : bool DataCodec::Available(int codec)
+  // Purpose  : True if this installation was compiled with the codec
+  //
+  static bool        Available(int codec);
+  //
+  // Name     : int DataCodec::Compress(const char *in, u_int32_t size,
+  //                                    char **out, u_int32_t *outSize)
+  // Purpose  : Compress size bytes. out points to the result afterwards,
+  //            which is either the scratch buffer or in itself. Returns 0
+  //            on success and -1 on failure.
+  //
+  virtual int        Compress(const char *in, u_int32_t size,
+			      char **out, u_int32_t *outSize)=0;
+  virtual int        GetID()=0;
+
+ protected:
+  char*              Scratch(size_t size);
+
+ private:
+  vector<char>       m_scratch;
+};
+
+/*! \brief Passes the data through untouched.
+ */
+class DataCodec_none : public DataCodec
+{
+ public:
+  int  Compress(const char *in, u_int32_t size, char **out, u_int32_t *outSize);
+  int  GetID(){ return CODEC_NONE; };
+};
+
+/*! \brief Google snappy. Fast with a moderate ratio.
+ */
+class DataCodec_snappy : public DataCodec
+{
+ public:
+  int  Compress(const char *in, u_int32_t size, char **out, u_int32_t *outSize);
+  int  GetID(){ return CODEC_SNAPPY; };
+};
+
+/*! \brief Delta and bit packing of the 16-bit samples (koSampleCodec).
+    Made for V1724 waveforms, which generic codecs hardly compress.
+ */
+class DataCodec_v1724 : public DataCodec
+{
+ public:
+  int  Compress(const char *in, u_int32_t size, char **out, u_int32_t *outSize);
+  int  GetID(){ return CODEC_V1724; };
+};
+
+#ifdef HAVE_LIBLZ4
+/*! \brief LZ4 block format. Faster than snappy, similar ratio.
+ */
+class DataCodec_lz4 : public DataCodec
+{
+ public:
+  int  Compress(const char *in, u_int32_t size, char **out, u_int32_t *outSize);
+  int  GetID(){ return CODEC_LZ4; };
+};
+#endif
+
+#ifdef HAVE_LIBZSTD
+/*! \brief Zstandard frames. Better ratio for more CPU depending on level.
+ */
+class DataCodec_zstd : public DataCodec
+{
+ public:
+  DataCodec_zstd(int level);
+  virtual ~DataCodec_zstd();
+  int  Compress(const char *in, u_int32_t size, char **out, u_int32_t *outSize);
+  int  GetID(){ return CODEC_ZSTD; };
+
+ private:
+  void *m_context;      // ZSTD_CCtx, reused for every pulse
+  int   m_level;
+};
+#endif
+
+#endif
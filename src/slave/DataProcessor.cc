@@ -12,10 +12,12 @@
 // 
 // *************************************************************
 #include <fstream>
+#include <climits>
 
 #include "DataProcessor.hh"
 #include "DigiInterface.hh"
-#include <snappy.h>
+#include <koScanner.hh>
+#include <koPulse.hh>
 
 DataProcessor::DataProcessor()
 {
@@ -28,10 +30,13 @@ DataProcessor::DataProcessor()
    m_bErrorSet     = false;   
    m_id            = -1;
    bProfiling      = false;
+   InitializeMembers();
 }
 
 DataProcessor::~DataProcessor()
 {
+  for(unsigned int x=0; x<m_vCodecs.size(); x++)
+    delete m_vCodecs[x];
 }
 
 void* DataProcessor::WProcess(void* data)
@@ -50,6 +55,99 @@ DataProcessor::DataProcessor(DigiInterface *digi, DAQRecorder *recorder,
   m_bErrorSet       = false;
   m_id              = id;
   bProfiling        = profiling;
+  InitializeMembers();
+
+  // Everything the processing loop needs from the options is read here,
+  // once, so nothing is looked up per BLT or per pulse.
+  if(m_koOptions == NULL)
+    return;
+  const run_config_t &config = m_koOptions->GetRunConfig();
+  m_iProcessingMode = config.processing_mode;
+  m_iWriteMode      = config.write_mode;
+  m_bCompress       = (config.codec != CODEC_NONE);
+  // occurrence_integral is both the old switch for the integral and the
+  // number of baseline samples for all pulse features
+  m_iFeatures       = config.occurrence_features;
+  if(config.occurrence_integral > 0){
+    m_iFeatures    |= KOPULSE_INTEGRAL;
+    m_iBaselineBins = config.occurrence_integral;
+  }
+  m_iWidthThreshold = config.occurrence_width_threshold;
+  m_bDebugOutput    = (config.debug_output == 1);
+  m_bLiteMode       = (config.lite_mode != 0);
+  m_bRotatingCollections = (config.rotating_collections == 1);
+  // block_compression alone bundles whole boards with a binary index
+  m_iBundleMode     = BUNDLE_NONE;
+  if(m_iWriteMode == WRITEMODE_MONGODB){
+    m_iBundleMode   = config.bundle_documents;
+    if(m_iBundleMode == BUNDLE_NONE && config.block_compression == 1)
+      m_iBundleMode = BUNDLE_BOARD;
+  }
+  m_bBinaryIndex    = (m_iBundleMode != BUNDLE_NONE && 
+		       config.block_compression == 1);
+  // Binary output compresses each chunk as one block instead
+  m_bBlockChunks    = (m_iWriteMode == WRITEMODE_BINARY && m_bCompress &&
+		       config.block_compression == 1);
+  // The pulses array always lists the integral
+  if(m_iBundleMode != BUNDLE_NONE && !m_bBinaryIndex)
+    m_iFeatures    |= KOPULSE_INTEGRAL;
+#ifdef HAVE_LIBMONGOCLIENT
+  m_iMaxInsertDocs = config.mongo.max_insert_docs;
+  m_iInsertBytes    = config.mongo.insert_bytes;
+  m_iBundleBytes    = BundleByteLimit(config.mongo.insert_bytes);
+  m_iInsertDeadline = (u_int64_t)config.mongo.insert_deadline_ms * 1000;
+  m_vBlocks.resize(m_iBundleMode == BUNDLE_CHANNEL ? 8 : 1);
+#endif
+  if(m_DigiInterface != NULL && m_DigiInterface->GetChunkTracker()->Enabled())
+    m_pChunks       = m_DigiInterface->GetChunkTracker();
+  if(m_DigiInterface != NULL){
+    CompressionController *ladder = m_DigiInterface->GetCompression();
+    for(int x=0; x<ladder->GetRungs(); x++){
+      DataCodec *codec = DataCodec::Create(ladder->GetCodec(x), ladder->GetLevel(x));
+      if(codec == NULL){
+	m_sErrorText = "Codec " + CompressionController::CodecName(ladder->GetCodec(x))
+	  + " is not available in this installation";
+	for(unsigned int y=0; y<m_vCodecs.size(); y++)
+	  delete m_vCodecs[y];
+	m_vCodecs.clear();
+	return;
+      }
+      m_vCodecs.push_back(codec);
+    }
+  }
+  else
+    m_vCodecs.push_back(DataCodec::Create(CODEC_NONE));
+  m_fProcessBatch   = SelectProcessBatch(m_iProcessingMode, m_bCompress);
+}
+
+void DataProcessor::InitializeMembers()
+{
+  m_iProcessingMode = 0;
+  m_iWriteMode      = WRITEMODE_NONE;
+  m_iFeatures       = 0;
+  m_iBaselineBins   = 8;
+  m_iWidthThreshold = 0;
+  m_bCompress = m_bDebugOutput = m_bLiteMode = m_bRotatingCollections = false;
+  m_bBinaryIndex    = false;
+  m_bBlockChunks    = false;
+  m_iBundleMode     = BUNDLE_NONE;
+  m_fProcessBatch   = NULL;
+  m_pChunks         = NULL;
+  m_iMongoID        = -1;
+  m_DAQRecorder_bin = NULL;
+  m_pBinaryFile     = NULL;
+#ifdef HAVE_LIBMONGOCLIENT
+  m_DAQRecorder_mdb = NULL;
+  m_pInsert = NULL;
+  m_iMaxInsertDocs = 0;
+  m_iInsertBytes = 0;
+  m_iBundleBytes = BUNDLE_MAX_BYTES;
+  m_iInsertDeadline = 0;
+  m_openTimes.clear();
+#endif
+#ifdef HAVE_LIBPBF
+  m_DAQRecorder_pb  = NULL;
+#endif
 }
 
 void DataProcessor::LogError(string err)
@@ -68,93 +166,73 @@ bool DataProcessor::QueryError(string &err)
   return true;
 }
 
-u_int32_t DataProcessor::GetTimeStamp(u_int32_t *buffer)
+u_int32_t DataProcessor::GetTimeStamp(u_int32_t *buffer, u_int32_t nWords)
 //Pull a time stamp out of a CAEN header
 {
-  int pnt = 0;
-  while((buffer[pnt])==0xFFFFFFFF) //filler between events
-    pnt++;
-  if((buffer[pnt]>>20)==0xA00)   { //look for a header
-    pnt+=3;
-    return (buffer[pnt] & 0x7FFFFFFF);
-  }   
-  return 0;   
+  u_int32_t time = koHelper::GetTimeStamp(buffer, nWords);
+  if(time == 0xFFFFFFFF)
+    return 0;
+  return time;
 }
 
-void DataProcessor::SplitBlocks(vector<u_int32_t*> *&buffvec, 
-				  vector<u_int32_t>  *&sizevec)
-// Break BLTs into individual triggers by locating headers and parsing
-// The buffvec and sizevec returned by reference must be cleared by the
-// calling function when they are no longer needed!
+void DataProcessor::SplitBlocks(vector<u_int32_t*> *buffvec, 
+				vector<u_int32_t>  *sizevec,
+				vector<pulse_view_t> &views)
+// Break BLTs into individual triggers by locating headers and parsing.
+// Each trigger is described by a view into its BLT. Nothing is copied.
 {
-   
-   //Will delete the buffers passed to the function and return these ones
-   vector <u_int32_t*> *retbuff = new vector <u_int32_t*>();
-   vector <u_int32_t > *retsize = new vector <u_int32_t >();
-   
    for(unsigned int x=0; x<buffvec->size();x++)  {	
       if((*sizevec)[x]==0)   {	  //sanity check
-	 delete[] (*buffvec)[x];
 	 continue;
       }
       
-      unsigned int idx = 0;
-      while(idx<((*sizevec)[x]/sizeof(u_int32_t)) && 
-	    (*buffvec)[x][idx]!=0xFFFFFFFF)   {
-	if(((*buffvec)[x][idx]>>20) == 0xA00) { //found a header	    
-	  u_int32_t size = (*buffvec)[x][idx]&0xFFFF*4;
-	  u_int32_t *rb = new u_int32_t[size]; //return buffer created
-	  //copy trigger to new buffer
-	  copy((*buffvec)[x]+idx,(*buffvec)[x]+(idx+size),rb); 
-	  retbuff->push_back(rb);
-	  retsize->push_back(size*sizeof(u_int32_t));
-	  idx+=size;
-	}
-	else
-	  idx++;
+      // Jump from header to header. Filler ends the BLT.
+      unsigned int nWords = (*sizevec)[x]/sizeof(u_int32_t);
+      unsigned int idx = koScanner::FindHeader((*buffvec)[x], 0, nWords, true);
+      while(idx<nWords && (*buffvec)[x][idx]!=0xFFFFFFFF)   {
+	//found a header
+	u_int32_t size = (*buffvec)[x][idx]&0xFFFF*4;
+	pulse_view_t view;
+	view.blt     = x;
+	view.offset  = idx;
+	view.size    = size*sizeof(u_int32_t);
+	view.channel = 0;
+	view.time    = (*buffvec)[x][idx+3]&0x7FFFFFFF;
+	views.push_back(view);
+	idx+=(size>0 ? size : 1);
+	idx = koScanner::FindHeader((*buffvec)[x], idx, nWords, true);
       }//end while
-      delete[] (*buffvec)[x];
    }
-   delete buffvec;
-   delete sizevec; 
-   buffvec=retbuff;
-   sizevec=retsize;
    return;
 }
 
-void DataProcessor::SplitChannels(vector<u_int32_t*> *&buffvec, vector<u_int32_t> *&sizevec,
-				      vector<u_int32_t> *timeStamps, vector<u_int32_t> *channels,
+void DataProcessor::SplitChannels(vector<u_int32_t*> *buffvec, vector<u_int32_t> *sizevec,
+				  vector<pulse_view_t> &views,
 				  vector<u_int32_t> *eventIndices, bool ZLE)
 {
-   
-  vector <u_int32_t*> *retbuff = new vector <u_int32_t*>();
-  vector <u_int32_t>  *retsize = new vector <u_int32_t>();
   
-  //timestamps, channels should be provided as pointers to empty vectors
   //Only works with ZLE on! Calling function should be aware of this.
   
   //buffvec is the buffers to be parsed (one blt per element)
   //sizevec is the size of each buffer in buffvec (in bytes)
-  //retbuff will be the returned buffers with headers stripped
-  //retsize will be the returned sizes in words
-  //timeStamps will be the timestamps of the returned buffers
-  //channels will be the channels of the returned buffers
-  //eventIndices will be a list of indices where new BLTs start
+  //views will describe the channel data with headers stripped
+  //eventIndices will be a list of indices into views where new events start
    
   for(unsigned int x=0; x<buffvec->size();x++)  {	
     //loop through main vector containing the raw data
     if((*sizevec)[x]==0)      { //sanity check
-      delete[] (*buffvec)[x];
       continue;   
     }
     
     unsigned int idx=0;           //used to iterate through the buffer
+    unsigned int nWords = (*sizevec)[x]/sizeof(u_int32_t);
     u_int32_t headerTime=0;
     u_int32_t channelSize=0;
-    while(idx<(((*sizevec)[x])/(sizeof(u_int32_t)))) {	   
+    while(idx<nWords) {	   
 
-      if(((*buffvec)[x][idx])==0xFFFFFFFF){idx++; continue;}// empty data, iterate
-      if(((*buffvec)[x][idx]>>20)!=0xA00){idx++; continue;} // stop if you found a header
+      // skip filler and anything else up to the next header
+      idx = koScanner::FindHeader((*buffvec)[x], idx, nWords);
+      if(idx>=nWords) break;
 
       // Read header
       // Proper computation of channel size needs channel mask
@@ -172,7 +250,7 @@ void DataProcessor::SplitChannels(vector<u_int32_t*> *&buffvec, vector<u_int32_t
       }
 
       if(eventIndices!=NULL)
-	eventIndices->push_back(retbuff->size());
+	eventIndices->push_back(views.size());
       headerTime = ((*buffvec)[x][idx+3])&0x7FFFFFFF;
       idx+=4;    
       //skip past header, we have what we need
@@ -203,70 +281,52 @@ void DataProcessor::SplitChannels(vector<u_int32_t*> *&buffvec, vector<u_int32_t
 	    wordCnt++;
 	  }
 	  else  GoodWords=channelSize;
-	  //char *keep = new char[GoodWords*4];
-	  u_int32_t *keep = new u_int32_t[GoodWords];
-	  //	       memcpy(keep,((*buffvec)[x]+idx),4*GoodWords);
-	  copy((*buffvec)[x]+idx,(*buffvec)[x]+(idx+GoodWords),keep);
+
+	  pulse_view_t view;
+	  view.blt     = x;
+	  view.offset  = idx;
+	  view.size    = GoodWords*4;
+	  view.channel = channel;
+	  view.time    = headerTime+sampleCnt;
+	  views.push_back(view);
 	  
 	  idx+=GoodWords;
 	  wordCnt+=GoodWords;
-	  retbuff->push_back(keep);
-	  retsize->push_back(GoodWords*4);
-	  channels->push_back(channel);
-	  timeStamps->push_back(headerTime+sampleCnt);
 	  sampleCnt+=2*GoodWords;
 	}//end while through this channel data          
       }//end for through channels                             
     }//end while through this trigger
-    delete[] (*buffvec)[x];
   }
-  
-  delete buffvec;
-  delete sizevec;
-  buffvec=retbuff;
-  sizevec=retsize;
   return;
 }
 
-void DataProcessor::SplitChannelsNewFW(vector<u_int32_t*> *&buffvec, 
-				       vector<u_int32_t> *&sizevec, 
-				       vector<u_int32_t> *timeStamps, 
-				       vector<u_int32_t> *channels, 
+void DataProcessor::SplitChannelsNewFW(vector<u_int32_t*> *buffvec, 
+				       vector<u_int32_t> *sizevec, 
+				       vector<pulse_view_t> &views,
 				       bool &bErrorSet, 
 				       string &sErrorText )
 {
   bErrorSet = false;
   sErrorText = "";
-  vector <u_int32_t*> *retbuff = new vector <u_int32_t*>();
-  vector <u_int32_t>  *retsize = new vector <u_int32_t>();
-  
-  //timestamps, channels should be provided as pointers to empty vectors
   
   //buffvec is the buffers to be parsed (one blt per element)
   //sizevec is the size of each buffer in buffvec (in bytes)
-  //retbuff will be the returned buffers with headers stripped
-  //retsize will be the returned sizes in words
-  //timeStamps will be the timestamps of the returned buffers
-  //channels will be the channels of the returned buffers
+  //views will describe the channel data with headers stripped
 
   for(unsigned int x=0; x<buffvec->size();x++)  {	
     //loop through main vector containing the raw data
     if((*sizevec)[x]==0)      {
       //sanity check
-      delete[] (*buffvec)[x];
       continue;
     }	
        
     unsigned int idx=0;           //used to iterate through the buffer
+    unsigned int nWords = (*sizevec)[x]/sizeof(u_int32_t);
     unsigned int nBuffs = 0;
-    while(idx<(((*sizevec)[x])/(sizeof(u_int32_t)))) {	    
-      if(((*buffvec)[x][idx])==0xFFFFFFFF){
-	idx++; continue;
-      }
-      //empty data, iterate
-      if(((*buffvec)[x][idx]>>20)!=0xA00)   {
-	idx++; continue;
-      }
+    while(idx<nWords) {	    
+      // skip filler and anything else up to the next header
+      idx = koScanner::FindHeader((*buffvec)[x], idx, nWords);
+      if(idx>=nWords) break;
       //found a header
       nBuffs++;
       //Read information from header. Need channel mask and header time
@@ -286,45 +346,17 @@ void DataProcessor::SplitChannelsNewFW(vector<u_int32_t*> *&buffvec,
 	u_int32_t channelSize = ((*buffvec)[x][idx]);
 	idx++; //iterate past the size word
 	u_int32_t channelTime = ((*buffvec)[x][idx])&0x7FFFFFFF;
-	//u_int32_t channelTime = ((*buffvec)[x][idx])&0x3FFFFFFF;
 	idx++;
-	//char *keep = new char[(channelSize-2)*4];	     
-
 
-	// SANITY CHECK FOR DAQ TEST
-	/*
-	if ( channelSize > 100000 || channelSize<=2 ){	 
-	  stringstream errorlog;
-          errorlog<<"Error parsing data with newfw algorithm (1). Index: "<<idx
-                  <<" channelSize: "<<channelSize<<" channel: "<<channel
-                  <<" channelTime: "<<channelTime<<" index attempted: "<<idx
-                  <<"-"<<idx+channelSize-2<<" from max "<<(*sizevec)[x]
-                  <<" Dump: ";
-
-          for( unsigned int dex = 0; dex<idx; dex++)
-            errorlog<<hex<<(*buffvec)[x][dex]<<endl;
-
-          // ERROR DUMP                   
-	  cout<<"Messed up event written to log."<<endl;
-          ofstream outfile;
-          outfile.open("stupiderror.txt");
-          outfile<<errorlog.str();
-          outfile.close();
-	  continue;
-	}
-	*/
-	// REMOVE ABOVE AFTER TEST
-
-
-	
-	u_int32_t *keep = new u_int32_t[channelSize-2];
-	//	copy((*buffvec)[x]+idx,(*buffvec)[x]+(idx+channelSize-2),keep); //copy channel data
-	if( idx + channelSize-2 < (*sizevec)[x] ){
-	  copy(&((*buffvec)[x][idx]),&((*buffvec)[x][idx+channelSize-2]),keep);
-	  retbuff->push_back(keep);
-	  retsize->push_back((channelSize-2)*4);
-	  channels->push_back(channel);
-	  timeStamps->push_back(channelTime);
+	// The view must stay inside the BLT. Sizes are in words.
+	if( channelSize >= 2 && idx + channelSize-2 <= nWords ){
+	  pulse_view_t view;
+	  view.blt     = x;
+	  view.offset  = idx;
+	  view.size    = (channelSize-2)*4;
+	  view.channel = channel;
+	  view.time    = channelTime;
+	  views.push_back(view);
 	}
 	else {	 
 	  /* FOR DAQ TEST */
@@ -332,7 +364,7 @@ void DataProcessor::SplitChannelsNewFW(vector<u_int32_t*> *&buffvec,
 	  errorlog<<"Error parsing data with newfw algorithm (2). Index: "<<idx
 		  <<" channelSize: "<<channelSize<<" channel: "<<channel
 		  <<" channelTime: "<<channelTime<<" index attempted: "<<idx
-		  <<"-"<<idx+channelSize-2<<" from max "<<(*sizevec)[x]
+		  <<"-"<<idx+channelSize-2<<" from max "<<nWords
 		  <<" Dump: ";
 
 	  for( unsigned int dex = 0; dex<idx; dex++)
@@ -343,7 +375,6 @@ void DataProcessor::SplitChannelsNewFW(vector<u_int32_t*> *&buffvec,
           outfile.open("stupiderror.txt");
           outfile<<errorlog.str();
           outfile.close();
-	  delete keep;
 	  
 	  //	  sErrorText = errorlog.str();
 	  //bErrorSet = true;
@@ -355,12 +386,7 @@ void DataProcessor::SplitChannelsNewFW(vector<u_int32_t*> *&buffvec,
       }
     }//end while       
     //cout<<"Found "<<nBuffs<<" headers in this BLT"<<endl;
-    delete(*buffvec)[x];
   }//end for through buffvec
-  delete buffvec;
-  delete sizevec;
-  buffvec=retbuff;
-  sizevec=retsize;
   return;   
 }
 
@@ -374,60 +400,86 @@ void DataProcessor::Process()
   
   // If no boards are active set this to true to exit
   bool bExitCondition = false; 
-  int mongoID = -1;
   cout<<"OPEN PROC THREAD"<<endl;
   // Check if objects have been initialized properly
   if(m_DigiInterface == NULL || m_koOptions == NULL) 
     return;
-  if(m_DAQRecorder==NULL && m_koOptions->GetInt("write_mode")!=WRITEMODE_NONE)
+  if(m_DAQRecorder==NULL && m_iWriteMode!=WRITEMODE_NONE)
+    return;
+  if(m_vCodecs.size() == 0){
+    LogError(m_sErrorText);
     return;
+  }
+  if(m_fProcessBatch == NULL){
+    LogError("Unknown processing mode " + 
+	     koHelper::IntToString(m_iProcessingMode));
+    return;
+  }
  
  
 #ifdef HAVE_LIBMONGOCLIENT
   // MongoDB-specific variables
   
-  mongoID = -1;
-  DAQRecorder_mongodb *DAQRecorder_mdb = NULL;
-  vector <mongo::BSONObj> *vMongoInsertVec = new vector<mongo::BSONObj>();
+  m_iMongoID = -1;
+  m_DAQRecorder_mdb = NULL;
+  m_pInsert = NULL;
+  m_vInserts.clear();
   
-  if( m_koOptions->GetInt("write_mode") == WRITEMODE_MONGODB ){
+  if( m_iWriteMode == WRITEMODE_MONGODB ){
 
     // We trust that we are being sent a mongoDB recorder, 
     // so we can safely dynamic cast
-    DAQRecorder_mdb = dynamic_cast <DAQRecorder_mongodb*> ( m_DAQRecorder );
+    m_DAQRecorder_mdb = dynamic_cast <DAQRecorder_mongodb*> ( m_DAQRecorder );
     
-    if((mongoID = m_DAQRecorder->RegisterProcessor())==-1) {
+    if((m_iMongoID = m_DAQRecorder->RegisterProcessor())==-1) {
       LogError("Failed to initialize mongodb. Check connection settings!");
       return;
     }
+    // Boards are routed to buffer hosts by the recorder
+    m_vInserts.resize(m_DAQRecorder_mdb->GetHosts());
+    for(unsigned int x=0; x<m_vInserts.size(); x++){
+      m_vInserts[x].batch = m_DAQRecorder_mdb->GetBatch(m_iMongoID, x);
+      m_vInserts[x].host = x;
+      m_vInserts[x].resetCount = 0;
+      m_vInserts[x].start = 0;
+      m_vInserts[x].lowTimes.clear();
+    }
+    m_openTimes.clear();
+    m_pInsert = &m_vInserts[0];
   }
-  mongo_option_t mongo_opts = m_koOptions->GetMongoOptions();
 
 #endif
 
 #ifdef HAVE_LIBPBF
   // Protocol Buffer File output
   
-  DAQRecorder_protobuff *DAQRecorder_pb = NULL;
-  if(m_koOptions->GetInt("write_mode") == WRITEMODE_FILE){
-    DAQRecorder_pb = dynamic_cast<DAQRecorder_protobuff*>(m_DAQRecorder);
+  m_DAQRecorder_pb = NULL;
+  if(m_iWriteMode == WRITEMODE_FILE){
+    m_DAQRecorder_pb = dynamic_cast<DAQRecorder_protobuff*>(m_DAQRecorder);
   }
   
 #endif
+
+  // Binary file output. Each processor writes a stream of its own.
+  m_DAQRecorder_bin = NULL;
+  m_pBinaryFile = NULL;
+  if(m_iWriteMode == WRITEMODE_BINARY){
+    m_DAQRecorder_bin = dynamic_cast<DAQRecorder_binary*>(m_DAQRecorder);
+    int ID = m_DAQRecorder_bin->RegisterProcessor();
+    if(ID == -1 || (m_pBinaryFile = m_DAQRecorder_bin->GetStream(ID)) == NULL){
+      LogError("Failed to open binary output file. Check file_path!");
+      return;
+    }
+  }
  
   //declare data containers
   vector<u_int32_t*> *buffvec      = NULL;  // Data
-  vector<u_int32_t > *sizevec      = NULL;  // Data sizes (words)
-  vector<u_int32_t > *channels     = NULL;  // Channel number
-  vector<u_int32_t > *times        = NULL;  // Timestamp
-  vector<u_int32_t > *eventIndices = NULL;  // Event
-  int                 iModule      = 0;     // Fill with ID of current module
-  int                 LAST_RESET_COUNT = 0;
+  vector<u_int32_t > *sizevec      = NULL;  // Data sizes (bytes)
 
   time_t lastPrintTime = koLogger::GetCurrentTime();
   
   if(bProfiling && !m_profilefile.is_open())
-    m_profilefile.open("profiling/thread_"+koHelper::IntToString(mongoID)+".txt", std::fstream::app);
+    m_profilefile.open("profiling/thread_"+koHelper::IntToString(m_iMongoID)+".txt", std::fstream::app);
 
   if(bProfiling && m_profilefile.is_open())
     m_profilefile<<"SEARCHING "<<koLogger::GetTimeMus()<<endl;
@@ -439,13 +491,18 @@ void DataProcessor::Process()
     // 
 
     bExitCondition = true;
+    // Read the notifier before looking at the boards so a signal
+    // arriving during the scan makes the wait below return at once
+    ReadoutNotifier *notifier = m_DigiInterface->GetNotifier();
+    u_int64_t generation = notifier->Generation();
+    bool bFoundData = false;
+    bool bWriteError = false;
 
     for(unsigned int x = 0; x < m_DigiInterface->GetDigis(); x++)  {
 
       CBV1724 *digi = m_DigiInterface->GetDigi(x);
       if(digi->Activated()) bExitCondition=false;
       else continue;
-      usleep(10); //avoid 100% cpu
       
       time_t thisTime = koLogger::GetCurrentTime();
       if(fabs(difftime(lastPrintTime, thisTime)) > 1.0){
@@ -454,7 +511,13 @@ void DataProcessor::Process()
 
       // Check if the digitizer has data and is not associated 
       // with another processor
-      if(digi->RequestDataLock()!=0) continue;
+      int iRequest = digi->RequestReadout();
+      if(iRequest!=0){
+        // Busy boards are skipped once and should be picked up next pass
+        if(iRequest==1) bFoundData = true;
+        continue;
+      }
+      bFoundData = true;
 
       if(bProfiling && m_profilefile.is_open())
 	m_profilefile<<"READ  "<<koLogger::GetTimeMus()<<" "
@@ -464,354 +527,618 @@ void DataProcessor::Process()
       // (it's only 31-bit) at the start of the event
       unsigned int resetCounterStart = 0; 
       u_int32_t headerTime = 0;
+      u_int64_t batchSequence = 0;
 
-      // YIELDS LOCK
       buffvec = digi->ReadoutBuffer( sizevec, resetCounterStart, headerTime,
-				     mongoID );
+				     m_iMongoID, &batchSequence );
 
       if(bProfiling && m_profilefile.is_open())
 	m_profilefile<<"PARSING "<<koLogger::GetTimeMus()<<" "<<digi->GetID().id
 		     <<" 0 "<<buffvec->size()<<endl;
 
-      iModule = digi->GetID().id;
-      //digi->UnlockDataBuffer();
-     
+      // Parse and write with the version built for our options
+      int iRet = (this->*m_fProcessBatch)(digi, buffvec, sizevec, 
+					  resetCounterStart, headerTime,
+					  batchSequence);
+      delete buffvec;
+      delete sizevec;
+      buffvec=NULL;
+      sizevec=NULL;
 
-      // Parse the data if requested
-      // The processing functions will modify the vectors sent as arguments
-      if(m_koOptions->GetInt("processing_mode") == 1) { 
-	//simple block parsing. 
-	SplitBlocks(buffvec,sizevec);
+      if(iRet<0){
+	if(bProfiling && m_profilefile.is_open())
+	  m_profilefile.close();
+	return;
       }
-      else if(m_koOptions->GetInt("processing_mode") !=0 ){ 
-	// all other modes separate channels
-	channels = new vector<u_int32_t>();
-	times = new vector<u_int32_t>();
-
-	if(m_koOptions->GetInt("processing_mode") == 2 || 
-	   m_koOptions->GetInt("processing_mode") == 3) { 
-	  //channel parsing old fw
+      if(iRet>0){
+	bWriteError = true;
+	break;
+      }
+      
+      if(bProfiling && m_profilefile.is_open())
+	m_profilefile<<"SEARCHING "<<koLogger::GetTimeMus()<<endl;
 
-	  eventIndices = new vector<u_int32_t>();
+    }//end loop through digis
 
-	  if(m_koOptions->GetInt("processing_mode") == 2)
-	    SplitChannels(buffvec,sizevec,times,channels,eventIndices);	  
-	  else 
-	    SplitChannels(buffvec,sizevec,times,channels,eventIndices,false);
-	}
-	else if(m_koOptions->GetInt("processing_mode") == 4) { 
-	  //channel parsing new fw
-	  bool bErrorSet = false;
-	  string sErrorText = "";
-	  SplitChannelsNewFW(buffvec,sizevec,times,channels, bErrorSet, sErrorText);
-	  if ( bErrorSet )
-	    LogError( sErrorText );
-	  
-	}
-      }
+    // Inserts are cut by size while parsing and by age here, never at
+    // BLT boundaries
+    int waitMs = 100;
+#ifdef HAVE_LIBMONGOCLIENT
+    if(!bWriteError && CheckInsertDeadline(waitMs) != 0)
+      bWriteError = true;
+#endif
 
-      // Processing part is over. 
-      // Now write the data with the DAQRecorder object
-      unsigned int        currentEventIndex = 0;
-      int                 protocHandle = -1;
-      long long           latestTime64 =0;
-      
-      vector<bool>        SawThisChannelOnce( 8, false );
-      vector<u_int32_t>   ChannelResetCounters( 8, resetCounterStart );
-      vector<bool>        Over15Counter( 8, false );
-      vector<u_int32_t>   PrevTime(8, 0);
+    if(bWriteError){
+      bExitCondition = true;
+      break;
+    }
 
-      //Loop through the parsed buffers
-      if(bProfiling && m_profilefile.is_open())
-        m_profilefile<<"DOCS "<<koLogger::GetTimeMus()<<" "<<digi->GetID().id
-                     <<" 0 "<<buffvec->size()<<endl;
-
-      for(unsigned int b = 0; b < buffvec->size(); b++) {
-	u_int32_t TimeStamp = 0;
-	int       Channel    = -1;
-
-	// Get time stamp if required
-	if(m_koOptions->GetInt("processing_mode")==0 || 
-	   m_koOptions->GetInt("processing_mode")==1) {
-	  TimeStamp = GetTimeStamp((*buffvec)[b]);
-	  Channel   = 0;
-	}
-	else {
-	  TimeStamp = (*times)[b];
-	  Channel   = (*channels)[b];
-	}
-	
-	if( Channel < 0 || Channel > 7 ){
-	  cout<<"ERROR in CHANNEL"<<endl;
-	  if(bProfiling && m_profilefile.is_open())
-	    m_profilefile.close();
-	  return;
-	}
-	
-	if( !SawThisChannelOnce[Channel]){
-	  SawThisChannelOnce[Channel] = true;
-	  if( fabs( (int)headerTime - (int)TimeStamp) > 10E8 ){
-	    //times far apart. Probably on other sides of reset counter
-	    if( TimeStamp > headerTime && ChannelResetCounters[Channel]!=0)
-	      ChannelResetCounters[Channel]--;
-	    else
-	      ChannelResetCounters[Channel]++;
-	  }
-	}
-	if( TimeStamp < PrevTime[Channel]){
-	  ChannelResetCounters[Channel]++;
-	  //cout<<"CHANNEL RESET: "<<ChannelResetCounters[Channel]<<endl;
-	}
-	PrevTime[Channel] = TimeStamp;
-	
-	// Convert the time to 64-bit
-	// We assume this data is in temporal order for 
-	// computation using the reset counter	
-	int iBitShift = 31; 
-	long long Time64 = ((unsigned long)ChannelResetCounters[Channel] << 
-			    iBitShift) +TimeStamp;
-	latestTime64 = Time64;
-
-	// Get integral if required (do before zipping)
-	float integral = 0.;
-	int baseline=0;
-	if( (baseline=m_koOptions->GetInt("occurrence_integral"))>0 )
-	  integral = GetBufferIntegral( (*buffvec)[b], (*sizevec)[b], baseline );	
-	
-	//zip data if required
-	char* buff=NULL;
-	u_int32_t eventSize=0;
-	if(m_koOptions->GetInt("compression") == 1){
-	  buff = new char[snappy::MaxCompressedLength((*sizevec)[b])];
-	  snappy::RawCompress((const char*)(*buffvec)[b], 
-			      (*sizevec)[b], buff, (size_t*)&eventSize);
-	  delete[] (*buffvec)[b];
-	}
-	else{
-	  buff = (char*)(*buffvec)[b];
-	  eventSize = (*sizevec)[b];
-	}
+    // Nothing to do. Sleep until a board signals or the open insert is
+    // due. Otherwise the timeout is only a safety net, boards and run
+    // stop wake us through the notifier.
+    if(!bFoundData && !bExitCondition)
+      notifier->Wait(generation, waitMs);
+  }//end while loop
+  if(bProfiling && m_profilefile.is_open())
+    m_profilefile<<"DONE "<<koLogger::GetTimeMus()<<endl;
 
-	//Now fill the actual data depending on write mode	
 #ifdef HAVE_LIBMONGOCLIENT
-	//Loop through the parsed buffers        
+  // Whatever is left goes out before the writers are stopped
+  for(unsigned int x=0; x<m_vInserts.size(); x++){
+    if(m_vInserts[x].batch != NULL && m_vInserts[x].batch->Documents() != 0 &&
+       !m_bErrorSet)
+      SendInsert(m_vInserts[x], -1);
+    if(m_vInserts[x].batch != NULL)
+      delete m_vInserts[x].batch;
+  }
+  m_vInserts.clear();
+  m_pInsert = NULL;
+#endif
+  cout<<"LEAVING PROCESSING THREAD"<<endl;
+  if(bProfiling && m_profilefile.is_open())
+    m_profilefile.close();
+  return;
+}
 
+template<int MODE, bool COMPRESS>
+int DataProcessor::ProcessBatch(CBV1724 *digi, vector<u_int32_t*> *buffvec,
+				vector<u_int32_t> *sizevec, 
+				unsigned int resetCounterStart,
+				u_int32_t headerTime, u_int64_t batchSequence)
+// One instance of this exists per processing mode and compression setting.
+// MODE and COMPRESS are compile time constants so all of the branches on
+// them below disappear.
+{
+  int                 iModule      = digi->GetID().id;
+  vector<u_int32_t > *eventIndices = NULL;  // Event
+  int                 iRet         = 0;
 
-	if(m_koOptions->GetInt("write_mode") == WRITEMODE_MONGODB){
-	  mongo::BSONObjBuilder bson;
+  // The compression controller may have moved this board to another
+  // codec. It's read once so the whole batch uses the same one.
+  unsigned int        rung         = digi->GetCompressionRung();
+  if(rung >= m_vCodecs.size())
+    rung = m_vCodecs.size()-1;
+  DataCodec          *codec        = m_vCodecs[rung];
 
-	  bson.genOID();	 	  
+#ifdef HAVE_LIBMONGOCLIENT
+  if(m_iWriteMode == WRITEMODE_MONGODB)
+    m_pInsert = &m_vInserts[m_DAQRecorder_mdb->GetRoute(iModule)];
+  // Left over if the last batch failed half way
+  for(unsigned int x=0; x<m_vBlocks.size(); x++){
+    m_vBlocks[x].entries.clear();
+    m_vBlocks[x].integrals.clear();
+    m_vBlocks[x].data.clear();
+  }
+#endif
 
-	  bson.append("module",iModule);
-	  bson.append("channel",Channel);
-	  bson.append("time",Time64);
-	  bson.append("endtime", Time64 + (long long)eventSize);
-	  
-	  // Integral is expensive! Just turn on if rate low enough.
-	  if( m_koOptions->HasField("occurrence_integral") &&
-	      m_koOptions->GetInt("occurrence_integral") > 0 )
-	    bson.append("integral", integral);
-
-	  // Debug output mode. Put extra fields in to track clock issues
-	  if( m_koOptions->HasField("debug_output") && m_koOptions->GetInt("debug_output")==1){
-	    bson.append("header_time", headerTime);
-	    bson.append("raw_time", TimeStamp);                                                         
-	    bson.append("header_batch_id", resetCounterStart ); 
-	    
-	    // Channel reset counters at this moment
-	    mongo::BSONArrayBuilder channel_reset_array;
-	    for(unsigned int x=0; x<ChannelResetCounters.size(); x++)
-	      channel_reset_array.append(ChannelResetCounters[x]);
-	    bson.append("channel_batch_ids", channel_reset_array.arr());
-	  }
+  // The raw BLTs are slabs from the digitizer's BLT pool. The parsers
+  // only give views into them, nothing is copied.
+  vector<pulse_view_t> views;
+  views.reserve(buffvec->size());
+
+  // Parse the data if requested
+  if(MODE == 0) {
+    // No parsing. One view per BLT.
+    for(unsigned int x=0; x<buffvec->size(); x++){
+      if((*sizevec)[x]==0) continue;
+      pulse_view_t view;
+      view.blt     = x;
+      view.offset  = 0;
+      view.size    = (*sizevec)[x];
+      view.channel = 0;
+      view.time    = GetTimeStamp((*buffvec)[x], (*sizevec)[x]/sizeof(u_int32_t));
+      views.push_back(view);
+    }
+  }
+  else if(MODE == 1) { 
+    //simple block parsing. 
+    SplitBlocks(buffvec,sizevec,views);
+  }
+  else if(MODE == 2 || MODE == 3) { 
+    //channel parsing old fw. Mode 2 is with ZLE, mode 3 without.
+    eventIndices = new vector<u_int32_t>();
+    SplitChannels(buffvec,sizevec,views,eventIndices,(MODE == 2));
+  }
+  else if(MODE == 4) { 
+    //channel parsing new fw
+    bool bErrorSet = false;
+    string sErrorText = "";
+    SplitChannelsNewFW(buffvec,sizevec,views, bErrorSet, sErrorText);
+    if ( bErrorSet )
+      LogError( sErrorText );
+  }
 
-	  // Lite mode means no data field. If we're not in lite mode add the data field.
-	  if( !m_koOptions->HasField("lite_mode") || m_koOptions->GetInt("lite_mode")==0)
-	    bson.appendBinData("data",(int)eventSize,mongo::BinDataGeneral,
-			       (const void*)buff);
-
-
-	  // If we're using rotating collections and the reset counter has
-	  // just changed, trigger an insert. All docs in the bulk insert
-	  // should have the same reset counter
-	  if(m_koOptions->HasField("rotating_collections") &&
-	     m_koOptions->GetInt("rotating_collections") == 1 &&
-	     ChannelResetCounters[Channel] != LAST_RESET_COUNT){
-	    
-	    if(bProfiling && m_profilefile.is_open())
-	      m_profilefile<<"INSERT "<<koLogger::GetTimeMus()<<" "
-			   <<iModule<<" "<<vMongoInsertVec->size()
-			   <<" "<<mongoID<<endl;			   
-
-	    if(DAQRecorder_mdb->InsertThreaded(vMongoInsertVec,mongoID,
-                                               LAST_RESET_COUNT)==0){
-	      LAST_RESET_COUNT = ChannelResetCounters[Channel];
-	      vMongoInsertVec = new vector<mongo::BSONObj>();
-
-	      if(bProfiling && m_profilefile.is_open())
-		m_profilefile<<"DOCS "<<koLogger::GetTimeMus()<<" "
-			     <<digi->GetID().id
-			     <<" "<<b<<"  "<<buffvec->size()<<endl;
-
-
-	    }
-            else{
-              LogError("MongoDB insert error from processor thread.");
-              bExitCondition=true;
-              vMongoInsertVec = NULL;
-              break;
-            }
-	  }
+  // Every view holds a reference on its BLT until it has been written,
+  // so slabs go back to the pool as soon as their last pulse is done.
+  // BLTs without any pulse go back right away.
+  vector<int> viewsPerBLT(buffvec->size(), 0);
+  for(unsigned int x=0; x<views.size(); x++)
+    viewsPerBLT[views[x].blt]++;
+  for(unsigned int x=0; x<buffvec->size(); x++){
+    if(viewsPerBLT[x]==0)
+      digi->ReturnBuffer((*buffvec)[x]);
+    else if(viewsPerBLT[x]>1)
+      digi->RetainBuffer((*buffvec)[x], viewsPerBLT[x]-1);
+  }
 
+  // Processing part is over. 
+  // Now write the data with the DAQRecorder object
+  unsigned int        currentEventIndex = 0;
+  int                 protocHandle = -1;
+  long long           latestTime64 =0;
+  
+  vector<u_int32_t>   ChannelResetCounters( 8, resetCounterStart );
+
+  // 64-bit times for the whole batch in one pass. The board's clock
+  // keeps the state between batches and threads.
+  vector<u_int32_t>   times( views.size() ), channels( views.size() );
+  vector<long long>   times64( views.size() );
+  for(unsigned int x=0; x<views.size(); x++){
+    times[x]    = views[x].time;
+    channels[x] = views[x].channel;
+  }
+  if(views.size() != 0)
+    digi->GetClock()->Reconstruct(batchSequence, resetCounterStart, headerTime,
+				  &times[0], &channels[0], views.size(), 
+				  &times64[0]);
 
-	  // Put new object into insert vector
-          vMongoInsertVec->push_back(bson.obj());
-	  
-	  bool insert = false;
+  //Loop through the parsed buffers
+  if(bProfiling && m_profilefile.is_open())
+    m_profilefile<<"DOCS "<<koLogger::GetTimeMus()<<" "<<digi->GetID().id
+		 <<" 0 "<<views.size()<<endl;
+
+  unsigned int b = 0;
+  for(b = 0; b < views.size(); b++) {
+    u_int32_t *pulse     = (*buffvec)[views[b].blt] + views[b].offset;
+    u_int32_t  pulseSize = views[b].size;
+    u_int32_t  TimeStamp = views[b].time;
+    int        Channel   = views[b].channel;
+    
+    if( Channel < 0 || Channel > 7 ){
+      cout<<"ERROR in CHANNEL"<<endl;
+      iRet = -1;
+      break;
+    }
+    
+    long long Time64 = times64[b];
+    ChannelResetCounters[Channel] = (u_int32_t)(Time64>>31);
+    latestTime64 = Time64;
+
+    // Pulse features if required (do before zipping). All of them come
+    // out of one pass over the samples.
+    pulse_features_t features;
+    if( m_iFeatures != 0 )
+      koPulse::Analyze( pulse, pulseSize/4, m_iBaselineBins, 
+			m_iWidthThreshold, &features );
+    
+    //zip data if required. The codec compresses into a scratch buffer
+    //that is kept for the whole thread.
+    char* buff=NULL;
+    u_int32_t eventSize=0;
+    int codecUsed = CODEC_NONE;
+    if(COMPRESS && m_iBundleMode == BUNDLE_NONE && !m_bBlockChunks){
+      if(codec->Compress((const char*)pulse, pulseSize, 
+			 &buff, &eventSize) != 0){
+	LogError("Failed to compress pulse with codec " + 
+		 CompressionController::CodecName(codec->GetID()));
+	iRet = 1;
+	break;
+      }
+      codecUsed = codec->GetID();
+      // Noise and very short pulses can come out larger than they went
+      // in. Documents and binary records say what they hold, so store
+      // those as they are.
+      if((m_iWriteMode == WRITEMODE_MONGODB || m_iWriteMode == WRITEMODE_BINARY)
+	 && eventSize >= pulseSize){
+	buff = (char*)pulse;
+	eventSize = pulseSize;
+	codecUsed = CODEC_NONE;
+      }
+    }
+    else{
+      buff = (char*)pulse;
+      eventSize = pulseSize;
+    }
 
-	  // If we exceed the threshold set by the user in options then make an insert
-	  if((int)vMongoInsertVec->size() > mongo_opts.min_insert_size 
-	     || (int)vMongoInsertVec->size() < 0){
-	    insert = true;
-	  }
-	 
-	  // If we're at the last doc from this round of BLTs
-	  // an insert to flush the buffer
-	  //if(bExitCondition && 
-	  if(b == buffvec->size() -1)
-            insert = true;
-	    
-	  if(insert){
-	    if(!(m_koOptions->HasField("rotating_collections")) ||
-	       (m_koOptions->GetInt("rotating_collections") != 1))
-	      LAST_RESET_COUNT=-1;
-
-	    if(bProfiling && m_profilefile.is_open())
-              m_profilefile<<"INSERT "<<koLogger::GetTimeMus()<<" "
-                           <<iModule<<" "<<vMongoInsertVec->size()
-                           <<" "<<mongoID<<endl;
-
-	    if(DAQRecorder_mdb->InsertThreaded(vMongoInsertVec,mongoID, 
-					       LAST_RESET_COUNT)==0){ 
-	      //success
-		LAST_RESET_COUNT = ChannelResetCounters[Channel];
-		vMongoInsertVec = new vector<mongo::BSONObj>();
-		
-		if(b!=buffvec->size()-1 && bProfiling && m_profilefile.is_open())
-		  m_profilefile<<"DOCS "<<koLogger::GetTimeMus()<<" "
-			       <<digi->GetID().id
-			       <<" "<<b<<" "<<buffvec->size()<<endl;
-		
-	      }
-	    else{
-	      LogError("MongoDB insert error from processor thread.");
-	      bExitCondition=true;
-	      vMongoInsertVec = NULL;
-	      break;
-	    }
-	  }
+    //Now fill the actual data depending on write mode	
+    if(m_iWriteMode == WRITEMODE_BINARY)
+      // Raw pulses are written from the BLT. Compressed ones have to be
+      // copied out of the codec's scratch space before the next pulse.
+      m_pBinaryFile->AddPulse(iModule, Channel, Time64, codecUsed, buff, 
+			      eventSize, (buff != (char*)pulse));
+#ifdef HAVE_LIBMONGOCLIENT
+    //Loop through the parsed buffers        
+
+
+    if(m_iWriteMode == WRITEMODE_MONGODB && m_iBundleMode != BUNDLE_NONE){
+      // All pulses of the batch on this channel (or board) go into one
+      // document, but a document can't span a reset of the counter or
+      // grow past the bundle limit
+      pulse_block_t &block = 
+	m_vBlocks[m_iBundleMode == BUNDLE_CHANNEL ? Channel : 0];
+      long long chunk = (m_pChunks != NULL) ? m_pChunks->ChunkOf(Time64) : -1;
+      if(block.entries.size() > 0 && 
+	 ((m_bRotatingCollections &&
+	   (int)ChannelResetCounters[Channel] != block.resetCount) ||
+	  chunk != block.chunk ||
+	  block.Full(pulseSize, m_iBundleBytes, m_bBinaryIndex)) &&
+	 FlushBlock(block, iModule, codec) != 0){
+	iRet = 1;
+	break;
+      }
+      if(block.entries.size() == 0){
+	block.resetCount = ChannelResetCounters[Channel];
+	block.chunk = chunk;
+      }
+      block_entry_t entry;
+      entry.time    = Time64;
+      entry.length  = pulseSize;
+      entry.channel = Channel;
+      block.entries.push_back(entry);
+      block.integrals.push_back((m_iFeatures & KOPULSE_INTEGRAL) ? 
+				features.integral : 0.);
+      block.data.insert(block.data.end(), (char*)pulse, (char*)pulse + pulseSize);
+      if(b == views.size()-1 && FlushBlocks(iModule, codec) != 0){
+	iRet = 1;
+	break;
+      }
+    }
+    else if(m_iWriteMode == WRITEMODE_MONGODB){
+      // Written straight into the insert buffer, always in this order
+      long long chunk = (m_pChunks != NULL) ? m_pChunks->ChunkOf(Time64) : -1;
+      if(StartDocument(ChannelResetCounters[Channel], iModule, Time64) != 0){
+	iRet = 1;
+	break;
+      }
+      BSONBatch *bson = m_pInsert->batch;
+      bson->AppendInt("module",iModule);
+      bson->AppendInt("channel",Channel);
+      bson->AppendLong("time",Time64);
+      bson->AppendLong("endtime", Time64 + (long long)eventSize);
+      if( chunk >= 0 )
+	bson->AppendLong("chunk", chunk);
+      bson->AppendInt("codec", codecUsed);
+      
+      // Optional pulse features
+      if( m_iFeatures & KOPULSE_BASELINE )
+	bson->AppendDouble("baseline", features.baseline);
+      if( m_iFeatures & KOPULSE_INTEGRAL )
+	bson->AppendDouble("integral", features.integral);
+      if( m_iFeatures & KOPULSE_MAX_AMPLITUDE )
+	bson->AppendInt("max_amplitude", features.max_amplitude);
+      if( m_iFeatures & KOPULSE_MAX_POSITION )
+	bson->AppendInt("max_position", (int)features.max_position);
+      if( m_iFeatures & KOPULSE_WIDTH )
+	bson->AppendInt("width", (int)features.width);
+
+      // Debug output mode. Put extra fields in to track clock issues
+      if( m_bDebugOutput ){
+	bson->AppendInt("header_time", headerTime);
+	bson->AppendInt("raw_time", TimeStamp);
+	bson->AppendInt("header_batch_id", resetCounterStart ); 
+	bson->AppendLong("batch_sequence", (long long)batchSequence );
+	
+	// Channel reset counters at this moment
+	bson->AppendIntArray("channel_batch_ids", &ChannelResetCounters[0],
+			     ChannelResetCounters.size());
+      }
 
-	  
-	}
+      // Lite mode means no data field. If we're not in lite mode add the data field.
+      if( !m_bLiteMode )
+	bson->AppendBinData("data", buff, eventSize);
+
+      if(FinishDocument(iModule) != 0){
+	iRet = 1;
+	break;
+      }
+      
+    }
 #endif
 #ifdef HAVE_LIBPBF
-	if(m_koOptions->GetInt("write_mode") == WRITEMODE_FILE){
-	  if(eventIndices == NULL || ( currentEventIndex<eventIndices->size()
-				       && (*eventIndices)[currentEventIndex]==b) ){
-	    if(protocHandle!=-1)
-	      DAQRecorder_pb->GetOutfile()->close_event(protocHandle,true);
-	    DAQRecorder_pb->GetOutfile()->create_event(TimeStamp,protocHandle);
-	    if(eventIndices!=NULL) currentEventIndex++;
-	  }
-	  DAQRecorder_pb->GetOutfile()->add_data(protocHandle,Channel,
-						 iModule,buff,eventSize,Time64);
-	  //special case for last event
-	  if(b==buffvec->size()-1 && protocHandle!=-1)
-	    DAQRecorder_pb->GetOutfile()->close_event(protocHandle,true);
-	}
+    if(m_iWriteMode == WRITEMODE_FILE){
+      if(eventIndices == NULL || ( currentEventIndex<eventIndices->size()
+				   && (*eventIndices)[currentEventIndex]==b) ){
+	if(protocHandle!=-1)
+	  m_DAQRecorder_pb->GetOutfile()->close_event(protocHandle,true);
+	m_DAQRecorder_pb->GetOutfile()->create_event(TimeStamp,protocHandle);
+	if(eventIndices!=NULL) currentEventIndex++;
+      }
+      m_DAQRecorder_pb->GetOutfile()->add_data(protocHandle,Channel,
+					       iModule,buff,eventSize,Time64);
+      //special case for last event
+      if(b==views.size()-1 && protocHandle!=-1)
+	m_DAQRecorder_pb->GetOutfile()->close_event(protocHandle,true);
+    }
 #endif
-	delete[] buff;
-      }//end loop through buffers
-      if(channels!=NULL) delete channels;
-      if(times!=NULL) delete times;
-      if(buffvec!=NULL) delete buffvec;
-      if(sizevec!=NULL) delete sizevec;
-      if(eventIndices!=NULL) delete eventIndices;
-      buffvec=NULL;
-      eventIndices=sizevec=channels=times=NULL;      
-      
-      if(bProfiling && m_profilefile.is_open())
-	m_profilefile<<"SEARCHING "<<koLogger::GetTimeMus()<<endl;
-
-    }//end loop through digis
-  }//end while loop
-  if(bProfiling && m_profilefile.is_open())
-    m_profilefile<<"DONE "<<koLogger::GetTimeMus()<<endl;
+    // The recorders copied the data. Drop this pulse's hold on the BLT.
+    if(m_iWriteMode != WRITEMODE_BINARY)
+      digi->ReturnBuffer((*buffvec)[views[b].blt]);
+  }//end loop through buffers
+
+  // The binary chunk still points into the BLTs. They go back once it is
+  // on disk.
+  if(m_iWriteMode == WRITEMODE_BINARY){
+    if(iRet != 0)
+      m_pBinaryFile->ClearChunk();
+    else if(m_pBinaryFile->WriteChunk(m_bBlockChunks ? codec : NULL) != 0){
+      LogError("Failed to write " + m_pBinaryFile->GetFileName());
+      iRet = 1;
+    }
+    b = 0;
+  }
 
+  // Pulses not given back above (left early or binary output) still
+  // hold their BLTs
+  for(; b<views.size(); b++)
+    digi->ReturnBuffer((*buffvec)[views[b].blt]);
+
+  // Everything of this batch is with the recorder. A failed batch is
+  // reported as well, its chunks are closed as incomplete.
+  if(m_pChunks != NULL){
+    long long firstTime = -1, lastTime = -1;
+    for(unsigned int x=0; x<times64.size(); x++){
+      if(firstTime < 0 || times64[x] < firstTime)
+	firstTime = times64[x];
+      if(times64[x] > lastTime)
+	lastTime = times64[x];
+    }
+    vector<chunk_marker_t> closed;
+    long long passed = -1;
+    m_pChunks->BatchDone(iModule, batchSequence, firstTime, lastTime, 
+			 (iRet != 0), closed, passed);
 #ifdef HAVE_LIBMONGOCLIENT
-  if(vMongoInsertVec != NULL)
-    delete vMongoInsertVec;
+    // Before the markers, which wait for the module's progress
+    if(m_DAQRecorder_mdb != NULL && passed >= 0)
+      m_DAQRecorder_mdb->ModuleProcessed(iModule, passed);
 #endif
-  cout<<"LEAVING PROCESSING THREAD"<<endl;
-  if(bProfiling && m_profilefile.is_open())
-    m_profilefile.close();
-  return;
+    long long length = m_pChunks->GetLength();
+    for(unsigned int x=0; x<closed.size(); x++)
+      m_DAQRecorder->ChunkComplete(iModule, closed[x].chunk, 
+				   closed[x].chunk*length,
+				   (closed[x].chunk+1)*length,
+				   closed[x].bComplete);
+  }
+  digi->ReleaseBoard(batchSequence);
+  if(eventIndices!=NULL) delete eventIndices;
+  return iRet;
 }
 
-int DataProcessor::GetBufferMax( u_int32_t *buffvec, u_int32_t size ){
-
-  int largestWord = 0;
-  int baseline = 0;
-  for ( u_int32_t i = 0; i < size/4; i++ ){
-    int firstWord  = (buffvec[i]&0x3FFF);
-    int secondWord = ((buffvec[i]>>16)&0x3FFF);
-    if ( i <= 3 ){
-      baseline += firstWord;
-      baseline += secondWord;
-      if ( i == 3 )
-        baseline /= 8;
+#ifdef HAVE_LIBMONGOCLIENT
+int DataProcessor::StartDocument(int resetCount, int iModule, long long time)
+{
+  // If we're using rotating collections and the reset counter has
+  // just changed, trigger an insert. All docs in the bulk insert
+  // should have the same reset counter
+  open_insert_t &insert = *m_pInsert;
+  if(m_bRotatingCollections && resetCount != insert.resetCount &&
+     insert.batch->Documents() != 0){
+    if(SendInsert(insert, iModule) != 0)
+      return 1;
+  }
+  insert.resetCount = resetCount;
+  if(insert.batch->Documents() == 0)
+    insert.start = koLogger::GetTimeMus();
+  if(m_pChunks != NULL){
+    map<int, long long>::iterator it = insert.lowTimes.find(iModule);
+    if(it == insert.lowTimes.end() || time < it->second){
+      insert.lowTimes[iModule] = time;
+      UpdateOpenTime(iModule);
     }
-    else{
-      if(baseline - firstWord > largestWord )
-	largestWord = baseline - firstWord;
-      if(baseline - secondWord > largestWord )
-	largestWord = baseline - secondWord;
+  }
+  insert.batch->StartDocument();
+  return 0;
+}
+
+void DataProcessor::UpdateOpenTime(int iModule)
+{
+  long long low = LLONG_MAX;
+  for(unsigned int x=0; x<m_vInserts.size(); x++){
+    map<int, long long>::const_iterator it = 
+      m_vInserts[x].lowTimes.find(iModule);
+    if(it != m_vInserts[x].lowTimes.end() && it->second < low)
+      low = it->second;
+  }
+  map<int, long long>::iterator last = m_openTimes.find(iModule);
+  if(last == m_openTimes.end() || last->second != low){
+    m_openTimes[iModule] = low;
+    m_DAQRecorder_mdb->UpdateProgressDoc(iModule, low, m_iMongoID);
+  }
+}
+
+int DataProcessor::FinishDocument(int iModule)
+{
+  BSONBatch *batch = m_pInsert->batch;
+  batch->EndDocument();
+      
+  // Send once the insert is big enough for the wire and the server
+  if((m_iMaxInsertDocs > 0 && (int)batch->Documents() >= m_iMaxInsertDocs) ||
+     (m_iInsertBytes > 0 && batch->Bytes() >= m_iInsertBytes))
+    return SendInsert(*m_pInsert, iModule);
+  return 0;
+}
+
+int DataProcessor::CheckInsertDeadline(int &waitMs)
+{
+  if(m_iInsertDeadline == 0)
+    return 0;
+  u_int64_t now = koLogger::GetTimeMus();
+  for(unsigned int x=0; x<m_vInserts.size(); x++){
+    open_insert_t &insert = m_vInserts[x];
+    if(insert.batch == NULL || insert.batch->Documents() == 0)
+      continue;
+    u_int64_t age = now - insert.start;
+    if(age >= m_iInsertDeadline){
+      if(SendInsert(insert, -1) != 0)
+	return 1;
+      continue;
     }
+    int left = (int)((m_iInsertDeadline - age + 999)/1000);
+    if(left < waitMs)
+      waitMs = left;
   }
-    return largestWord;
+  return 0;
 }
-float DataProcessor::GetBufferIntegral( u_int32_t *buffvec, u_int32_t size, u_int32_t bins_baseline ){
-  
-  // Want to loop through buffer and get integral
-  // Assume as first step baseline @ 0xAFFF
-  float integral = 0;
-  float baseline = 0.;
-
-  // bins_baseline must be even and >2=
-  if((bins_baseline%2)==1)
-    bins_baseline-=1;
-  if(bins_baseline<2)
+
+int DataProcessor::SendInsert(open_insert_t &insert, int iModule)
+{
+  if(bProfiling && m_profilefile.is_open())
+    m_profilefile<<"INSERT "<<koLogger::GetTimeMus()<<" "
+		 <<iModule<<" "<<insert.batch->Documents()
+		 <<" "<<m_iMongoID<<" "<<insert.host<<endl;
+
+  int resetCount = m_bRotatingCollections ? insert.resetCount : -1;
+  if(m_DAQRecorder_mdb->InsertAsync(insert.batch, m_iMongoID, resetCount,
+				    insert.host)!=0){
+    LogError("MongoDB insert error from processor thread.");
+    insert.batch = NULL;
+    return 1;
+  }
+  // The last one comes back once it has been written
+  insert.batch = m_DAQRecorder_mdb->GetBatch(m_iMongoID, insert.host);
+  // Only now, the watermarks must see the insert queued first
+  if(!insert.lowTimes.empty()){
+    vector<int> modules;
+    for(map<int, long long>::iterator it = insert.lowTimes.begin();
+	it != insert.lowTimes.end(); it++)
+      modules.push_back(it->first);
+    insert.lowTimes.clear();
+    for(unsigned int x=0; x<modules.size(); x++)
+      UpdateOpenTime(modules[x]);
+  }
+  return 0;
+}
+
+int DataProcessor::FlushBlock(pulse_block_t &block, int iModule,
+			      DataCodec *codec)
+{
+  if(block.entries.size() == 0)
     return 0;
 
-  for ( u_int32_t i = 0; i < size/4; i++ ){
-         
-    int firstWord  =  buffvec[i]&0x3FFF;
-    int secondWord = (buffvec[i]>>16)&0x3FFF;
-    
-    if ( i < bins_baseline/2 ){
-      baseline += float(firstWord);
-      baseline += float(secondWord);
+  char *buff = &block.data[0];
+  u_int32_t size = block.data.size();
+  int codecUsed = CODEC_NONE;
+  if(m_bCompress){
+    if(codec->Compress(&block.data[0], block.data.size(), &buff, &size) != 0){
+      LogError("Failed to compress block with codec " + 
+	       CompressionController::CodecName(codec->GetID()));
+      return 1;
     }
-    else if ( i == bins_baseline/2 ){
-	baseline /= bins_baseline;
+    codecUsed = codec->GetID();
+    if(size >= block.data.size()){
+      buff = &block.data[0];
+      size = block.data.size();
+      codecUsed = CODEC_NONE;
     }
-    else {
-      integral += baseline - float(firstWord);
-      integral += baseline - float(secondWord);
+  }
+
+  long long endTime = 0, lowTime = block.entries[0].time;
+  for(unsigned int x=0; x<block.entries.size(); x++){
+    if(block.entries[x].time + block.entries[x].length > endTime)
+      endTime = block.entries[x].time + block.entries[x].length;
+    if(block.entries[x].time < lowTime)
+      lowTime = block.entries[x].time;
+  }
+
+  int resetCount = block.resetCount;
+  if(StartDocument(resetCount, iModule, lowTime) != 0)
+    return 1;
+  BSONBatch *bson = m_pInsert->batch;
+  bson->AppendInt("module", iModule);
+  if(m_iBundleMode == BUNDLE_CHANNEL)
+    bson->AppendInt("channel", (int)block.entries[0].channel);
+  bson->AppendLong("time", lowTime);
+  bson->AppendLong("endtime", endTime);
+  if(block.chunk >= 0)
+    bson->AppendLong("chunk", block.chunk);
+  bson->AppendInt("codec", codecUsed);
+  if(m_bBinaryIndex){
+    bson->AppendInt("pulses", (int)block.entries.size());
+    bson->AppendBinData("index", (const char*)&block.entries[0],
+			block.entries.size()*sizeof(block_entry_t));
+  }
+  else{
+    bson->StartArray("pulses");
+    for(unsigned int x=0; x<block.entries.size(); x++){
+      bson->StartObject(bson->ArrayKey(x));
+      bson->AppendLong("time", block.entries[x].time);
+      bson->AppendInt("length", (int)block.entries[x].length);
+      bson->AppendDouble("integral", block.integrals[x]);
+      if(m_iBundleMode == BUNDLE_BOARD)
+	bson->AppendInt("channel", (int)block.entries[x].channel);
+      bson->EndObject();
     }
+    bson->EndObject();
+  }
+  if( !m_bLiteMode )
+    bson->AppendBinData("data", buff, size);
 
+  block.entries.clear();
+  block.integrals.clear();
+  block.data.clear();
+  return FinishDocument(iModule);
+}
+
+int DataProcessor::FlushBlocks(int iModule, DataCodec *codec)
+{
+  for(unsigned int x=0; x<m_vBlocks.size(); x++)
+    if(FlushBlock(m_vBlocks[x], iModule, codec) != 0)
+      return 1;
+  return 0;
+}
+#endif
+
+DataProcessor::process_batch_fn DataProcessor::SelectProcessBatch(int mode, 
+								  bool compress)
+{
+  switch(mode){
+  case 0:
+    if(compress) return &DataProcessor::ProcessBatch<0,true>;
+    return &DataProcessor::ProcessBatch<0,false>;
+  case 1:
+    if(compress) return &DataProcessor::ProcessBatch<1,true>;
+    return &DataProcessor::ProcessBatch<1,false>;
+  case 2:
+    if(compress) return &DataProcessor::ProcessBatch<2,true>;
+    return &DataProcessor::ProcessBatch<2,false>;
+  case 3:
+    if(compress) return &DataProcessor::ProcessBatch<3,true>;
+    return &DataProcessor::ProcessBatch<3,false>;
+  case 4:
+    if(compress) return &DataProcessor::ProcessBatch<4,true>;
+    return &DataProcessor::ProcessBatch<4,false>;
+  default:
+    return NULL;
   }
-  return integral;
+}
+
+int DataProcessor::GetBufferMax( u_int32_t *buffvec, u_int32_t size ){
+
+  // Baseline from the first 8 samples, maximum over the rest
+  pulse_features_t features;
+  if(koPulse::Analyze( buffvec, size/4, 8, 0, &features ) != 0 ||
+     features.max_amplitude < 0)
+    return 0;
+  return features.max_amplitude;
 }
 
 	
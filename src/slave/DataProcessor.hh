@@ -16,10 +16,103 @@
 // *************************************************************
 
 #include "DAQRecorder.hh"
+#include "DataCodec.hh"
+#include "ChunkTracker.hh"
 #include <fstream>
 
+// Bundles are cut at this size (data plus index), well under the 16 MB
+// that MongoDB allows for a document
+#define BUNDLE_MAX_BYTES    12582912
+// About what one entry of the "pulses" array takes in BSON
+#define BUNDLE_PULSE_BYTES  72
+
 using namespace std;
 class DigiInterface;
+class CBV1724;
+class BSONBatch;
+
+/*! \brief One pulse found by the parsers. 
+
+    Points into a raw BLT instead of holding a copy of the data. The data 
+    starts at buffvec[blt]+offset.
+ */
+struct pulse_view_t{
+  u_int32_t  blt;       // Index of the BLT in the batch
+  u_int32_t  offset;    // Offset of the data in the BLT (words)
+  u_int32_t  size;      // Size of the data (bytes)
+  u_int32_t  channel;
+  u_int32_t  time;      // 31-bit time stamp
+};
+
+/*! \brief Index entry of a block document (block_compression). 
+
+    A block document holds all pulses of one batch for one board in a
+    single compressed payload. The "index" field is an array of these 
+    (16 bytes each, little endian) in the order of the pulses in the 
+    payload.
+ */
+struct block_entry_t{
+  long long  time;      // 64-bit time stamp
+  u_int32_t  length;    // Size of the pulse in the payload (bytes)
+  u_int32_t  channel;
+};
+
+/*! \brief Pulses collected for one bundle document (bundle_documents).
+
+    With bundle_documents a document holds all pulses of one batch for a
+    board and channel (BUNDLE_CHANNEL) or for a whole board (BUNDLE_BOARD).
+    The samples are concatenated into one payload and the document lists
+    time, length and integral of every pulse in payload order, either as
+    a "pulses" array or, with block_compression, as the binary "index".
+    A bundle is cut into several documents once it would grow past
+    BundleByteLimit.
+ */
+struct pulse_block_t{
+  vector<block_entry_t>  entries;
+  vector<float>          integrals;
+  vector<char>           data;
+  int                    resetCount;
+  long long              chunk;         // Time chunk, -1 without chunks
+
+  // Bytes per pulse in the index
+  static u_int32_t IndexBytes(bool bBinaryIndex){
+    return bBinaryIndex ? sizeof(block_entry_t) : BUNDLE_PULSE_BYTES;
+  };
+  // Data (before compression) and index so far
+  u_int32_t      Bytes(bool bBinaryIndex) const {
+    return data.size() + entries.size()*IndexBytes(bBinaryIndex);
+  };
+  // True if a pulse of pulseSize bytes would take it past limit. An
+  // empty bundle takes any pulse.
+  bool           Full(u_int32_t pulseSize, u_int32_t limit,
+		      bool bBinaryIndex) const {
+    return (entries.size() > 0 && Bytes(bBinaryIndex) + pulseSize +
+	    IndexBytes(bBinaryIndex) > limit);
+  };
+};
+
+// Size a bundle is cut at: insert_bytes if set and smaller than
+// BUNDLE_MAX_BYTES
+inline u_int32_t BundleByteLimit(u_int32_t insertBytes)
+{
+  return (insertBytes > 0 && insertBytes < BUNDLE_MAX_BYTES) ? 
+    insertBytes : BUNDLE_MAX_BYTES;
+}
+
+/*! \brief Insert being filled for one buffer host.
+
+    Each processor keeps one open insert per host of the recorder's pool,
+    so boards routed to different hosts never cut each other's inserts.
+ */
+struct open_insert_t{
+  BSONBatch  *batch;
+  int         host;
+  int         resetCount;   // Of the documents in the batch
+  u_int64_t   start;        // When the first document went in (mus)
+  // Oldest document time of each module in the batch. Only kept if
+  // chunks or progress documents are on.
+  map<int, long long>  lowTimes;
+};
 
 /*! \brief Class for processing data between readout and storage routines.
  
@@ -49,47 +142,125 @@ public:
   //
   // Data formatting functions
   //
-  // Name     : void DataProcessor::SplitBlocks(vector<u_int32_t*>*&buffvec,
-  //                                            vector<u_int32_t> *&sizevec)
+  // The parsers do not copy anything. They describe each pulse with a
+  // pulse_view_t pointing into the raw BLTs passed in buffvec. The BLTs
+  // belong to the digitizer's BLT pool and must stay alive until every
+  // view has been used. The caller gives them back with 
+  // CBV1724::ReturnBuffers.
+  //
+  // Name     : void DataProcessor::SplitBlocks(vector<u_int32_t*> *buffvec,
+  //                                            vector<u_int32_t> *sizevec,
+  //                                            vector<pulse_view_t> &views)
   // Purpose  : Splits block transfers into individual triggers for non-custom
-  //            CAEN V1724 firmware
+  //            CAEN V1724 firmware. One view per trigger, header included.
   // 
-  static void         SplitBlocks(vector <u_int32_t*> *&buffvec, 
-			   vector<u_int32_t> *&sizevec);
+  static void         SplitBlocks(vector <u_int32_t*> *buffvec, 
+				  vector<u_int32_t> *sizevec,
+				  vector<pulse_view_t> &views);
   //
-  // Name     : void DataProcessor::SplitChannels(vector<u_int32_t*> *&buffvec,
-  //                                                    vector<u_int32_t> *&sizevec,
-  //                                                    vector<u_int32_t> *timestamps,
-  //                                                    vector<u_int32_t> *channels)
+  // Name     : void DataProcessor::SplitChannels(vector<u_int32_t*> *buffvec,
+  //                                              vector<u_int32_t> *sizevec,
+  //                                              vector<pulse_view_t> &views,
+  //                                              vector<u_int32_t> *eventIndices,
+  //                                              bool ZLE)
   // Purpose  : Fine block splitting for non-custom CAEN V1724 firmware. Splits
-  //            zero-length-encoded data into "occurrences". The four vectors should
-  //            have the same size upon return where each data buffer corresponds
-  //            to a size, a timestamp, and a channel. Run SplitData on the data
-  //            first if there should be multiple events per BLT
+  //            zero-length-encoded data into "occurrences". Each view gives
+  //            the data, size, timestamp and channel of one occurrence. If 
+  //            eventIndices is given it is filled with the index of the first
+  //            view of each trigger.
   // 
-  static void        SplitChannels(vector <u_int32_t*> *&buffvec,
-			    vector <u_int32_t>  *&sizevec,
-			    vector <u_int32_t>   *timestamps,
-			    vector <u_int32_t>   *channels,
+  static void        SplitChannels(vector <u_int32_t*> *buffvec,
+				   vector <u_int32_t>  *sizevec,
+				   vector <pulse_view_t> &views,
 				   vector <u_int32_t>  *eventIndices=NULL,
 				   bool ZLE=true);
   //
-  // Name      : void DataProcessor::SplitChannelsNewFW(vector <u_int32_t*> *&buffvec,
-  //                                                        vector <u_int32_t> *&sizevec,
-  //                                                        vector <u_int32_t> *timestamps,
-  //                                                        vector <u_int32_t> *channels)
+  // Name      : void DataProcessor::SplitChannelsNewFW(vector <u_int32_t*> *buffvec,
+  //                                                    vector <u_int32_t> *sizevec,
+  //                                                    vector<pulse_view_t> &views,
+  //                                                    bool &bErrorSet,
+  //                                                    string &sErrorText)
   // Purpose   : Split data blocks into channels without any channel parsing
   //
-  static void           SplitChannelsNewFW(vector <u_int32_t*> *&buffvec,
-				    vector <u_int32_t> *&sizevec,
-				    vector <u_int32_t> *timestamps,
-					   vector <u_int32_t> *channels,
+  static void           SplitChannelsNewFW(vector <u_int32_t*> *buffvec,
+					   vector <u_int32_t> *sizevec,
+					   vector <pulse_view_t> &views,
 					   bool &bErrorSet,
 					   string &sErrorText);
 
   static int GetBufferMax( u_int32_t *buffvec, u_int32_t size );
 
 private:  
+  //
+  // Name      : int DataProcessor::ProcessBatch<MODE,COMPRESS>(CBV1724 *digi, ...)
+  // Purpose   : Parse one batch read from digi and hand it to the recorder.
+  //             Instantiated for every processing mode and compression 
+  //             setting. Returns 0 on success, 1 if writing failed and -1 
+  //             if the data can't be parsed.
+  //
+  template<int MODE, bool COMPRESS>
+  int               ProcessBatch(CBV1724 *digi, vector<u_int32_t*> *buffvec,
+				 vector<u_int32_t> *sizevec,
+				 unsigned int resetCounterStart,
+				 u_int32_t headerTime, u_int64_t batchSequence);
+  typedef int (DataProcessor::*process_batch_fn)(CBV1724*, vector<u_int32_t*>*,
+						 vector<u_int32_t>*, unsigned int,
+						 u_int32_t, u_int64_t);
+  //
+  // Name      : process_batch_fn DataProcessor::SelectProcessBatch(int mode, bool compress)
+  // Purpose   : Pick the ProcessBatch instance for the options. NULL if the 
+  //             processing mode is unknown.
+  //
+  static process_batch_fn SelectProcessBatch(int mode, bool compress);
+#ifdef HAVE_LIBMONGOCLIENT
+  //
+  // Name      : int DataProcessor::StartDocument(int resetCount, int iModule,
+  //                                            long long time)
+  // Purpose   : Open a new document in the insert for the board being
+  //             processed (m_pInsert). With rotating collections the
+  //             insert is sent first if the reset counter changed. time
+  //             is the document's (earliest) 64-bit time. Returns 0 on
+  //             success and 1 if the writer failed.
+  //
+  int               StartDocument(int resetCount, int iModule, long long time);
+  //
+  // Name      : int DataProcessor::FinishDocument(int iModule)
+  // Purpose   : Close the document. The batch is handed to this processor's
+  //             writer thread once it holds max_insert_docs documents or
+  //             insert_bytes. Returns 0 on success and 1 if the writer
+  //             failed.
+  //
+  int               FinishDocument(int iModule);
+  int               SendInsert(open_insert_t &insert, int iModule);
+  //
+  // Name      : int DataProcessor::CheckInsertDeadline(int &waitMs)
+  // Purpose   : Send each open insert if its first document is older than
+  //             insert_deadline_ms, so quiet periods don't hold data back.
+  //             Otherwise waitMs is lowered to the time left. Returns 0 on
+  //             success and 1 if the writer failed.
+  //
+  int               CheckInsertDeadline(int &waitMs);
+  //
+  // Name      : int DataProcessor::FlushBlock(pulse_block_t &block, int iModule,
+  //                                           DataCodec *codec)
+  // Purpose   : Compress the pulses of a bundle once and add them to the
+  //             insert as one document.
+  //
+  int               FlushBlock(pulse_block_t &block, int iModule,
+			       DataCodec *codec);
+  //
+  // Name      : int DataProcessor::FlushBlocks(int iModule, DataCodec *codec)
+  // Purpose   : Close all open bundles. Called at the end of each batch.
+  //
+  int               FlushBlocks(int iModule, DataCodec *codec);
+  //
+  // Name      : void DataProcessor::UpdateOpenTime(int iModule)
+  // Purpose   : Tell the recorder the oldest time of the module in our
+  //             open inserts if it changed (UpdateProgressDoc)
+  //
+  void              UpdateOpenTime(int iModule);
+#endif
+  void              InitializeMembers();
   //
   // Name      : void DataProcessor::LogError(string err)
   // Purpose   : The data processor routines can report errors using this
@@ -97,17 +268,11 @@ private:
   // 
   void              LogError(string err);
   //
-  // Name      : u_int32_t DataProcessor::GetTimeStamp(u_int32_t *buffer)
+  // Name      : u_int32_t DataProcessor::GetTimeStamp(u_int32_t *buffer, u_int32_t nWords)
   // Purpose   : Send a normal CAEN buffer (with header) to this function and 
-  //             it will extract the 31-bit trigger time tag.
+  //             it will extract the 31-bit trigger time tag. 0 if no header.
   // 
-  u_int32_t         GetTimeStamp(u_int32_t *buffer);
-  
-  //
-  // Name       : int DataProcessor::GetBufferIntegral( u_int32_t *buffvec, u_int32_t size, u_int32_t baseline_bins )
-  // Purpose    : Return the integral of the pulse in the buffer in digi units. Baseline bins must be even >=2
-  //
-  float               GetBufferIntegral( u_int32_t *buffvec, u_int32_t size, u_int32_t baseline_bins );
+  u_int32_t         GetTimeStamp(u_int32_t *buffer, u_int32_t nWords);
   
   // Access to private members
   //DAQRecorder*   GetDAQRecorder(){
@@ -125,6 +290,44 @@ private:
   int               m_id;
   bool              bProfiling;
   ofstream          m_profilefile;
+
+  // Options, read once in the constructor
+  int               m_iProcessingMode, m_iWriteMode;
+  int               m_iFeatures, m_iBaselineBins, m_iWidthThreshold;
+  bool              m_bCompress, m_bDebugOutput, m_bLiteMode;
+  bool              m_bRotatingCollections, m_bBinaryIndex, m_bBlockChunks;
+  int               m_iBundleMode;
+  process_batch_fn  m_fProcessBatch;
+
+  // Time chunks (time_chunk_ms), NULL if off
+  ChunkTracker     *m_pChunks;
+
+  // Thread state that lives from batch to batch
+  int               m_iMongoID;
+  // This processor's stream in WRITEMODE_BINARY
+  DAQRecorder_binary *m_DAQRecorder_bin;
+  BinaryFile       *m_pBinaryFile;
+  // One codec per rung of the CompressionController ladder. Each owns
+  // its compression scratch space.
+  vector<DataCodec*> m_vCodecs;
+#ifdef HAVE_LIBMONGOCLIENT
+  DAQRecorder_mongodb     *m_DAQRecorder_mdb;
+  // One open insert per buffer host, m_pInsert is the current board's
+  vector<open_insert_t>    m_vInserts;
+  open_insert_t           *m_pInsert;
+  // Insert limits (0 = off)
+  int                      m_iMaxInsertDocs;
+  u_int32_t                m_iInsertBytes;
+  u_int32_t                m_iBundleBytes;      // BundleByteLimit
+  u_int64_t                m_iInsertDeadline;   // mus
+  // Open bundles, one per channel or one for the board
+  vector<pulse_block_t>    m_vBlocks;
+  // Last value given to UpdateProgressDoc per module
+  map<int, long long>      m_openTimes;
+#endif
+#ifdef HAVE_LIBPBF
+  DAQRecorder_protobuff   *m_DAQRecorder_pb;
+#endif
 };
 
 #endif
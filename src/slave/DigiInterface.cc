@@ -16,20 +16,17 @@
 
 DigiInterface::DigiInterface()
 {
-   m_ReadThread.IsOpen=false;
    m_WriteThread.IsOpen=false;
    m_koLog = NULL;
    m_DAQRecorder=NULL;
    m_RunStartModule=NULL;
    m_DB_USER=m_DB_PASSWORD="";
-   pthread_mutex_init(&m_RateMutex,NULL);
    m_koOptions = NULL;
    bProfiling=false;
 }
 
 DigiInterface::~DigiInterface()
 {     
-  pthread_mutex_destroy(&m_RateMutex);
   Close();
 }
 
@@ -37,7 +34,6 @@ DigiInterface::DigiInterface(koLogger *logger, int ID,
 			     string DB_USER, string DB_PASSWORD, int cores, 
 			     int profiling)
 {
-   m_ReadThread.IsOpen  = false;
    m_WriteThread.IsOpen = false;
    m_koLog              = logger;
    m_DAQRecorder        = NULL;
@@ -45,7 +41,6 @@ DigiInterface::DigiInterface(koLogger *logger, int ID,
    m_slaveID            = ID;
    m_DB_USER            = DB_USER;
    m_DB_PASSWORD        = DB_PASSWORD;
-   pthread_mutex_init(&m_RateMutex,NULL);
    m_koOptions = NULL;
    fCores = cores;
    bProfiling = profiling;
@@ -66,6 +61,17 @@ int DigiInterface::Arm(koOptions *options){
   cout<<"Arming!"<<endl;
 
   m_koOptions = options;
+  if(options->GetConfigErrors() != ""){
+    if(m_koLog!=NULL)
+      m_koLog->Error("DigiInterface::Arm - Invalid options: " + 
+		     options->GetConfigErrors());
+    return -1;
+  }
+  if(!DataCodec::Available(options->GetRunConfig().codec)){
+    if(m_koLog!=NULL)
+      m_koLog->Error("DigiInterface::Arm - The codec requested is not available in this installation");
+    return -1;
+  }
 
   // Ensure mutiple 'Arm' commands in sequence don't declare too many 
   // objects by closing first.
@@ -99,9 +105,6 @@ int DigiInterface::Arm(koOptions *options){
   cout<<"Run started"<<endl;
 
   //Set up processing threads containers
-  m_iReadSize=0;
-  m_iReadFreq=0;
-
   /*
   if(options->GetInt("processing_num_threads")>0)
     m_vProcThreads.resize(options->GetInt("processing_num_threads"));
@@ -140,6 +143,8 @@ int DigiInterface::Arm(koOptions *options){
     options->SetInt("write_mode", WRITEMODE_NONE);
 #endif
   }
+  else if ( options->GetInt("write_mode") == WRITEMODE_BINARY )
+    m_DAQRecorder = new DAQRecorder_binary(m_koLog);
   else
     options->SetInt("write_mode", WRITEMODE_NONE);
   
@@ -154,6 +159,14 @@ int DigiInterface::Arm(koOptions *options){
     }
   }
 
+  // The processors build their codecs from this, so set it up first
+  m_Compression.Initialize(options->GetRunConfig());
+  // Progress documents need the processed times even without chunks
+  const run_config_t &config = options->GetRunConfig();
+  m_Chunks.Initialize(config.time_chunk_ms,
+		      (config.write_mode == WRITEMODE_MONGODB &&
+		       config.mongo.progress_interval_ms > 0));
+
   // Spawn the actual threads
   cout<<"Spawning threads"<<endl;
   for(unsigned int x=0; x<m_vProcThreads.size();x++)  {
@@ -175,20 +188,49 @@ int DigiInterface::Arm(koOptions *options){
     m_vProcThreads[x].IsOpen=true;
   }
 
-  // If the read thread is already open there must have been a problem 
+  // If a read thread is already open there must have been a problem 
   // Closing the last run. So fail send the stop command. 
-  if(m_ReadThread.IsOpen)  {
+  if(m_vReadThreads.size()!=0)  {
     if(m_koLog!=NULL)
       m_koLog->Error("DigiInterface::StartRun - Read thread was already open.");
     Close();
     return -1;
   }
 
-  //Create read thread and indicate that it's open 
-  cout<<"Making read thread"<<endl;
-  pthread_create(&m_ReadThread.Thread,NULL,DigiInterface::ReadThreadWrapper,
-                 static_cast<void*>(this));
-  m_ReadThread.IsOpen=true;
+  // Assign the digitizers to read threads. Either one thread for 
+  // everything or one thread per crate handle (i.e. per link).
+  bool bParallelReadout = (options->GetRunConfig().parallel_readout==1);
+  for(unsigned int x=0;x<m_vDigitizers.size();x++){
+    int handle = -1;
+    if(bParallelReadout)
+      handle = m_vDigitizers[x]->GetCrateHandle();
+    ReadThreadType *rt = NULL;
+    for(unsigned int y=0;y<m_vReadThreads.size();y++){
+      if(m_vReadThreads[y]->CrateHandle == handle){
+	rt = m_vReadThreads[y];
+	break;
+      }
+    }
+    if(rt == NULL){
+      rt = new ReadThreadType();
+      rt->IsOpen = false;
+      rt->CrateHandle = handle;
+      rt->ReadSize = 0;
+      rt->ReadFreq = 0;
+      rt->Interface = this;
+      m_vReadThreads.push_back(rt);
+    }
+    rt->Digitizers.push_back(m_vDigitizers[x]);
+  }
+
+  //Create read threads and indicate that they're open 
+  cout<<"Making "<<m_vReadThreads.size()<<" read thread(s)"<<endl;
+  for(unsigned int x=0;x<m_vReadThreads.size();x++){
+    pthread_create(&m_vReadThreads[x]->Thread,NULL,
+		   DigiInterface::ReadThreadWrapper,
+		   static_cast<void*>(m_vReadThreads[x]));
+    m_vReadThreads[x]->IsOpen=true;
+  }
 
   // Reset the clocks!
   for(unsigned int x=0;x<m_vDigitizers.size();x++){
@@ -297,6 +339,7 @@ int DigiInterface::InitializeHardware(koOptions *options)
 	CBV1724 *digitizer = new CBV1724(Board, m_koLog, bProfiling);
 	m_vDigitizers.push_back(digitizer);
 	digitizer->SetCrateHandle(tempHandle);
+	digitizer->SetNotifier(&m_Notifier);
       }	 
       else if(Board.type=="V2718"){	      
 	CBV2718 *digitizer = new CBV2718(Board, m_koLog);
@@ -344,11 +387,13 @@ int DigiInterface::InitializeHardware(koOptions *options)
 
 
 int DigiInterface::GetBufferOccupancy( vector<int> &digis, vector<int> &sizes,
-				       vector<int> &counts, vector<string> &profile)
+				       vector<int> &counts, vector<int> &pools,
+				       vector<string> &profile)
 {
   digis.resize(0);
   sizes.resize(0);
   counts.resize(0);
+  pools.resize(0);
   int totalSize = 0;
   for(unsigned int x=0; x<m_vDigitizers.size(); x++){
     digis.push_back(m_vDigitizers[x]->GetID().id);
@@ -358,6 +403,8 @@ int DigiInterface::GetBufferOccupancy( vector<int> &digis, vector<int> &sizes,
     profile.insert(profile.end(), p.begin(), p.end());
     counts.push_back(bCount);
     sizes.push_back(bSize);
+    int poolTotal = 0;
+    pools.push_back(m_vDigitizers[x]->GetPoolOccupancy(poolTotal));
     totalSize += bSize;
   }
   return totalSize;
@@ -431,12 +478,12 @@ void* DigiInterface::ReadThreadWrapper(void* data)
   pthread_setschedprio(thId, max_prio_for_policy);
   pthread_attr_destroy(&thAttr);
   */
-   DigiInterface *digi = static_cast<DigiInterface*>(data);
-   digi->ReadThread();
+   ReadThreadType *rt = static_cast<ReadThreadType*>(data);
+   rt->Interface->ReadThread(rt);
    return (void*)data;
 }
 
-void DigiInterface::ReadThread()
+void DigiInterface::ReadThread(ReadThreadType *rt)
 {
   bool  RanOnce = false;
   bool ExitCondition=false;
@@ -445,12 +492,13 @@ void DigiInterface::ReadThread()
   // Use this to make sure you read each digitizer once 
   // even once the run finishes. This way the object is not clears
   // while there's still data in the board's buffer.
-  vector<bool> EndOfRunClear( m_vDigitizers.size(), false );
+  vector<CBV1724*> &digis = rt->Digitizers;
+  vector<bool> EndOfRunClear( digis.size(), false );
 
    while(!ExitCondition)  {
       ExitCondition=true;
       unsigned int rate=0,freq=0;
-      for(unsigned int x=0; x<m_vDigitizers.size();x++)  {
+      for(unsigned int x=0; x<digis.size();x++)  {
 
 	// avoid hammering the vme bus. Debatable if this is needed but
 	// it doesn't hurt.
@@ -458,7 +506,7 @@ void DigiInterface::ReadThread()
 
 	// First check if the digitizer is active. If at least
 	// one digitizer is active then keep the thread alive
-	if(m_vDigitizers[x]->Activated()) {
+	if(digis[x]->Activated()) {
 	   ExitCondition=false; 
 	   RanOnce = true;
 	   EndOfRunClear[x] = false;
@@ -471,7 +519,7 @@ void DigiInterface::ReadThread()
 	}
 
 	// Read from the digitizer and adjust the rates
-	 unsigned int ratecycle=m_vDigitizers[x]->ReadMBLT();	 	 
+	 unsigned int ratecycle=digis[x]->ReadMBLT();	 	 
 	 //double drate = (double)(ratecycle);
 	 //if(drate > 1000000)
 	 //cout<<drate/1000000<<endl;
@@ -481,10 +529,9 @@ void DigiInterface::ReadThread()
 	   freq++;
       }  
 
-      LockRateMutex();
-      m_iReadSize+=rate;      
-      m_iReadFreq+=freq;
-      UnlockRateMutex();
+      // Only this thread adds to its counters. GetRate swaps them out.
+      rt->ReadSize+=rate;      
+      rt->ReadFreq+=freq;
 
       // End of run logic. If no digitizers seem to be activated
       // Try a few times (100) to see if any are active. If not end run.
@@ -565,6 +612,18 @@ int DigiInterface::StartRun()
       
    cout<<"Deactivated digitizers. Closing threads."<<endl;
    CloseThreads();
+
+   // The processors are done, so the last chunk of each module is too
+   if(m_DAQRecorder != NULL && m_Chunks.Enabled()){
+     vector<chunk_marker_t> closed;
+     m_Chunks.Finish(closed);
+     long long length = m_Chunks.GetLength();
+     for(unsigned int x=0; x<closed.size(); x++)
+       m_DAQRecorder->ChunkComplete(closed[x].module, closed[x].chunk,
+				    closed[x].chunk*length,
+				    (closed[x].chunk+1)*length,
+				    closed[x].bComplete);
+   }
    cout<<"Shutting down recorder."<<endl;
    if(m_DAQRecorder != NULL)
      m_DAQRecorder->Shutdown();
@@ -576,12 +635,18 @@ int DigiInterface::StartRun()
 void DigiInterface::CloseThreads(bool Completely)
 {
   cout<<"Entering closethreads"<<endl;
-   if(m_ReadThread.IsOpen)  {
-     cout<<"Closing read thread...";
-      m_ReadThread.IsOpen=false;
-      pthread_join(m_ReadThread.Thread,NULL);      
-      cout<<" done!"<<endl;
+   for(unsigned int x=0;x<m_vReadThreads.size();x++)  {
+     cout<<"Closing read thread "<<x<<"...";
+     if(m_vReadThreads[x]->IsOpen){
+       m_vReadThreads[x]->IsOpen=false;
+       pthread_join(m_vReadThreads[x]->Thread,NULL);      
+     }
+     delete m_vReadThreads[x];
+     cout<<" done!"<<endl;
    }
+   m_vReadThreads.clear();
+   // Make sure no processor is sleeping while we wait for it
+   m_Notifier.Broadcast();
    for(unsigned int x=0;x<m_vProcThreads.size();x++)  {
      cout<<"Closing processing thread "<<x<<"..."<<flush;
       if(m_vProcThreads[x].IsOpen==false) continue;
@@ -605,27 +670,58 @@ void DigiInterface::CloseThreads(bool Completely)
    return;
 }
 
-bool DigiInterface::LockRateMutex()
+void DigiInterface::UpdateCompression(double cpuPct)
 {
-   int error = pthread_mutex_lock(&m_RateMutex);
-   if(error==0) return true;
-   return false;
+  if(m_Compression.GetRungs() < 2)
+    return;
+  for(unsigned int x=0; x<m_vDigitizers.size(); x++){
+    int total = 0;
+    int used = m_vDigitizers[x]->GetPoolOccupancy(total);
+    if(total == 0)
+      continue;
+    int rung = m_vDigitizers[x]->GetCompressionRung();
+    int newRung = m_Compression.Update(rung, (double)used/total, cpuPct);
+    if(newRung == rung)
+      continue;
+    m_vDigitizers[x]->SetCompressionRung(newRung);
+    if(m_koLog != NULL){
+      stringstream msg;
+      msg<<"Board "<<m_vDigitizers[x]->GetID().id<<" now compresses with "
+	 <<CompressionController::CodecName(m_Compression.GetCodec(newRung))
+	 <<" (pool "<<used<<"/"<<total<<", CPU "<<cpuPct<<"%)";
+      m_koLog->Message(msg.str());
+    }
+  }
 }
 
-bool DigiInterface::UnlockRateMutex()
+int DigiInterface::GetWriteQueue(int &capacity, int &peak, u_int64_t &stalls,
+				 u_int64_t &spilled)
 {
-   int error = pthread_mutex_unlock(&m_RateMutex);
-   if(error==0) return true;
-   return false;
+  capacity = peak = 0;
+  stalls = spilled = 0;
+#ifdef HAVE_LIBMONGOCLIENT
+  DAQRecorder_mongodb *mdb = dynamic_cast<DAQRecorder_mongodb*>(m_DAQRecorder);
+  if(mdb != NULL){
+    mongo_writer_stats_t stats;
+    mdb->GetWriterStats(stats);
+    capacity = stats.capacity;
+    peak = stats.peak;
+    stalls = stats.stalls;
+    spilled = stats.spilled;
+    return stats.depth;
+  }
+#endif
+  return -1;
 }
 
 u_int32_t DigiInterface::GetRate(u_int32_t &freq)
 {
-   if(!LockRateMutex()) return 0;
-   freq=m_iReadFreq;
-   u_int32_t retRate=m_iReadSize;
-   m_iReadFreq=m_iReadSize=0;
-   UnlockRateMutex();
+   freq=0;
+   u_int32_t retRate=0;
+   for(unsigned int x=0;x<m_vReadThreads.size();x++){
+     freq+=m_vReadThreads[x]->ReadFreq.exchange(0);
+     retRate+=m_vReadThreads[x]->ReadSize.exchange(0);
+   }
    return retRate;
 }
 
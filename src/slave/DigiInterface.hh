@@ -16,11 +16,14 @@
 
 #include <koLogger.hh>
 #include <pthread.h>
+#include <atomic>
 #include <koHelper.hh>
 #include "CBV1724.hh"
 #include "CBV2718.hh"
 #include "CBV1495.hh"
 #include "DataProcessor.hh"
+#include "CompressionController.hh"
+#include "ChunkTracker.hh"
 
 using namespace std;
 
@@ -32,6 +35,25 @@ struct PThreadType
    bool IsOpen;
 };
 
+class DigiInterface;
+
+/*! \brief Holder for a readout thread.
+
+    Each readout thread owns a set of digitizers and reads them round-robin.
+    The rate counters belong to the thread so that several readout threads
+    never contend on a shared lock. They are summed up in GetRate.
+ */
+struct ReadThreadType
+{
+   pthread_t Thread;
+   bool IsOpen;
+   int CrateHandle;                     // -1 if the thread serves all links
+   vector<CBV1724*> Digitizers;
+   std::atomic<u_int32_t> ReadSize;
+   std::atomic<u_int32_t> ReadFreq;
+   DigiInterface *Interface;
+};
+
 /*! \brief Holder for processing threads.
  */ 
 struct ProcThread
@@ -88,6 +110,26 @@ class DigiInterface
    // Output   : Data size since last call to GetRate and #BLTs since last call
    u_int32_t     GetRate(u_int32_t &freq);
    //
+   // Name     : void DigiInterface::UpdateCompression(double cpuPct)
+   // Input    : CPU load in percent (from koSysmon)
+   // Function : Lets the CompressionController move each board up or down
+   //            its codec ladder. Call about once a second while running.
+   // Output   : none
+   //
+   void          UpdateCompression(double cpuPct);
+   //
+   // Name     : int DigiInterface::GetWriteQueue(int &capacity, int &peak, 
+   //                                             u_int64_t &stalls,
+   //                                             u_int64_t &spilled)
+   // Function : Inserts waiting in the processors' mongodb writer queues
+   // Output   : Depth now, capacity, peak depth since the last call, the
+   //            number of times a processor had to wait for room and the
+   //            bytes waiting in the spill file. Returns -1 if there are
+   //            no writers.
+   //
+   int           GetWriteQueue(int &capacity, int &peak, u_int64_t &stalls,
+			       u_int64_t &spilled);
+   //
    // Name     : void DigiInterface::Close()
    // Input    : none
    // Function : Closes this object and resets everything.
@@ -112,32 +154,50 @@ class DigiInterface
    unsigned int  GetDigis()  {
       return m_vDigitizers.size();
    };
+  ReadoutNotifier* GetNotifier(){
+    return &m_Notifier;
+  };
+  CompressionController* GetCompression(){
+    return &m_Compression;
+  };
+  ChunkTracker* GetChunkTracker(){
+    return &m_Chunks;
+  };
    
    //
    //For read thread - not for user use but public since threads need to access
    //
-   static void*  ReadThreadWrapper(void* digi);    
+   static void*  ReadThreadWrapper(void* data);    
 
   // Get the buffer sizes of all digitizers. This corresponds roughly to the 
   // memory usage of the program (there's some overhead from the data currently 
   // being read out, object size, etc. but most of the memory usage is here). 
   // The vectors give the digitizer id's (digis) and the buffer size in each (sizes)
+  // The BLT slabs in use in each digitizer's pool are given in pools.
   // The return value is the total occupancy (sum of sizes)
   int GetBufferOccupancy( vector<int> &digis, vector<int> &sizes, 
-			  vector<int> &counts, vector<string> &profile);
+			  vector<int> &counts, vector<int> &pools,
+			  vector<string> &profile);
    
  private:   
-  void          ReadThread();       // Only need 1 read thread since V1724
-                                    // reads can't be parallelized
+  // V1724 reads can't be parallelized within one optical link, but boards
+  // behind different crate handles can be read at the same time. By default
+  // one thread reads everything. With the option parallel_readout=1 one
+  // thread is spawned per crate handle, each reading the boards on its link.
+  void          ReadThread(ReadThreadType *rt);
   void          CloseThreads(bool Completely=false);
-  bool          LockRateMutex();    // Need a mutex for the rate since reads are
-  bool          UnlockRateMutex();  // done in a separate thread but readout of
-                                    // the rate is done in the main thread
   int           InitializeHardware(koOptions *options);
   int           fCores;
    //Threads
    vector<ProcThread>   m_vProcThreads;  
-   PThreadType          m_ReadThread;
+   vector<ReadThreadType*> m_vReadThreads;
+  // Processors sleep on this until a digitizer has data for them
+  ReadoutNotifier      m_Notifier;
+  // Codec ladder shared by the processors
+  CompressionController m_Compression;
+  // Time chunks of the run (time_chunk_ms) and processed times, shared
+  // by the processors
+  ChunkTracker          m_Chunks;
    PThreadType          m_WriteThread;
    
   // Electronics
@@ -147,11 +207,6 @@ class DigiInterface
   DAQRecorder         *m_DAQRecorder;
   vector<CBV1495*>    m_vGeneralPurposeBoards;
   
-  // Rate info
-  unsigned int         m_iReadSize;
-  unsigned int         m_iReadFreq;
-  pthread_mutex_t      m_RateMutex;
-  
   //kodiaq objects
   koOptions           *m_koOptions;
   koLogger            *m_koLog;
@@ -0,0 +1,281 @@
+// ****************************************************************
+//
+// kodiaq Data Acquisition Software
+//
+// File     : MongoWriter.cc
+// Date     : 16.10.2026
+//
+// Brief    : Writes the processors' bulk inserts from a thread of
+//            its own so parsing never waits on the network
+//
+// *****************************************************************
+
+#include "MongoWriter.hh"
+
+#ifdef HAVE_LIBMONGOCLIENT
+
+#include <sys/time.h>
+#include "DAQRecorder.hh"
+
+#define MONGOWRITER_RETRY_MS   100
+
+MongoWriter::MongoWriter(DAQRecorder_mongodb *recorder,
+			 mongo::DBClientBase *conn, int ID, int host,
+			 unsigned int capacity)
+{
+  m_recorder = recorder;
+  m_conn = conn;
+  m_ID = ID;
+  m_host = host;
+  m_capacity = (capacity < 1) ? 1 : capacity;
+  pthread_mutex_init(&m_lock, NULL);
+  pthread_cond_init(&m_notEmpty, NULL);
+  pthread_cond_init(&m_notFull, NULL);
+  m_bRunning = m_bStop = m_bError = false;
+  m_bLost = false;
+  m_peak = 0;
+  m_stalls = m_inserts = 0;
+  m_pushed = m_finished = 0;
+  m_lastLatency = 0;
+  m_nsResetCount = m_nsVersion = -1;
+}
+
+MongoWriter::~MongoWriter()
+{
+  Stop();
+  // Only left if the thread never ran
+  for(unsigned int x=0; x<m_queue.size(); x++)
+    delete m_queue[x].batch;
+  m_queue.clear();
+  for(unsigned int x=0; x<m_free.size(); x++)
+    delete m_free[x];
+  m_free.clear();
+  pthread_cond_destroy(&m_notFull);
+  pthread_cond_destroy(&m_notEmpty);
+  pthread_mutex_destroy(&m_lock);
+}
+
+int MongoWriter::Start()
+{
+  if(m_bRunning)
+    return 0;
+  m_bStop = m_bError = false;
+  if(pthread_create(&m_thread, NULL, MongoWriter::WriteWrapper,
+		    static_cast<void*>(this)) != 0)
+    return -1;
+  m_bRunning = true;
+  return 0;
+}
+
+void MongoWriter::Stop()
+{
+  if(!m_bRunning)
+    return;
+  pthread_mutex_lock(&m_lock);
+  m_bStop = true;
+  pthread_cond_broadcast(&m_notEmpty);
+  pthread_mutex_unlock(&m_lock);
+  pthread_join(m_thread, NULL);
+  m_bRunning = false;
+}
+
+int MongoWriter::Push(BSONBatch *batch, int resetCount, bool bWait,
+		      int attempts)
+{
+  pthread_mutex_lock(&m_lock);
+  if(!m_bRunning || m_bStop || m_bError){
+    pthread_mutex_unlock(&m_lock);
+    delete batch;
+    return -1;
+  }
+  if(m_queue.size() >= m_capacity && !m_bLost){
+    if(!bWait){
+      pthread_mutex_unlock(&m_lock);
+      return 1;
+    }
+    m_stalls++;
+    while(m_queue.size() >= m_capacity && !m_bError && !m_bLost)
+      pthread_cond_wait(&m_notFull, &m_lock);
+  }
+  // The recorder picks another host
+  if(m_bLost){
+    pthread_mutex_unlock(&m_lock);
+    return 2;
+  }
+  insert_job_t job;
+  job.batch = batch;
+  job.resetCount = resetCount;
+  job.attempts = attempts;
+  m_queue.push_back(job);
+  m_pushed++;
+  if(m_queue.size() > m_peak)
+    m_peak = m_queue.size();
+  pthread_cond_signal(&m_notEmpty);
+  int ret = m_bError ? -1 : 0;
+  pthread_mutex_unlock(&m_lock);
+  return ret;
+}
+
+BSONBatch* MongoWriter::GetBatch()
+{
+  BSONBatch *batch = NULL;
+  pthread_mutex_lock(&m_lock);
+  if(!m_free.empty()){
+    batch = m_free.back();
+    m_free.pop_back();
+  }
+  pthread_mutex_unlock(&m_lock);
+  if(batch == NULL)
+    batch = new BSONBatch();
+  return batch;
+}
+
+void MongoWriter::Recycle(BSONBatch *batch)
+{
+  pthread_mutex_lock(&m_lock);
+  m_free.push_back(batch);
+  pthread_mutex_unlock(&m_lock);
+}
+
+void MongoWriter::GetStats(mongo_writer_stats_t &stats)
+{
+  pthread_mutex_lock(&m_lock);
+  stats.depth += m_queue.size();
+  stats.capacity += m_capacity;
+  stats.peak += m_peak;
+  stats.stalls += m_stalls;
+  stats.inserts += m_inserts;
+  m_peak = m_queue.size();
+  pthread_mutex_unlock(&m_lock);
+}
+
+void MongoWriter::GetProgress(u_int64_t &pushed, u_int64_t &finished)
+{
+  pthread_mutex_lock(&m_lock);
+  pushed = m_pushed;
+  finished = m_finished;
+  pthread_mutex_unlock(&m_lock);
+}
+
+bool MongoWriter::Congested(int latencyMs)
+{
+  pthread_mutex_lock(&m_lock);
+  bool ret = (m_queue.size() >= m_capacity ||
+	      (latencyMs > 0 && !m_queue.empty() &&
+	       m_lastLatency > (u_int64_t)latencyMs*1000));
+  pthread_mutex_unlock(&m_lock);
+  return ret;
+}
+
+void MongoWriter::SetConnection(mongo::DBClientBase *conn)
+{
+  pthread_mutex_lock(&m_lock);
+  m_conn = conn;
+  m_bLost = false;
+  pthread_mutex_unlock(&m_lock);
+}
+
+void* MongoWriter::WriteWrapper(void *data)
+{
+  MongoWriter *writer = static_cast<MongoWriter*>(data);
+  writer->WriteThread();
+  return data;
+}
+
+void MongoWriter::WriteThread()
+{
+  pthread_mutex_lock(&m_lock);
+  while(true){
+    while(m_queue.empty() && !m_bStop)
+      pthread_cond_wait(&m_notEmpty, &m_lock);
+    if(m_queue.empty())
+      break;
+    insert_job_t job = m_queue.front();
+    mongo::DBClientBase *conn = m_conn;
+    bool bStop = m_bStop;
+    pthread_mutex_unlock(&m_lock);
+
+    // The network round trip happens without the lock so the processor
+    // can keep queueing
+    int version = m_recorder->GetCollectionVersion();
+    if(job.resetCount != m_nsResetCount || version != m_nsVersion){
+      m_ns = m_recorder->GetCollectionName(job.resetCount);
+      m_nsResetCount = job.resetCount;
+      m_nsVersion = version;
+    }
+    // The BSONObjs only point into the batch
+    int ret = -1;
+    if(!m_recorder->HostFailed(m_host)){
+      m_docs.clear();
+      for(u_int32_t x=0; x<job.batch->Documents(); x++)
+	m_docs.push_back(mongo::BSONObj(job.batch->Document(x)));
+      u_int64_t start = koLogger::GetTimeMus();
+      ret = m_recorder->InsertThreaded(m_docs, conn, m_ns);
+      u_int64_t latency = koLogger::GetTimeMus() - start;
+      m_docs.clear();
+      pthread_mutex_lock(&m_lock);
+      m_lastLatency = latency;
+      pthread_mutex_unlock(&m_lock);
+    }
+    bool bLost = false, bKeep = false;
+    if(ret == 0)
+      job.batch->Clear();
+    else if(ret == -2){
+      // The host is fine but didn't take it. Spilled (or dropped), the
+      // batch stays here.
+      m_recorder->InsertFailed(job.batch, job.resetCount, m_host, 
+			       job.attempts+1);
+      job.batch->Clear();
+    }
+    else{
+      // Connection gone. This and everything still queued here goes to
+      // another host or the spill file. Producers waiting for room here
+      // go elsewhere too.
+      m_recorder->SetHostFailed(m_host);
+      pthread_mutex_lock(&m_lock);
+      m_bLost = true;
+      pthread_cond_broadcast(&m_notFull);
+      pthread_mutex_unlock(&m_lock);
+      // Without waiting while the run goes on. At the end the other
+      // writers are still draining, so it can wait for them.
+      int handed = bStop ?
+	m_recorder->InsertAsync(job.batch, m_ID, job.resetCount, m_host) :
+	m_recorder->HandOff(job.batch, m_ID, job.resetCount, m_host,
+			    job.attempts);
+      if(handed == 1)
+	bKeep = true;
+      else{
+	bLost = (handed != 0);
+	job.batch = NULL;
+      }
+    }
+
+    pthread_mutex_lock(&m_lock);
+    if(bKeep){
+      // Nobody has room, offer it again in a bit (or to our own host if
+      // it is back by then)
+      struct timeval now;
+      gettimeofday(&now, NULL);
+      struct timespec until;
+      long long nsec = (long long)now.tv_usec*1000 + 
+	MONGOWRITER_RETRY_MS*1000000LL;
+      until.tv_sec = now.tv_sec + nsec/1000000000LL;
+      until.tv_nsec = nsec%1000000000LL;
+      pthread_cond_timedwait(&m_notEmpty, &m_lock, &until);
+      continue;
+    }
+    m_queue.pop_front();
+    m_finished++;
+    if(job.batch != NULL){
+      m_free.push_back(job.batch);
+      if(ret == 0)
+	m_inserts++;
+    }
+    if(bLost)
+      m_bError = true;
+    pthread_cond_broadcast(&m_notFull);
+  }
+  pthread_mutex_unlock(&m_lock);
+}
+
+#endif
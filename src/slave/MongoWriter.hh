@@ -0,0 +1,162 @@
+#ifndef _MONGOWRITER_HH_
+#define _MONGOWRITER_HH_
+
+// ****************************************************************
+//
+// kodiaq Data Acquisition Software
+//
+// File     : MongoWriter.hh
+// Date     : 16.10.2026
+//
+// Brief    : Writes the processors' bulk inserts from a thread of
+//            its own so parsing never waits on the network
+//
+// *****************************************************************
+
+#include <config.h>
+
+#ifdef HAVE_LIBMONGOCLIENT
+
+#include <sys/types.h>
+#include <pthread.h>
+#include <deque>
+#include <vector>
+#include <string>
+#include "mongo/client/dbclient.h"
+#include "BSONBatch.hh"
+
+using namespace std;
+
+class DAQRecorder_mongodb;
+
+/*! \brief Queue depth of one or more writers.
+ */
+struct mongo_writer_stats_t{
+  int        depth;      // Inserts waiting right now
+  int        capacity;   // Inserts that fit in the queue
+  int        peak;       // Largest depth since the last GetStats
+  u_int64_t  stalls;     // Times a processor had to wait for room
+  u_int64_t  inserts;    // Inserts written
+  u_int64_t  spilled;    // Bytes waiting in the spill file
+};
+
+/*! \brief Bounded queue of bulk inserts drained by one writer thread.
+
+    The DAQRecorder_mongodb keeps a pool of these, each with its own 
+    connection to one of the buffer hosts. A processor hands over each
+    finished BSONBatch with Push and goes back to parsing while the writer
+    thread does the insert. Up to capacity inserts can wait, so a slow
+    round trip is absorbed. Push only blocks if the queue is full, so
+    memory stays bounded when the database can't keep up.
+
+    An insert the server turns down goes to the spill file to be tried
+    again (see DAQRecorder_mongodb::InsertFailed).
+
+    If the connection is lost the host is marked as failed and the writer
+    passes its inserts on to another host or the spill file. That handoff
+    never waits: an insert nobody has room for stays at the front of this
+    queue and is offered again a little later, so a lost host can't hold
+    up the writer thread of another one.
+
+    Written batches are cleared and kept for GetBatch, so the buffers
+    cycle between processor and writer without being reallocated. The
+    collection name is only rebuilt when the reset counter or the
+    recorder's collection changes.
+ */
+class MongoWriter
+{
+ public:
+  MongoWriter(DAQRecorder_mongodb *recorder, mongo::DBClientBase *conn,
+	      int ID, int host, unsigned int capacity);
+  virtual ~MongoWriter();
+
+  //
+  // Name     : int MongoWriter::Start()
+  // Purpose  : Start the writer thread. Returns 0 on success.
+  //
+  int           Start();
+  //
+  // Name     : void MongoWriter::Stop()
+  // Purpose  : Write everything still queued and join the thread
+  //
+  void          Stop();
+  //
+  // Name     : int MongoWriter::Push(BSONBatch *batch, int resetCount,
+  //                                   bool bWait, int attempts)
+  // Purpose  : Queue an insert that failed attempts times before (when
+  //            replayed). Ownership of batch passes to the writer
+  //            if it returns 0 or -1. -1 means the writer is not running
+  //            or an insert could not be written anywhere. The batch stays
+  //            with the caller on 1, the queue is full and bWait is not
+  //            set, and on 2, the host has been lost.
+  //
+  int           Push(BSONBatch *batch, int resetCount, bool bWait=true,
+		     int attempts=0);
+  //
+  // Name     : BSONBatch* MongoWriter::GetBatch()
+  // Purpose  : An empty batch to fill, reused if one has been written.
+  //            Owned by the caller until it is given to Push.
+  //
+  BSONBatch*    GetBatch();
+  //
+  // Name     : void MongoWriter::Recycle(BSONBatch *batch)
+  // Purpose  : Keep an empty batch for GetBatch
+  //
+  void          Recycle(BSONBatch *batch);
+  //
+  // Name     : void MongoWriter::GetStats(mongo_writer_stats_t &stats)
+  // Purpose  : Add this writer's numbers to stats and reset the peak
+  //
+  void          GetStats(mongo_writer_stats_t &stats);
+  //
+  // Name     : void MongoWriter::GetProgress(u_int64_t &pushed, u_int64_t &finished)
+  // Purpose  : Inserts queued here so far and inserts that left the queue,
+  //            written or passed on to another host
+  //
+  void          GetProgress(u_int64_t &pushed, u_int64_t &finished);
+  //
+  // Name     : bool MongoWriter::Congested(int latencyMs)
+  // Purpose  : True if the queue is full, or if it isn't empty and the
+  //            last insert took longer than latencyMs (if > 0)
+  //
+  bool          Congested(int latencyMs);
+  //
+  // Name     : void MongoWriter::SetConnection(mongo::DBClientBase *conn)
+  // Purpose  : New connection after the host came back. The old one
+  //            stays with the recorder. Push takes inserts again.
+  //
+  void          SetConnection(mongo::DBClientBase *conn);
+
+ private:
+  struct insert_job_t{
+    BSONBatch  *batch;
+    int         resetCount;
+    int         attempts;
+  };
+
+  static void*  WriteWrapper(void *data);
+  void          WriteThread();
+
+  DAQRecorder_mongodb  *m_recorder;
+  mongo::DBClientBase  *m_conn;
+  int                   m_ID, m_host;
+  unsigned int          m_capacity;
+  pthread_t             m_thread;
+  pthread_mutex_t       m_lock;
+  pthread_cond_t        m_notEmpty, m_notFull;
+  deque<insert_job_t>   m_queue;
+  vector<BSONBatch*>    m_free;
+  // Only used by the writer thread
+  vector<mongo::BSONObj> m_docs;
+  string                m_ns;
+  int                   m_nsResetCount, m_nsVersion;
+  bool                  m_bRunning, m_bStop, m_bError;
+  bool                  m_bLost;          // Until SetConnection
+  unsigned int          m_peak;
+  u_int64_t             m_stalls, m_inserts;
+  u_int64_t             m_pushed, m_finished;
+  u_int64_t             m_lastLatency;    // mus
+};
+
+#endif
+#endif
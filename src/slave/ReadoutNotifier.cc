@@ -0,0 +1,70 @@
+// ****************************************************************
+//
+// kodiaq Data Acquisition Software
+//
+// File     : ReadoutNotifier.cc
+// Date     : 16.10.2026
+//
+// Brief    : Wakes sleeping processing threads when a digitizer
+//            has data ready to be read out
+//
+// *****************************************************************
+
+#include <time.h>
+#include "ReadoutNotifier.hh"
+
+ReadoutNotifier::ReadoutNotifier()
+{
+  pthread_mutex_init(&m_lock, NULL);
+  pthread_cond_init(&m_cond, NULL);
+  m_generation = 0;
+  m_waiters = 0;
+}
+
+ReadoutNotifier::~ReadoutNotifier()
+{
+  pthread_cond_destroy(&m_cond);
+  pthread_mutex_destroy(&m_lock);
+}
+
+void ReadoutNotifier::Signal()
+{
+  m_generation++;
+  if(m_waiters.load() == 0)
+    return;
+  pthread_mutex_lock(&m_lock);
+  pthread_cond_signal(&m_cond);
+  pthread_mutex_unlock(&m_lock);
+}
+
+void ReadoutNotifier::Broadcast()
+{
+  m_generation++;
+  pthread_mutex_lock(&m_lock);
+  pthread_cond_broadcast(&m_cond);
+  pthread_mutex_unlock(&m_lock);
+}
+
+void ReadoutNotifier::Wait(u_int64_t generation, int timeout_ms)
+{
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec  += timeout_ms/1000;
+  deadline.tv_nsec += (long)(timeout_ms%1000)*1000000;
+  if(deadline.tv_nsec >= 1000000000){
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+
+  pthread_mutex_lock(&m_lock);
+  // Announce ourselves before checking the generation. Signal increments
+  // the generation before checking for waiters, so one of the two sides
+  // always sees the other.
+  m_waiters++;
+  while(m_generation.load() == generation){
+    if(pthread_cond_timedwait(&m_cond, &m_lock, &deadline) != 0)
+      break;
+  }
+  m_waiters--;
+  pthread_mutex_unlock(&m_lock);
+}
@@ -0,0 +1,66 @@
+#ifndef _READOUTNOTIFIER_HH_
+#define _READOUTNOTIFIER_HH_
+
+// ****************************************************************
+//
+// kodiaq Data Acquisition Software
+//
+// File     : ReadoutNotifier.hh
+// Date     : 16.10.2026
+//
+// Brief    : Wakes sleeping processing threads when a digitizer
+//            has data ready to be read out
+//
+// *****************************************************************
+
+#include <sys/types.h>
+#include <pthread.h>
+#include <atomic>
+
+/*! \brief Notification between digitizers and processing threads.
+
+    Processors read the generation counter, look through the boards and, if
+    there is nothing to do, call Wait with the generation they read. Wait
+    returns as soon as any board signals after that point, so a signal can
+    not get lost between the scan and the wait. Signal only touches the
+    mutex if somebody is actually sleeping, so the read thread pays two
+    atomic operations when processors are busy anyway.
+ */
+class ReadoutNotifier
+{
+ public:
+  ReadoutNotifier();
+  virtual ~ReadoutNotifier();
+
+  //
+  // Name     : void ReadoutNotifier::Signal()
+  // Purpose  : One board has data ready. Wakes one waiting processor.
+  //
+  void       Signal();
+  //
+  // Name     : void ReadoutNotifier::Broadcast()
+  // Purpose  : Wake all waiting processors (i.e. run state changed)
+  //
+  void       Broadcast();
+  //
+  // Name     : u_int64_t ReadoutNotifier::Generation()
+  // Purpose  : Current signal count. Read before looking for work.
+  //
+  u_int64_t  Generation(){
+    return m_generation.load();
+  };
+  //
+  // Name     : void ReadoutNotifier::Wait(u_int64_t generation, int timeout_ms)
+  // Purpose  : Sleep until the generation moves past the value given or
+  //            the timeout expires.
+  //
+  void       Wait(u_int64_t generation, int timeout_ms);
+
+ private:
+  pthread_mutex_t         m_lock;
+  pthread_cond_t          m_cond;
+  std::atomic<u_int64_t>  m_generation;
+  std::atomic<int>        m_waiters;
+};
+
+#endif
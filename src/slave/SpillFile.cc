@@ -0,0 +1,254 @@
+// ****************************************************************
+//
+// kodiaq Data Acquisition Software
+//
+// File     : SpillFile.cc
+// Date     : 16.10.2026
+//
+// Brief    : Local file that takes inserts while the buffer databases
+//            can't, and feeds them back once they can
+//
+// *****************************************************************
+
+#include "SpillFile.hh"
+
+#ifdef HAVE_LIBMONGOCLIENT
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sstream>
+#include <iomanip>
+#include "DAQRecorder.hh"
+
+#define SPILL_MAGIC            0x4C4C5053   // "SPLL"
+
+SpillFile::SpillFile(DAQRecorder_mongodb *recorder)
+{
+  m_recorder = recorder;
+  m_chunk = 0;
+  m_iSegments = 0;
+  m_readPos = m_pending = 0;
+  m_bOpen = false;
+  m_bRunning = m_bStop = false;
+  pthread_mutex_init(&m_lock, NULL);
+  pthread_cond_init(&m_written, NULL);
+}
+
+SpillFile::~SpillFile()
+{
+  Close();
+  pthread_cond_destroy(&m_written);
+  pthread_mutex_destroy(&m_lock);
+}
+
+int SpillFile::Open(string path, u_int64_t chunk)
+{
+  Close();
+  m_path = path;
+  m_chunk = (chunk < 1048576) ? 1048576 : chunk;
+  m_iSegments = 0;
+  m_readPos = m_pending = 0;
+  if(AddSegment(m_chunk) != 0)
+    return -1;
+  m_bStop = false;
+  m_bOpen = true;
+  if(pthread_create(&m_thread, NULL, SpillFile::ReplayWrapper,
+		    static_cast<void*>(this)) != 0){
+    m_bOpen = false;
+    DropOldest();
+    return -1;
+  }
+  m_bRunning = true;
+  return 0;
+}
+
+void SpillFile::Close()
+{
+  if(m_bRunning){
+    pthread_mutex_lock(&m_lock);
+    m_bStop = true;
+    pthread_cond_broadcast(&m_written);
+    pthread_mutex_unlock(&m_lock);
+    pthread_join(m_thread, NULL);
+    m_bRunning = false;
+  }
+  m_bOpen = false;
+  // Kept if something couldn't be written
+  for(unsigned int x=0; x<m_segments.size(); x++){
+    close(m_segments[x].fd);
+    u_int64_t start = (x == 0) ? m_readPos : 0;
+    if(m_segments[x].written == start)
+      unlink(m_segments[x].name.c_str());
+  }
+  m_segments.clear();
+}
+
+int SpillFile::AddSegment(u_int64_t size)
+{
+  stringstream name;
+  name<<m_path<<"_"<<setfill('0')<<setw(6)<<m_iSegments<<".dat";
+  spill_segment_t seg;
+  seg.name = name.str();
+  seg.allocated = size;
+  seg.written = 0;
+  seg.fd = open(seg.name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if(seg.fd < 0)
+    return -1;
+  if(posix_fallocate(seg.fd, 0, size) != 0){
+    close(seg.fd);
+    unlink(seg.name.c_str());
+    return -1;
+  }
+  m_segments.push_back(seg);
+  m_iSegments++;
+  return 0;
+}
+
+void SpillFile::DropOldest()
+{
+  close(m_segments.front().fd);
+  unlink(m_segments.front().name.c_str());
+  m_segments.pop_front();
+  m_readPos = 0;
+}
+
+int SpillFile::Write(BSONBatch *batch, int resetCount, int host, int attempts)
+{
+  spill_record_t rec;
+  rec.magic = SPILL_MAGIC;
+  rec.size = batch->Bytes();
+  rec.resetCount = resetCount;
+  rec.host = host;
+  rec.attempts = attempts;
+  u_int64_t need = sizeof(rec) + rec.size;
+
+  pthread_mutex_lock(&m_lock);
+  if(!m_bOpen || m_bStop){
+    pthread_mutex_unlock(&m_lock);
+    return -1;
+  }
+  // Records don't span segments. One bigger than a chunk gets its own.
+  if(m_segments.empty() || 
+     m_segments.back().written + need > m_segments.back().allocated){
+    if(AddSegment((need > m_chunk) ? need : m_chunk) != 0){
+      pthread_mutex_unlock(&m_lock);
+      return -1;
+    }
+  }
+  spill_segment_t &seg = m_segments.back();
+  if(pwrite(seg.fd, &rec, sizeof(rec), seg.written) != (ssize_t)sizeof(rec) ||
+     (rec.size > 0 && pwrite(seg.fd, batch->Data(), rec.size,
+			     seg.written + sizeof(rec)) != (ssize_t)rec.size)){
+    pthread_mutex_unlock(&m_lock);
+    return -1;
+  }
+  seg.written += need;
+  m_pending += need;
+  pthread_cond_signal(&m_written);
+  pthread_mutex_unlock(&m_lock);
+  return 0;
+}
+
+u_int64_t SpillFile::Pending()
+{
+  pthread_mutex_lock(&m_lock);
+  u_int64_t ret = m_pending;
+  pthread_mutex_unlock(&m_lock);
+  return ret;
+}
+
+void* SpillFile::ReplayWrapper(void *data)
+{
+  SpillFile *spill = static_cast<SpillFile*>(data);
+  spill->ReplayThread();
+  return data;
+}
+
+void SpillFile::ReplayThread()
+{
+  pthread_mutex_lock(&m_lock);
+  while(true){
+    if(m_pending == 0){
+      if(m_bStop)
+	break;
+      struct timeval now;
+      gettimeofday(&now, NULL);
+      struct timespec until;
+      until.tv_sec = now.tv_sec + 1;
+      until.tv_nsec = now.tv_usec * 1000;
+      pthread_cond_timedwait(&m_written, &m_lock, &until);
+    }
+    bool bStop = m_bStop;
+    bool bPending = (m_pending != 0);
+    pthread_mutex_unlock(&m_lock);
+
+    int ret = 1;
+    if(bPending && m_recorder->CanReplay())
+      ret = ReplayOne();
+    pthread_mutex_lock(&m_lock);
+    if(ret < 0)
+      break;
+    if(ret == 1 && bPending){
+      // Nobody has room. At the end of the run what's left stays.
+      if(bStop)
+	break;
+      pthread_mutex_unlock(&m_lock);
+      usleep(100000);
+      pthread_mutex_lock(&m_lock);
+    }
+  }
+  pthread_mutex_unlock(&m_lock);
+}
+
+int SpillFile::ReplayOne()
+{
+  // Segments the writer has moved on from are done once read
+  pthread_mutex_lock(&m_lock);
+  while(m_segments.size() > 1 && m_readPos == m_segments.front().written)
+    DropOldest();
+  if(m_segments.empty() || m_readPos == m_segments.front().written){
+    pthread_mutex_unlock(&m_lock);
+    return 1;
+  }
+  // Only this thread drops segments and everything before written is on
+  // disk, so the record can be read without the lock
+  int fd = m_segments.front().fd;
+  u_int64_t pos = m_readPos;
+  pthread_mutex_unlock(&m_lock);
+
+  spill_record_t rec;
+  if(pread(fd, &rec, sizeof(rec), pos) != (ssize_t)sizeof(rec) ||
+     rec.magic != SPILL_MAGIC)
+    return -1;
+  if(m_readBuffer.size() < rec.size)
+    m_readBuffer.resize(rec.size);
+  if(rec.size > 0 &&
+     pread(fd, &m_readBuffer[0], rec.size, pos + sizeof(rec)) != (ssize_t)rec.size)
+    return -1;
+
+  BSONBatch *batch = m_recorder->GetBatch(rec.host, rec.host);
+  if(rec.size > 0)
+    batch->AppendDocuments(&m_readBuffer[0], rec.size);
+  // The record stays until a writer has taken it
+  if(m_recorder->ReplayInsert(batch, rec.resetCount, rec.host, 
+			      rec.attempts) != 0)
+    return 1;
+
+  pthread_mutex_lock(&m_lock);
+  m_readPos = pos + sizeof(rec) + rec.size;
+  m_pending -= sizeof(rec) + rec.size;
+  if(m_readPos == m_segments.front().written){
+    if(m_segments.size() > 1)
+      DropOldest();
+    else{
+      // Caught up, reuse the space from the front
+      m_segments.front().written = 0;
+      m_readPos = 0;
+    }
+  }
+  pthread_mutex_unlock(&m_lock);
+  return 0;
+}
+
+#endif
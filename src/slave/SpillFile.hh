@@ -0,0 +1,129 @@
+#ifndef _SPILLFILE_HH_
+#define _SPILLFILE_HH_
+
+// ****************************************************************
+//
+// kodiaq Data Acquisition Software
+//
+// File     : SpillFile.hh
+// Date     : 16.10.2026
+//
+// Brief    : Local file that takes inserts while the buffer databases
+//            can't, and feeds them back once they can
+//
+// *****************************************************************
+
+#include <config.h>
+
+#ifdef HAVE_LIBMONGOCLIENT
+
+#include <sys/types.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include "BSONBatch.hh"
+
+using namespace std;
+
+class DAQRecorder_mongodb;
+
+/*! \brief Append-only files of inserts waiting for the database.
+
+    When every writer for a host is backed up (queue full or inserts
+    slower than spill_latency_ms), no host is left or the server turned
+    an insert down, the recorder writes the insert here instead of
+    blocking the processor or dropping it. Records go into segment files
+    <path>_000000.dat, <path>_000001.dat, ... of chunk bytes each, which
+    are preallocated and written front to back, so spilling costs one
+    sequential write per insert.
+
+    A replay thread reads the records back in order and queues them with
+    the writers whenever one has room again. A segment is deleted as soon
+    as it has been replayed, so under steady spilling the disk only holds
+    what is still waiting plus the segment being written. Once replay has
+    caught up the last segment starts over from the front.
+
+    Each record is a spill_record_t followed by the BSON documents of the
+    insert exactly as they were encoded.
+ */
+class SpillFile
+{
+ public:
+  SpillFile(DAQRecorder_mongodb *recorder);
+  virtual ~SpillFile();
+
+  //
+  // Name     : int SpillFile::Open(string path, u_int64_t chunk)
+  // Purpose  : Create the first segment, preallocate chunk bytes and
+  //            start the replay thread. Returns 0 on success.
+  //
+  int           Open(string path, u_int64_t chunk);
+  //
+  // Name     : void SpillFile::Close()
+  // Purpose  : Replay what can still be written and stop the thread.
+  //            Segments with something left stay on disk.
+  //
+  void          Close();
+  //
+  // Name     : int SpillFile::Write(BSONBatch *batch, int resetCount, int host,
+  //                                 int attempts)
+  // Purpose  : Append an insert that failed attempts times so far. The
+  //            batch stays with the caller. Returns -1 if the file is
+  //            closed or the disk is full.
+  //
+  int           Write(BSONBatch *batch, int resetCount, int host,
+		      int attempts=0);
+  //
+  // Name     : u_int64_t SpillFile::Pending()
+  // Purpose  : Bytes waiting to be replayed
+  //
+  u_int64_t     Pending();
+
+ private:
+  struct spill_record_t{
+    u_int32_t  magic;
+    u_int32_t  size;         // Bytes of documents after this header
+    int32_t    resetCount;
+    int32_t    host;
+    int32_t    attempts;
+  };
+  struct spill_segment_t{
+    string     name;
+    int        fd;
+    u_int64_t  allocated;
+    u_int64_t  written;      // Bytes of records
+  };
+
+  static void*  ReplayWrapper(void *data);
+  void          ReplayThread();
+  //
+  // Name     : int SpillFile::ReplayOne()
+  // Purpose  : Queue the oldest record with a writer. Returns 0 if it was
+  //            taken, 1 if it has to wait and -1 if the file is broken.
+  //
+  int           ReplayOne();
+  // With m_lock held
+  int           AddSegment(u_int64_t size);
+  void          DropOldest();
+
+  DAQRecorder_mongodb  *m_recorder;
+  string                m_path;
+  u_int64_t             m_chunk;
+  // Oldest first, records are appended to the last one
+  deque<spill_segment_t> m_segments;
+  unsigned int          m_iSegments;      // Created so far, for the names
+  // Position in the oldest segment. Only the replay thread moves it and
+  // drops segments.
+  u_int64_t             m_readPos;
+  u_int64_t             m_pending;
+  bool                  m_bOpen;
+  pthread_t             m_thread;
+  pthread_mutex_t       m_lock;
+  pthread_cond_t        m_written;
+  bool                  m_bRunning, m_bStop;
+  vector<char>          m_readBuffer;
+};
+
+#endif
+#endif
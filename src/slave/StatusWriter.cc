@@ -0,0 +1,307 @@
+// ****************************************************************
+//
+// kodiaq Data Acquisition Software
+//
+// File     : StatusWriter.cc
+// Date     : 16.10.2026
+//
+// Brief    : Writes the chunk markers and progress documents to the
+//            buffer databases once the data they stand for is there
+//
+// *****************************************************************
+
+#include "StatusWriter.hh"
+
+#ifdef HAVE_LIBMONGOCLIENT
+
+#include <climits>
+#include "DAQRecorder.hh"
+
+#define STATUS_PASS_MS   50
+
+StatusWriter::StatusWriter(DAQRecorder_mongodb *recorder, int progressMs)
+{
+  m_recorder = recorder;
+  m_iProgressMs = progressMs;
+  gettimeofday(&m_lastProgress, NULL);
+  m_bRunning = m_bStop = false;
+  m_iLeft = 0;
+  pthread_mutex_init(&m_lock, NULL);
+  pthread_cond_init(&m_added, NULL);
+}
+
+StatusWriter::~StatusWriter()
+{
+  Stop();
+  for(unsigned int x=0; x<m_conns.size(); x++)
+    delete m_conns[x];
+  m_conns.clear();
+  pthread_cond_destroy(&m_added);
+  pthread_mutex_destroy(&m_lock);
+}
+
+int StatusWriter::Start()
+{
+  if(m_bRunning)
+    return 0;
+  m_bStop = false;
+  if(pthread_create(&m_thread, NULL, StatusWriter::StatusWrapper,
+		    static_cast<void*>(this)) != 0)
+    return -1;
+  m_bRunning = true;
+  return 0;
+}
+
+int StatusWriter::Stop()
+{
+  if(!m_bRunning)
+    return 0;
+  pthread_mutex_lock(&m_lock);
+  m_bStop = true;
+  pthread_cond_broadcast(&m_added);
+  pthread_mutex_unlock(&m_lock);
+  pthread_join(m_thread, NULL);
+  m_bRunning = false;
+
+  pthread_mutex_lock(&m_lock);
+  m_markers.clear();
+  m_modules.clear();
+  pthread_mutex_unlock(&m_lock);
+  return m_iLeft;
+}
+
+void StatusWriter::AddMarker(int module, long long chunk, long long start,
+			     long long end, bool bComplete)
+{
+  pending_marker_t marker;
+  marker.module = module;
+  marker.chunk = chunk;
+  marker.start = start;
+  marker.end = end;
+  marker.bComplete = bComplete;
+  pthread_mutex_lock(&m_lock);
+  // A chunk closed at the end of the run only needs what was processed
+  module_state_t &state = State(module);
+  marker.need = end - 1;
+  if(state.processed >= 0 && state.processed < marker.need)
+    marker.need = state.processed;
+  m_markers.push_back(marker);
+  pthread_cond_signal(&m_added);
+  pthread_mutex_unlock(&m_lock);
+}
+
+void StatusWriter::SetProcessed(int module, long long time)
+{
+  pthread_mutex_lock(&m_lock);
+  // Processors may report out of order
+  module_state_t &state = State(module);
+  if(time > state.processed)
+    state.processed = time;
+  pthread_mutex_unlock(&m_lock);
+}
+
+StatusWriter::module_state_t& StatusWriter::State(int module)
+{
+  map<int, module_state_t>::iterator it = m_modules.find(module);
+  if(it != m_modules.end())
+    return it->second;
+  module_state_t &state = m_modules[module];
+  state.processed = state.written = state.published = -1;
+  state.bArmed = false;
+  state.armedTime = -1;
+  return state;
+}
+
+void* StatusWriter::StatusWrapper(void *data)
+{
+  StatusWriter *writer = static_cast<StatusWriter*>(data);
+  writer->StatusThread();
+  return data;
+}
+
+void StatusWriter::StatusThread()
+{
+  pthread_mutex_lock(&m_lock);
+  while(!m_bStop){
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    struct timespec until;
+    long long nsec = (long long)now.tv_usec*1000 + STATUS_PASS_MS*1000000LL;
+    until.tv_sec = now.tv_sec + nsec/1000000000LL;
+    until.tv_nsec = nsec%1000000000LL;
+    pthread_cond_timedwait(&m_added, &m_lock, &until);
+    pthread_mutex_unlock(&m_lock);
+    Pass(false);
+    pthread_mutex_lock(&m_lock);
+  }
+  pthread_mutex_unlock(&m_lock);
+  // The writers are done by now, so this is the last chance
+  m_iLeft = Pass(true);
+}
+
+int StatusWriter::Pass(bool bFinal)
+{
+  MoveWatermarks();
+  int left = WriteMarkers();
+  return left + WriteProgress(bFinal);
+}
+
+void StatusWriter::MoveWatermarks()
+{
+  // Read in this order: a processor has its documents in an open insert
+  // before it reports the batch, and spills or queues them before it
+  // gives the insert up.
+  vector<int> modules;
+  vector<long long> processed, open;
+  pthread_mutex_lock(&m_lock);
+  for(map<int, module_state_t>::iterator it = m_modules.begin();
+      it != m_modules.end(); it++){
+    modules.push_back(it->first);
+    processed.push_back(it->second.processed);
+  }
+  pthread_mutex_unlock(&m_lock);
+  for(unsigned int x=0; x<modules.size(); x++)
+    open.push_back(m_recorder->LowestOpenTime(modules[x]));
+  bool bSpillEmpty = (m_recorder->SpillPending() == 0);
+  vector<u_int64_t> pushed, finished;
+  m_recorder->GetWriterProgress(pushed, finished);
+
+  pthread_mutex_lock(&m_lock);
+  for(unsigned int x=0; x<modules.size(); x++){
+    module_state_t &state = m_modules[modules[x]];
+    if(!state.bArmed && bSpillEmpty){
+      long long candidate = processed[x];
+      if(open[x] != LLONG_MAX && open[x] - 1 < candidate)
+	candidate = open[x] - 1;
+      if(candidate > state.written){
+	state.bArmed = true;
+	state.armedTime = candidate;
+	state.pushed = pushed;
+      }
+    }
+    if(!state.bArmed)
+      continue;
+    bool bDone = true;
+    for(unsigned int y=0; y<state.pushed.size() && bDone; y++)
+      if(y >= finished.size() || finished[y] < state.pushed[y])
+	bDone = false;
+    if(bDone){
+      state.written = state.armedTime;
+      state.bArmed = false;
+    }
+  }
+  pthread_mutex_unlock(&m_lock);
+}
+
+int StatusWriter::WriteMarkers()
+{
+  // In order, so one that isn't due holds back the rest
+  while(true){
+    pthread_mutex_lock(&m_lock);
+    if(m_markers.empty()){
+      pthread_mutex_unlock(&m_lock);
+      return 0;
+    }
+    pending_marker_t marker = m_markers.front();
+    if(State(marker.module).written < marker.need){
+      int left = m_markers.size();
+      pthread_mutex_unlock(&m_lock);
+      return left;
+    }
+    pthread_mutex_unlock(&m_lock);
+
+    mongo::BSONObjBuilder builder;
+    builder.append("module", marker.module);
+    builder.append("chunk", marker.chunk);
+    builder.append("start", marker.start);
+    builder.append("end", marker.end);
+    builder.append("complete", marker.bComplete);
+    if(Send(marker.module, "_chunks", builder.obj(), false) != 0){
+      pthread_mutex_lock(&m_lock);
+      int left = m_markers.size();
+      pthread_mutex_unlock(&m_lock);
+      return left;
+    }
+
+    pthread_mutex_lock(&m_lock);
+    m_markers.pop_front();
+    pthread_mutex_unlock(&m_lock);
+  }
+}
+
+int StatusWriter::WriteProgress(bool bForce)
+{
+  if(m_iProgressMs <= 0)
+    return 0;
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  long long elapsed = (now.tv_sec - m_lastProgress.tv_sec)*1000LL + 
+    (now.tv_usec - m_lastProgress.tv_usec)/1000;
+
+  vector<int> modules;
+  vector<long long> times;
+  pthread_mutex_lock(&m_lock);
+  for(map<int, module_state_t>::iterator it = m_modules.begin();
+      it != m_modules.end(); it++){
+    if(it->second.written > it->second.published){
+      modules.push_back(it->first);
+      times.push_back(it->second.written);
+    }
+  }
+  pthread_mutex_unlock(&m_lock);
+  if(modules.size() == 0 || (!bForce && elapsed < m_iProgressMs))
+    return modules.size();
+  m_lastProgress = now;
+
+  int left = 0;
+  for(unsigned int x=0; x<modules.size(); x++){
+    mongo::BSONObjBuilder builder;
+    builder.append("module", modules[x]);
+    builder.append("time", times[x]);
+    if(Send(modules[x], "_progress", builder.obj(), true) != 0){
+      left++;
+      continue;
+    }
+    pthread_mutex_lock(&m_lock);
+    m_modules[modules[x]].published = times[x];
+    pthread_mutex_unlock(&m_lock);
+  }
+  return left;
+}
+
+int StatusWriter::Send(int module, string suffix, mongo::BSONObj obj,
+		       bool bUpsert)
+{
+  // The module's own host, or any other that works
+  string ns = m_recorder->GetCollectionName(-1) + suffix;
+  int host = m_recorder->GetRoute(module);
+  int nHosts = m_recorder->GetHosts();
+  if(m_conns.size() < (unsigned int)nHosts)
+    m_conns.resize(nHosts, NULL);
+  for(int x=0; x<nHosts; x++){
+    int h = (host+x)%nHosts;
+    if(m_recorder->HostFailed(h))
+      continue;
+    if(m_conns[h] == NULL)
+      m_conns[h] = m_recorder->Connect(m_recorder->GetHostAddress(h));
+    if(m_conns[h] == NULL)
+      continue;
+    try{
+      if(bUpsert){
+	mongo::BSONObjBuilder query;
+	query.append("module", module);
+	m_conns[h]->update(ns, mongo::Query(query.obj()), obj, true);
+      }
+      else
+	m_conns[h]->insert(ns, obj);
+      return 0;
+    }
+    catch(const mongo::DBException &){
+      delete m_conns[h];
+      m_conns[h] = NULL;
+    }
+  }
+  return -1;
+}
+
+#endif
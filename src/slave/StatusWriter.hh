@@ -0,0 +1,143 @@
+#ifndef _STATUSWRITER_HH_
+#define _STATUSWRITER_HH_
+
+// ****************************************************************
+//
+// kodiaq Data Acquisition Software
+//
+// File     : StatusWriter.hh
+// Date     : 16.10.2026
+//
+// Brief    : Writes the chunk markers and progress documents to the
+//            buffer databases once the data they stand for is there
+//
+// *****************************************************************
+
+#include <config.h>
+
+#ifdef HAVE_LIBMONGOCLIENT
+
+#include <sys/types.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <deque>
+#include <map>
+#include <vector>
+#include "mongo/client/dbclient.h"
+
+using namespace std;
+
+class DAQRecorder_mongodb;
+
+/*! \brief Thread that writes the "chunk complete" markers and the
+    per-module progress documents.
+
+    Both rest on a watermark per module: the time up to which all of the
+    module's data is in the buffer database. The processors may be done
+    with a time (ModuleProcessed) while its documents still sit in an
+    open insert, a writer queue or the spill file. A watermark T is
+    armed once
+
+    1. the processors are done with the module up to T,
+    2. no processor has an older document of the module in an open
+       insert, see DAQRecorder_mongodb::UpdateProgressDoc, and
+    3. the spill file is empty,
+
+    and taken as written once every writer has finished all inserts it
+    had been given by then. So it lags by up to insert_deadline_ms. Only
+    an insert that moves to another host after its writer lost the
+    connection can still arrive after it.
+
+    Markers go out in the order they came in once their module's
+    watermark has passed them, one document each ({module, chunk, start,
+    end, complete}) in <collection>_chunks. complete is false if a batch
+    of the chunk failed and some of its data is missing. With progress_interval_ms the watermarks
+    that moved are upserted into <collection>_progress ({module, time}),
+    one document per module, at most that often. Both go to the host the
+    module writes to, over a connection of their own.
+ */
+class StatusWriter
+{
+ public:
+  StatusWriter(DAQRecorder_mongodb *recorder, int progressMs);
+  virtual ~StatusWriter();
+
+  int           Start();
+  //
+  // Name     : int StatusWriter::Stop()
+  // Purpose  : Write what can be written and stop the thread. Call after
+  //            the writers are done. Returns the number of markers and
+  //            progress documents left.
+  //
+  int           Stop();
+  //
+  // Name     : void StatusWriter::AddMarker(int module, long long chunk,
+  //                                        long long start, long long end,
+  //                                        bool bComplete)
+  // Purpose  : Queue a marker. Thread safe.
+  //
+  void          AddMarker(int module, long long chunk, long long start,
+			  long long end, bool bComplete);
+  //
+  // Name     : void StatusWriter::SetProcessed(int module, long long time)
+  // Purpose  : The processors are done with the module up to time.
+  //            Thread safe.
+  //
+  void          SetProcessed(int module, long long time);
+
+ private:
+  struct pending_marker_t{
+    int                module;
+    long long          chunk, start, end;
+    bool               bComplete;
+    long long          need;      // Watermark that lets it out
+  };
+  struct module_state_t{
+    long long          processed; // -1 = nothing yet
+    long long          written;   // The watermark, -1 = nothing yet
+    long long          published; // Last one in the progress document
+    bool               bArmed;    // Conditions 1 to 3 met for armedTime
+    long long          armedTime;
+    vector<u_int64_t>  pushed;    // Inserts given to each writer by then
+  };
+
+  static void*  StatusWrapper(void *data);
+  void          StatusThread();
+  //
+  // Name     : int StatusWriter::Pass(bool bFinal)
+  // Purpose  : Move the watermarks and write what is due. The final pass
+  //            writes the progress documents whatever the interval.
+  //            Returns the number of things left.
+  //
+  int           Pass(bool bFinal);
+  void          MoveWatermarks();
+  int           WriteMarkers();
+  int           WriteProgress(bool bForce);
+  // Creates it if needed, call with m_lock held
+  module_state_t& State(int module);
+  //
+  // Name     : int StatusWriter::Send(int module, string suffix,
+  //                                   mongo::BSONObj obj, bool bUpsert)
+  // Purpose  : Write obj to <collection><suffix> on the module's host, or
+  //            on any other that works. An upsert replaces the module's
+  //            document. Returns 0 on success.
+  //
+  int           Send(int module, string suffix, mongo::BSONObj obj,
+		     bool bUpsert);
+
+  DAQRecorder_mongodb            *m_recorder;
+  deque<pending_marker_t>         m_markers;
+  map<int, module_state_t>        m_modules;
+  int                             m_iProgressMs;      // 0 = no progress docs
+  struct timeval                  m_lastProgress;
+  // Connection per host, made when first needed. Only the thread uses them.
+  vector<mongo::DBClientBase*>    m_conns;
+  pthread_t                       m_thread;
+  pthread_mutex_t                 m_lock;
+  pthread_cond_t                  m_added;
+  bool                            m_bRunning, m_bStop;
+  int                             m_iLeft;            // After the final pass
+};
+
+#endif
+#endif
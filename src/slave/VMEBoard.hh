@@ -38,6 +38,9 @@ class VMEBoard
    void SetCrateHandle(int CrateHandle){
       fCrateHandle=CrateHandle;
    };
+   int GetCrateHandle(){
+      return fCrateHandle;
+   };
    board_definition_t GetID()  {
       return fBID;
    };
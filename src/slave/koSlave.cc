@@ -151,9 +151,10 @@ program_start:
 	vector <int> digis;
 	vector <int> sizes;
 	vector <int> counts;
+	vector <int> pools;
 	vector <string> readout_reports;
 	int BufferSize = fElectronics->GetBufferOccupancy(digis, sizes, counts,
-							  readout_reports);
+							  pools, readout_reports);
 	//theGUI.UpdateBufferSize(BufferSize);
 
 	/*if( fDAQOptions.buffer_size_kill != -1 && 
@@ -366,12 +367,15 @@ connection_loop:
 	 vector <int> digis;
 	 vector <int> sizes;
 	 vector <int> counts;
+	 vector <int> pools;
 	 vector <string> readout_reports;
 	 int BufferSize = fElectronics->GetBufferOccupancy(digis, sizes, counts,
-							   readout_reports);
+							   pools, readout_reports);
 
 	 // System monitor
 	 koSysInfo_t systemInfo = sysmon.Get();	 
+	 if(bRunning)
+	   fElectronics->UpdateCompression(systemInfo.cpuPct);
 	 cout<<"CPU: "<<systemInfo.cpuPct<<" RAM_tot: "<<systemInfo.availableRAM<<
 	   " RAM_used: "<<systemInfo.usedRAM<<endl;
 	 cout<<"rate: "<<rate<<" freq: "<<freq<<" iRate: "<<iRate<<" tdiff: "
@@ -384,8 +388,22 @@ connection_loop:
 	 else cout<<"ERROR";
 	 cout<<" Buffer: "<<BufferSize<<endl;
 	 for(unsigned int digi=0; digi<sizes.size(); digi+=1)
-	   cout<<digis[digi]<<": "<<sizes[digi]<<"("<<counts[digi]<<") ";	 
+	   cout<<digis[digi]<<": "<<sizes[digi]<<"("<<counts[digi]<<") ["
+	       <<pools[digi]<<"] ";	 
 	 cout<<endl;
+	 if(bRunning){
+	   int wCapacity=0, wPeak=0;
+	   u_int64_t wStalls=0, wSpilled=0;
+	   int wDepth = fElectronics->GetWriteQueue(wCapacity, wPeak, wStalls,
+						    wSpilled);
+	   if(wDepth >= 0){
+	     cout<<"Write queue: "<<wDepth<<"/"<<wCapacity<<" (peak "<<wPeak
+		 <<", stalls "<<wStalls<<")";
+	     if(wSpilled != 0)
+	       cout<<", spilled "<<wSpilled/1048576.<<" MB";
+	     cout<<endl;
+	   }
+	 }
 
 	 // Check for errors in threads
 	 string err;
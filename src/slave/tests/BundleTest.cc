@@ -0,0 +1,100 @@
+// ****************************************************************
+//
+// kodiaq Data Acquisition Software
+//
+// File     : BundleTest.cc
+// Date     : 16.10.2026
+//
+// Brief    : Checks that bundle documents are cut before they grow
+//            past the bundle limit
+//
+// *****************************************************************
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include "DataProcessor.hh"
+
+using namespace std;
+
+static int g_iFailed = 0;
+
+static void Check(bool ok, string what)
+{
+  if(!ok){
+    cout<<"FAILED: "<<what<<endl;
+    g_iFailed++;
+  }
+}
+
+// Adds pulses the way DataProcessor::ProcessBatch does, cutting the
+// bundle when the next pulse doesn't fit. Returns the number of
+// documents and the largest one's size.
+static int FillBundles(const vector<u_int32_t> &sizes, u_int32_t limit,
+		       bool bBinaryIndex, u_int32_t &largest, u_int32_t &pulses)
+{
+  pulse_block_t block;
+  int documents = 0;
+  largest = pulses = 0;
+  for(unsigned int x=0; x<=sizes.size(); x++){
+    if(block.entries.size() > 0 &&
+       (x == sizes.size() || block.Full(sizes[x], limit, bBinaryIndex))){
+      if(block.Bytes(bBinaryIndex) > largest)
+	largest = block.Bytes(bBinaryIndex);
+      pulses += block.entries.size();
+      documents++;
+      block.entries.clear();
+      block.data.clear();
+    }
+    if(x == sizes.size())
+      break;
+    block_entry_t entry;
+    entry.time = x;
+    entry.length = sizes[x];
+    entry.channel = 0;
+    block.entries.push_back(entry);
+    block.data.insert(block.data.end(), sizes[x], (char)x);
+  }
+  return documents;
+}
+
+int main()
+{
+  Check(BUNDLE_MAX_BYTES < 16*1024*1024, "limit under the 16 MB documents");
+  Check(BundleByteLimit(0) == BUNDLE_MAX_BYTES, "limit without insert_bytes");
+  Check(BundleByteLimit(4194304) == 4194304, "insert_bytes lowers the limit");
+  Check(BundleByteLimit(64*1024*1024) == BUNDLE_MAX_BYTES,
+	"insert_bytes can't raise the limit");
+
+  // A board with 100 MB in one batch, with both kinds of index
+  vector<u_int32_t> sizes(100000, 1000);
+  for(int binary=0; binary<2; binary++){
+    u_int32_t largest = 0, pulses = 0;
+    int documents = FillBundles(sizes, BundleByteLimit(0), binary == 1,
+				largest, pulses);
+    stringstream what;
+    what<<(binary ? "binary index" : "pulses array")<<": "<<documents
+	<<" documents, largest "<<largest<<" bytes";
+    Check(documents > 1, what.str() + ", cut");
+    Check(largest <= BUNDLE_MAX_BYTES, what.str() + ", within the limit");
+    Check(largest > BUNDLE_MAX_BYTES - 1000 -
+	  pulse_block_t::IndexBytes(binary == 1), what.str() + ", filled");
+    Check(pulses == sizes.size(), what.str() + ", all pulses kept");
+  }
+
+  // A pulse bigger than the limit still gets a document of its own
+  vector<u_int32_t> big;
+  big.push_back(100);
+  big.push_back(2000);
+  big.push_back(100);
+  u_int32_t largest = 0, pulses = 0;
+  int documents = FillBundles(big, 1000, true, largest, pulses);
+  Check(documents == 3 && pulses == 3, "oversized pulse alone");
+
+  if(g_iFailed != 0){
+    cout<<g_iFailed<<" checks failed"<<endl;
+    return 1;
+  }
+  cout<<"All checks passed"<<endl;
+  return 0;
+}